@@ -0,0 +1,76 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "GDriveCpp/gDrive.h"
+#include "eventLoop.hpp"
+#include "requestScheduler.hpp"
+
+namespace GCloud::Http {
+    struct BatchRequest {
+        std::string method = "GET";
+        // Path and query relative to https://www.googleapis.com, e.g. "/drive/v3/files/<id>?fields=id"
+        std::string path;
+    };
+
+    struct BatchResponse {
+        long status_code = 0;
+        std::string text;
+    };
+
+    // Coalesces small Drive API calls queued within a short window into multipart/mixed batch requests of
+    // up to maxBatchSize parts, and hands every part of the batch response back to its caller.
+    class BatchScheduler {
+      public:
+        using CompletionCallback = std::function<void(BatchResponse)>;
+        using FailureCallback = EventLoop::FailureCallback;
+
+        BatchScheduler(std::shared_ptr<SessionPool> sessionPool, std::shared_ptr<EventLoop> eventLoop,
+                       std::shared_ptr<RequestScheduler> requestScheduler, const BatchOptions& options);
+        ~BatchScheduler();
+
+        BatchScheduler(const BatchScheduler&) = delete;
+        BatchScheduler& operator=(const BatchScheduler&) = delete;
+
+        // The access token authorizes the whole batch the request ends up in.
+        void submit(BatchRequest request, std::string accessToken, CompletionCallback onComplete,
+                    FailureCallback onFailure);
+
+      private:
+        struct Item {
+            BatchRequest request;
+            CompletionCallback onComplete;
+            FailureCallback onFailure;
+        };
+
+        void run();
+        void flush(std::vector<Item>&& items, const std::string& accessToken);
+
+        std::shared_ptr<SessionPool> _sessionPool;
+        std::shared_ptr<EventLoop> _eventLoop;
+        std::shared_ptr<RequestScheduler> _requestScheduler;
+        BatchOptions _options;
+        std::mutex _mutex;
+        std::condition_variable _condition;
+        std::deque<Item> _queue;
+        std::string _accessToken;
+        bool _stopping = false;
+        std::thread _thread;
+    };
+
+    std::string percentEncode(const std::string_view& value);
+
+    // Splits a multipart/mixed batch response into its parts, indexed by the position of the request in the
+    // batch. Parts missing from the response stay empty.
+    std::vector<std::optional<BatchResponse>> parseBatchResponse(const std::string_view& contentType,
+                                                                 const std::string_view& body, size_t partCount);
+}  // namespace GCloud::Http
@@ -1,10 +1,16 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
+#include <memory>
 #include <nlohmann/json.hpp>
 #include <optional>
 #include <string>
 #include <string_view>
+#include <vector>
+
+#include "GDriveCpp/gDrive.h"
+#include "io.hpp"
 
 namespace GCloud::Cache {
     struct ClientCache {
@@ -54,11 +60,52 @@ namespace GCloud::Cache {
         }
     };
 
+    // Access token shared by every process of a client through a small memory mapped file. Holding the lock from
+    // finding the token stale until the refreshed one is stored makes the other processes wait for that token
+    // instead of asking the token endpoint for their own.
+    class SharedTokenSlot {
+      public:
+        SharedTokenSlot(const std::string_view &clientId, const std::string_view &clientSecret);
+
+        void lock() { _file.lock(); }
+
+        void unlock() { _file.unlock(); }
+
+        // The following require the lock.
+        // Token stored last by any process, null while there is none
+        std::shared_ptr<const Authentication::AccessToken> load();
+        void store(const Authentication::AccessToken &token);
+
+      private:
+        utils::io::SharedMappedFile _file;
+        std::vector<uint8_t> _password;
+        // Decrypted content as of _sequence, handed out again until another store
+        uint64_t _sequence = 0;
+        std::shared_ptr<const Authentication::AccessToken> _token;
+    };
+
     std::filesystem::path getCacheFilePath(const std::string_view &clientId);
+    std::filesystem::path getTokenSlotFilePath(const std::string_view &clientId);
+    std::filesystem::path getPathCacheFilePath(const std::string_view &clientId);
+    std::filesystem::path getChangesFilePath(const std::string_view &clientId);
+    std::filesystem::path getMetadataIndexDirectory(const std::string_view &clientId);
+    // Shared by every client, blobs are addressed by file ID and content version
+    std::filesystem::path getBlobCacheDirectory();
+    // Read and decrypted once per process, later calls are answered from memory
     std::optional<ClientCache> getClientCache(const std::string_view &clientId, const std::string_view &clientSecret);
+    // Rewrites the file, atomically, only when the refresh token changed; access tokens go to the SharedTokenSlot
     void createClientCache(const std::string_view &clientId, const std::string_view &clientSecret,
                            const ClientCache &data);
     void clearClientCache(const std::string_view &clientId);
+    // One slot per client and process
+    std::shared_ptr<SharedTokenSlot> getSharedTokenSlot(const std::string_view &clientId,
+                                                        const std::string_view &clientSecret);
+
+    // Start page tokens of the changes feed, one per drive (empty driveId for the user's corpus)
+    std::optional<std::string> getStartPageToken(const std::string_view &clientId, const std::string_view &driveId);
+    void storeStartPageToken(const std::string_view &clientId, const std::string_view &driveId,
+                             const std::string_view &token);
+    void clearStartPageToken(const std::string_view &clientId, const std::string_view &driveId);
 
 
 }  // namespace GCloud::Cache
\ No newline at end of file
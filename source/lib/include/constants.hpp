@@ -3,3 +3,4 @@
 #include <string_view>
 
 constexpr std::string_view TAB_SPACE = "   ";
+constexpr std::string_view FOLDER_MIME_TYPE = "application/vnd.google-apps.folder";
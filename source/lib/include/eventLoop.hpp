@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cpr/cpr.h>
+#include <curl/curl.h>
+
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include "GDriveCpp/gDrive.h"
+
+namespace GCloud::Http {
+    enum class Method { Get, Post, Put, Patch, Download };
+
+    // Drives many cpr sessions concurrently on a single thread through a libcurl multi handle.
+    // Callbacks run on the loop thread and must not block on other transfers of the same loop.
+    class EventLoop {
+      public:
+        using CompletionCallback = std::function<void(cpr::Response)>;
+        using FailureCallback = std::function<void(std::exception_ptr)>;
+        using Task = std::function<void()>;
+
+        explicit EventLoop(const ConnectionPoolOptions& options);
+        ~EventLoop();
+
+        EventLoop(const EventLoop&) = delete;
+        EventLoop& operator=(const EventLoop&) = delete;
+
+        void submit(std::shared_ptr<cpr::Session> session, Method method, CompletionCallback onComplete,
+                    FailureCallback onFailure);
+        // The body goes to write instead of the response
+        void submitDownload(std::shared_ptr<cpr::Session> session, cpr::WriteCallback write,
+                            CompletionCallback onComplete, FailureCallback onFailure);
+        // Runs task on the loop thread once delay has passed. A task that throws, or is still waiting when the
+        // loop stops, is reported to onFailure.
+        void schedule(std::chrono::steady_clock::duration delay, Task task, FailureCallback onFailure);
+
+        size_t getActiveTransfers() const;
+        bool isLoopThread() const { return std::this_thread::get_id() == _thread.get_id(); }
+
+      private:
+        // Everything the loop thread works on. The thread shares ownership, so a callback may drop the last
+        // reference to the loop: the thread is then left to wind down on its own instead of joining itself.
+        class Core;
+
+        std::shared_ptr<Core> _core;
+        std::thread _thread;
+    };
+}  // namespace GCloud::Http
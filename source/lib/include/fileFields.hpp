@@ -0,0 +1,163 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "GDriveCpp/gFile.h"
+
+namespace GDrive::Fields {
+    enum class Kind : uint8_t { String, Bool, StringList };
+
+    // One JSON member of a Drive file resource and the GFile member it is stored in
+    struct FieldInfo {
+        std::string_view name;
+        GFileField field;
+        Kind kind;
+        std::optional<std::string> GFile::*stringMember = nullptr;
+        std::optional<bool> GFile::*boolMember = nullptr;
+        std::optional<std::vector<std::string>> GFile::*listMember = nullptr;
+    };
+
+    constexpr FieldInfo StringField(std::string_view name, GFileField field,
+                                    std::optional<std::string> GFile::*member) {
+        return FieldInfo{.name = name, .field = field, .kind = Kind::String, .stringMember = member};
+    }
+
+    constexpr FieldInfo BoolField(std::string_view name, GFileField field, std::optional<bool> GFile::*member) {
+        return FieldInfo{.name = name, .field = field, .kind = Kind::Bool, .boolMember = member};
+    }
+
+    constexpr FieldInfo StringListField(std::string_view name, GFileField field,
+                                        std::optional<std::vector<std::string>> GFile::*member) {
+        return FieldInfo{.name = name, .field = field, .kind = Kind::StringList, .listMember = member};
+    }
+
+    inline constexpr std::array FIELDS = {
+            StringField("kind", GFileField::kind, &GFile::kind),
+            StringField("driveId", GFileField::driveId, &GFile::driveId),
+            StringField("fileExtension", GFileField::fileExtension, &GFile::fileExtension),
+            BoolField("copyRequiresWriterPermission", GFileField::copyRequiresWriterPermission,
+                      &GFile::copyRequiresWriterPermission),
+            StringField("md5Checksum", GFileField::md5Checksum, &GFile::md5Checksum),
+            BoolField("writersCanShare", GFileField::writersCanShare, &GFile::writersCanShare),
+            BoolField("viewedByMe", GFileField::viewedByMe, &GFile::viewedByMe),
+            StringField("mimeType", GFileField::mimeType, &GFile::mimeType),
+            StringListField("parents", GFileField::parents, &GFile::parents),
+            StringField("thumbnailLink", GFileField::thumbnailLink, &GFile::thumbnailLink),
+            StringField("iconLink", GFileField::iconLink, &GFile::iconLink),
+            BoolField("shared", GFileField::shared, &GFile::shared),
+            StringField("headRevisionId", GFileField::headRevisionId, &GFile::headRevisionId),
+            StringField("webViewLink", GFileField::webViewLink, &GFile::webViewLink),
+            StringField("webContentLink", GFileField::webContentLink, &GFile::webContentLink),
+            StringField("size", GFileField::size, &GFile::size),
+            BoolField("viewersCanCopyContent", GFileField::viewersCanCopyContent, &GFile::viewersCanCopyContent),
+            BoolField("hasThumbnail", GFileField::hasThumbnail, &GFile::hasThumbnail),
+            StringListField("spaces", GFileField::spaces, &GFile::spaces),
+            StringField("folderColorRgb", GFileField::folderColorRgb, &GFile::folderColorRgb),
+            StringField("id", GFileField::id, &GFile::id),
+            StringField("name", GFileField::name, &GFile::name),
+            StringField("description", GFileField::description, &GFile::description),
+            BoolField("starred", GFileField::starred, &GFile::starred),
+            BoolField("trashed", GFileField::trashed, &GFile::trashed),
+            BoolField("explicitlyTrashed", GFileField::explicitlyTrashed, &GFile::explicitlyTrashed),
+            StringField("createdTime", GFileField::createdTime, &GFile::createdTime),
+            StringField("modifiedTime", GFileField::modifiedTime, &GFile::modifiedTime),
+            StringField("modifiedByMeTime", GFileField::modifiedByMeTime, &GFile::modifiedByMeTime),
+            StringField("viewedByMeTime", GFileField::viewedByMeTime, &GFile::viewedByMeTime),
+            StringField("sharedWithMeTime", GFileField::sharedWithMeTime, &GFile::sharedWithMeTime),
+            StringField("quotaBytesUsed", GFileField::quotaBytesUsed, &GFile::quotaBytesUsed),
+            StringField("version", GFileField::version, &GFile::version),
+            StringField("originalFilename", GFileField::originalFilename, &GFile::originalFilename),
+            BoolField("ownedByMe", GFileField::ownedByMe, &GFile::ownedByMe),
+            StringField("fullFileExtension", GFileField::fullFileExtension, &GFile::fullFileExtension),
+            BoolField("isAppAuthorized", GFileField::isAppAuthorized, &GFile::isAppAuthorized),
+            StringField("teamDriveId", GFileField::teamDriveId, &GFile::teamDriveId),
+            BoolField("hasAugmentedPermissions", GFileField::hasAugmentedPermissions, &GFile::hasAugmentedPermissions),
+            StringField("thumbnailVersion", GFileField::thumbnailVersion, &GFile::thumbnailVersion),
+            StringField("trashedTime", GFileField::trashedTime, &GFile::trashedTime),
+            BoolField("modifiedByMe", GFileField::modifiedByMe, &GFile::modifiedByMe),
+            StringListField("permissionIds", GFileField::permissionIds, &GFile::permissionIds),
+            StringField("resourceKey", GFileField::resourceKey, &GFile::resourceKey),
+            StringField("sha1Checksum", GFileField::sha1Checksum, &GFile::sha1Checksum),
+            StringField("sha256Checksum", GFileField::sha256Checksum, &GFile::sha256Checksum),
+            BoolField("inheritedPermissionsDisabled", GFileField::inheritedPermissionsDisabled,
+                      &GFile::inheritedPermissionsDisabled),
+    };
+
+    // FIELDS is indexed by GFileField, so a mask bit and its table entry share the same position
+    constexpr bool fieldsMatchEnum() {
+        if (FIELDS.size() != static_cast<size_t>(GFileField::Count)) return false;
+        for (size_t i = 0; i < FIELDS.size(); ++i) {
+            if (static_cast<size_t>(FIELDS[i].field) != i) return false;
+        }
+        return true;
+    }
+    static_assert(fieldsMatchEnum(), "FIELDS must list every GFileField in enum order");
+
+    constexpr const FieldInfo& fieldInfo(GFileField field) { return FIELDS[static_cast<size_t>(field)]; }
+
+    constexpr char toLower(char c) { return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c; }
+
+    // FNV-1a over the lower-cased name, field names are matched case-insensitively
+    constexpr uint32_t hashName(std::string_view name) {
+        uint32_t hash = 2166136261u;
+        for (char c : name) {
+            hash ^= static_cast<uint8_t>(toLower(c));
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    constexpr bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (toLower(a[i]) != toLower(b[i])) return false;
+        }
+        return true;
+    }
+
+    // Open addressing table built at compile time; slots hold an index into FIELDS, or -1 when empty
+    inline constexpr size_t SLOT_COUNT = 256;
+    static_assert(SLOT_COUNT >= FIELDS.size() * 4 && (SLOT_COUNT & (SLOT_COUNT - 1)) == 0);
+
+    struct SlotTable {
+        std::array<int16_t, SLOT_COUNT> slots{};
+        size_t longestProbe = 0;
+    };
+
+    constexpr SlotTable buildSlotTable() {
+        SlotTable table;
+        for (auto& slot : table.slots) slot = -1;
+        for (size_t i = 0; i < FIELDS.size(); ++i) {
+            size_t slot = hashName(FIELDS[i].name) & (SLOT_COUNT - 1);
+            size_t probe = 0;
+            while (table.slots[slot] != -1) {
+                slot = (slot + 1) & (SLOT_COUNT - 1);
+                ++probe;
+            }
+            table.slots[slot] = static_cast<int16_t>(i);
+            if (probe > table.longestProbe) table.longestProbe = probe;
+        }
+        return table;
+    }
+
+    inline constexpr SlotTable SLOTS = buildSlotTable();
+    static_assert(SLOTS.longestProbe <= 2, "Field name hashes cluster too much, grow SLOT_COUNT");
+
+    constexpr const FieldInfo* findField(std::string_view name) {
+        size_t slot = hashName(name) & (SLOT_COUNT - 1);
+        for (size_t probe = 0; probe <= SLOTS.longestProbe; ++probe) {
+            int16_t index = SLOTS.slots[slot];
+            if (index < 0) return nullptr;
+            if (equalsIgnoreCase(FIELDS[index].name, name)) return &FIELDS[index];
+            slot = (slot + 1) & (SLOT_COUNT - 1);
+        }
+        return nullptr;
+    }
+
+    static_assert(findField("id") != nullptr && findField("mimetype") != nullptr && findField("unknown") == nullptr);
+}  // namespace GDrive::Fields
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cpr/cpr.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "GDriveCpp/gFile.h"
+#include "fileFields.hpp"
+
+namespace GDrive {
+    // Query parameters of a files.list request, shared by direct and batched requests
+    std::vector<std::pair<std::string, std::string>> makeListQuery(const GFileListRequest& request);
+    std::shared_ptr<cpr::Session> makeListSession(GCloud::Authentication::OAuthAgent& agent,
+                                                  const GFileListRequest& request);
+
+    // Copies the members of a parsed file resource into a GFile, for responses that are small enough to be
+    // parsed into a DOM (files.get, uploads, changes)
+    void applyJsonFields(GFile& file, const nlohmann::json& item);
+
+    // Receives the members of the files of a listing in document order
+    class FileListSink {
+      public:
+        virtual ~FileListSink() = default;
+
+        virtual void beginFile() = 0;
+        // Values may be moved from
+        virtual void setString(const Fields::FieldInfo& field, std::string& value) = 0;
+        virtual void setBool(const Fields::FieldInfo& field, bool value) = 0;
+        virtual void beginList(const Fields::FieldInfo& field) = 0;
+        virtual void addListItem(std::string& value) = 0;
+        virtual void endFile() = 0;
+    };
+
+    // Builds a GFile per entry and hands it to the callback once it is complete
+    class GFileSink : public FileListSink {
+      public:
+        using FileCallback = std::function<void(std::shared_ptr<GFile>)>;
+
+        GFileSink(std::weak_ptr<GCloud::Authentication::OAuthAgent> client, FileCallback onFile);
+
+        void beginFile() override;
+        void setString(const Fields::FieldInfo& field, std::string& value) override;
+        void setBool(const Fields::FieldInfo& field, bool value) override;
+        void beginList(const Fields::FieldInfo& field) override;
+        void addListItem(std::string& value) override;
+        void endFile() override;
+
+      private:
+        std::weak_ptr<GCloud::Authentication::OAuthAgent> _client;
+        FileCallback _onFile;
+        std::shared_ptr<GFile> _file;
+        std::vector<std::string>* _list = nullptr;
+    };
+
+    // nlohmann SAX handler for a files.list response. Members are passed to the sink while the document is
+    // read, so no DOM is created. With a non-empty mask, members outside of it are skipped without being stored.
+    class FileListSaxHandler {
+      public:
+        explicit FileListSaxHandler(FileListSink& sink, const GFileFieldMask& fields = {});
+
+        bool null();
+        bool boolean(bool value);
+        bool number_integer(nlohmann::json::number_integer_t value);
+        bool number_unsigned(nlohmann::json::number_unsigned_t value);
+        bool number_float(nlohmann::json::number_float_t value, const std::string& text);
+        bool string(std::string& value);
+        bool binary(nlohmann::json::binary_t& value);
+        bool start_object(std::size_t elements);
+        bool key(std::string& name);
+        bool end_object();
+        bool start_array(std::size_t elements);
+        bool end_array();
+        bool parse_error(std::size_t position, const std::string& token, const nlohmann::detail::exception& error);
+
+        // Throws if the document was malformed or did not contain a files array
+        void validate(bool parsed) const;
+
+        std::string& getNextPageToken() { return _nextPageToken; }
+
+      private:
+        // Depth of the parser inside the response: 1 = response object, 2 = files array, 3 = file, 4 = list member
+        enum Depth : size_t { Response = 1, FilesArray = 2, File = 3, FileList = 4 };
+
+        bool skipValue();
+
+        FileListSink& _sink;
+        GFileFieldMask _fields;
+        size_t _depth = 0;
+        size_t _skipDepth = 0;  // > 0 while inside a nested value nothing is read from
+        std::string _responseKey;
+        const Fields::FieldInfo* _field = nullptr;
+        std::string _nextPageToken;
+        bool _sawFiles = false;
+        std::string _error;
+    };
+
+    // Stream buffer fed from a transfer callback on one thread and read through std::istream on another.
+    // The number of buffered bytes is bounded so a slow reader throttles the transfer instead of growing memory.
+    class ChunkStreamBuffer : public std::streambuf {
+      public:
+        explicit ChunkStreamBuffer(size_t maxBufferedBytes = 4 * 1024 * 1024);
+
+        // Returns false once the reader stopped, so the writer can abort the transfer
+        bool push(std::string_view data);
+        // Marks the end of input; the reader sees EOF after the queued chunks
+        void close();
+        // Called by the reader when it will not read any further
+        void stopReading();
+
+      protected:
+        int_type underflow() override;
+
+      private:
+        std::mutex _mutex;
+        std::condition_variable _readable;
+        std::condition_variable _writable;
+        std::deque<std::string> _chunks;
+        std::string _current;
+        size_t _bufferedBytes = 0;
+        size_t _maxBufferedBytes;
+        bool _closed = false;
+        bool _readerStopped = false;
+    };
+
+    // Performs the GET on the calling thread and parses the body on a helper thread while it arrives.
+    // The body of a non 200 response is not parsed and returned in Response::text instead.
+    cpr::Response streamFileList(cpr::Session& session, FileListSaxHandler& handler);
+
+    // Parses an already received files.list body
+    void parseFileList(std::string_view body, FileListSaxHandler& handler);
+}  // namespace GDrive
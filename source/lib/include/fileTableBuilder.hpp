@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "GDriveCpp/gFileTable.h"
+#include "fileFields.hpp"
+#include "fileListParser.hpp"
+
+namespace GDrive {
+    // Appends the files of a listing to a GFileTable. Members arrive in document order and are collected per
+    // file, then written as one record with an exactly sized slot array in field order.
+    class GFileTableBuilder : public FileListSink {
+      public:
+        explicit GFileTableBuilder(GFileTable& table);
+
+        void beginFile() override;
+        void setString(const Fields::FieldInfo& field, std::string& value) override;
+        void setBool(const Fields::FieldInfo& field, bool value) override;
+        void beginList(const Fields::FieldInfo& field) override;
+        void addListItem(std::string& value) override;
+        void endFile() override;
+
+        void setString(GFileField field, std::string_view value);
+        void beginList(GFileField field);
+        void addListItem(std::string_view value);
+
+      private:
+        GFileTable& _table;
+        GFileTable::Record _record;
+        std::array<GFileTable::Slot, static_cast<size_t>(GFileField::Count)> _pending;
+        // List items of the current file, copied into the arena by endFile
+        std::vector<std::string_view> _items;
+        std::array<size_t, static_cast<size_t>(GFileField::Count)> _listStart;
+        size_t _list = 0;
+        bool _internList = false;
+    };
+}  // namespace GDrive
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "GDriveCpp/gFile.h"
+#include "GDriveCpp/gFileTable.h"
+#include "GDriveCpp/queryBuilder.h"
+#include "fileFields.hpp"
+#include "queryLogic.hpp"
+
+namespace GDrive {
+    // Condition tree of a QueryBuilder compiled for evaluation against metadata held locally. Follows the server
+    // semantics for the members of GFile:
+    //  - strings compare byte wise, which orders RFC 3339 timestamps correctly; integer members (size,
+    //    quotaBytesUsed, version, thumbnailVersion) compare as numbers
+    //  - contains matches case insensitively: a prefix of the name or of one of its words for name, as the server
+    //    does, a substring for other members. starts_with and ends_with are case sensitive
+    //  - in matches when a list member holds one of the values, or a single valued member equals one of them
+    //  - a condition on a missing member only holds for !=
+    class QueryEvaluator {
+      public:
+        // Throws std::invalid_argument for conditions on members GFile does not have (fullText, properties, ...)
+        // or operators that do not apply to the member
+        explicit QueryEvaluator(const QueryTree& tree);
+
+        // Evaluator of the builder's current conditions, compiled once and shared until the builder changes
+        static std::shared_ptr<const QueryEvaluator> Of(const QueryBuilder& query);
+
+        bool matches(const GFile& file) const;
+        bool matches(const GFileView& file) const;
+        // One bit per table entry. Conditions are applied one at a time over all entries still in question,
+        // booleans straight from the packed record bits.
+        std::vector<uint64_t> filter(const GFileTable& table) const;
+
+        // Operands of top level conditions every match must satisfy, used to narrow index lookups
+        const std::optional<std::string>& requiredParent() const { return _requiredParent; }
+
+        const std::optional<std::string>& requiredName() const { return _requiredName; }
+
+      private:
+        struct Predicate {
+            const Fields::FieldInfo* field = nullptr;
+            QueryBuilder::ComparisonOperator op = QueryBuilder::ComparisonOperator::Equal;
+            std::vector<std::string> values;
+            // Parsed operands of integer members, parallel to values
+            std::vector<int64_t> numbers;
+            bool numeric = false;
+            bool boolean = false;
+        };
+
+        struct Node {
+            enum class Kind { And, Or, Predicate } kind = Kind::And;
+            std::vector<Node> children;
+            Predicate predicate;
+        };
+
+        using Bitmap = std::vector<uint64_t>;
+
+        static Node compileBlock(const QueryTree& tree, uint32_t index);
+        static Predicate compileCondition(const QueryTree& tree, const QueryNode& condition);
+
+        // op replaces the predicate's operator, a list decides != by testing its items with ==
+        static bool testString(const Predicate& predicate, QueryBuilder::ComparisonOperator op,
+                               std::optional<std::string_view> value);
+        static bool testBool(const Predicate& predicate, std::optional<bool> value);
+        template <typename Items>
+        static bool testList(const Predicate& predicate, bool present, const Items& items);
+
+        template <typename Source>
+        static bool evaluate(const Node& node, const Source& source);
+        static bool testPredicate(const Predicate& predicate, const GFile& file);
+        static bool testPredicate(const Predicate& predicate, const GFileView& file);
+
+        static Bitmap evaluate(const Node& node, const GFileTable& table, const Bitmap& candidates);
+        static Bitmap evaluate(const Predicate& predicate, const GFileTable& table, const Bitmap& candidates);
+
+        Node _root;
+        std::optional<std::string> _requiredParent;
+        std::optional<std::string> _requiredName;
+    };
+}  // namespace GDrive
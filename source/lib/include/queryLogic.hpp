@@ -1,84 +1,265 @@
 #pragma once
 
 #include <array>
+#include <cstdint>
 #include <format>
+#include <span>
+#include <stdexcept>
 #include <string>
 #include <string_view>
-#include <variant>
 #include <vector>
 
 #include "GDriveCpp/queryBuilder.h"
+#include "fileFields.hpp"
 
 namespace GDrive {
-    std::string ComparisonOperatorToString(QueryBuilder::ComparisonOperator op) {
+    inline std::string_view ComparisonOperatorToString(QueryBuilder::ComparisonOperator op) {
         static constexpr std::array<std::string_view, 10> operators = {
             "=", "!=", ">", "<", ">=", "<=", "contains", "in", "starts_with", "ends_with"};
         if (op < QueryBuilder::ComparisonOperator::Equal || op > QueryBuilder::ComparisonOperator::EndsWith) return "";
-        return std::string(operators[static_cast<size_t>(op)]);
+        return operators[static_cast<size_t>(op)];
     }
 
-    struct Condition {
-        std::string field;
-        QueryBuilder::ComparisonOperator op;
-        std::string value;
+    // Characters Drive requires to be escaped inside a quoted string
+    inline size_t escapedSize(std::string_view value) {
+        size_t size = value.size();
+        for (char c : value) size += c == '\'' || c == '\\';
+        return size;
+    }
+
+    inline void appendEscaped(std::string& out, std::string_view value) {
+        size_t start = 0;
+        for (size_t i = 0; i < value.size(); ++i) {
+            if (value[i] != '\'' && value[i] != '\\') continue;
+            out.append(value.substr(start, i - start));
+            out += '\\';
+            start = i;
+        }
+        out.append(value.substr(start));
+    }
+
+    // Operand left open by a parameter, to be filled in at offset of the serialized query
+    struct QueryPlaceholder {
+        size_t offset;
+        std::string_view name;
+    };
+
+    // Part of QueryTree::text
+    struct TextRange {
+        uint32_t offset = 0;
+        uint32_t size = 0;
+        // Bytes reserved for the range, a replacement that fits is written in place
+        uint32_t capacity = 0;
+    };
+
+    struct QueryNode {
+        static constexpr uint32_t NONE = UINT32_MAX;
+
+        enum class Type : uint8_t { And, Or, Condition };
+
+        Type type = Type::And;
+        QueryBuilder::ComparisonOperator op = QueryBuilder::ComparisonOperator::Equal;
+        // Condition built from a list of values
+        bool list = false;
+        // Condition whose single operand is the name of a parameter bound later
+        bool parameter = false;
+        uint32_t parent = NONE;
+        uint32_t firstChild = NONE;
+        uint32_t lastChild = NONE;
+        uint32_t nextSibling = NONE;
+        // Children that serialize to something; blocks without any are left out of the query
+        uint32_t liveChildren = 0;
+        // Condition only: the field and a range of QueryTree::operands
+        TextRange field;
+        uint32_t firstOperand = 0;
+        uint32_t operandCount = 0;
+    };
+
+    // Query tree kept in flat arrays. Nodes refer to each other by index and all strings share one buffer, so
+    // adding a condition appends to three vectors and nothing is allocated per node. Node 0 is the root And
+    // block, and children always come after their parent.
+    class QueryTree {
+      public:
+        QueryTree() { _nodes.push_back(QueryNode{}); }
 
-        Condition(const std::string& field, QueryBuilder::ComparisonOperator op, const std::string& value)
-            : field(field), op(op), value(value) {}
+        uint32_t addBlock(uint32_t parent, QueryNode::Type type) {
+            QueryNode node{.type = type};
+            return link(parent, std::move(node));
+        }
+
+        uint32_t addCondition(uint32_t parent, std::string_view field, QueryBuilder::ComparisonOperator op,
+                              std::span<const std::string> values, bool list, bool parameter = false) {
+            QueryNode node{.type = QueryNode::Type::Condition, .op = op, .list = list, .parameter = parameter};
+            if (parameter) ++_parameters;
+            node.field = store(field);
+            node.firstOperand = static_cast<uint32_t>(_operands.size());
+            node.operandCount = static_cast<uint32_t>(values.size());
+            for (const auto& value : values) _operands.push_back(store(value));
+            uint32_t index = link(parent, std::move(node));
+            markLive(index);
+            return index;
+        }
 
-        Condition(const std::string& field, QueryBuilder::ComparisonOperator op, std::vector<std::string> values)
-            : field(field), op(op), value("") {
-            if (op != QueryBuilder::ComparisonOperator::In) {
-                throw std::invalid_argument("Invalid operator for multiple values");
+        // Replaces one operand of a condition, in place when the new value fits into the old one's bytes
+        void setOperand(uint32_t condition, uint32_t operand, std::string_view value) {
+            TextRange& range = _operands[_nodes[condition].firstOperand + operand];
+            if (value.size() <= range.capacity) {
+                _text.replace(range.offset, value.size(), value);
+                range.size = static_cast<uint32_t>(value.size());
+                return;
             }
-            if (values.empty()) {
-                value = "()";
+            range = store(value);
+        }
+
+        const std::vector<QueryNode>& nodes() const { return _nodes; }
+
+        const QueryNode& node(uint32_t index) const { return _nodes[index]; }
+
+        std::string_view text(const TextRange& range) const {
+            return std::string_view(_text).substr(range.offset, range.size);
+        }
+
+        std::string_view field(const QueryNode& node) const { return text(node.field); }
+
+        std::string_view operand(const QueryNode& node, uint32_t index) const {
+            return text(_operands[node.firstOperand + index]);
+        }
+
+        bool hasParameters() const { return _parameters != 0; }
+
+        // Appends the query string to out. The exact length is measured first, so out grows at most once.
+        // Parameters are left out and reported through placeholders, which must be given when there are any.
+        void serialize(std::string& out, std::vector<QueryPlaceholder>* placeholders = nullptr) const {
+            if (hasParameters() && !placeholders) {
+                throw std::logic_error("Query has parameters, compile it into a QueryTemplate to bind them");
             }
-            value = "(";
-            for (auto it = values.begin(); it != prev(values.end()); it++) {
-                value += std::format("'{}',", *it);
+            out.reserve(out.size() + measure(0));
+            write(0, out, placeholders);
+        }
+
+      private:
+        uint32_t link(uint32_t parent, QueryNode&& node) {
+            auto index = static_cast<uint32_t>(_nodes.size());
+            node.parent = parent;
+            QueryNode& owner = _nodes[parent];
+            if (owner.lastChild == QueryNode::NONE) {
+                owner.firstChild = index;
+            } else {
+                _nodes[owner.lastChild].nextSibling = index;
             }
-            value += std::format("'{}')", values.back());
+            owner.lastChild = index;
+            _nodes.push_back(std::move(node));
+            return index;
         }
 
-        std::string toString() const { return std::format("{} {} '{}'", field, ComparisonOperatorToString(op), value); }
-    };
+        // A block becomes live with its first live child, which may make its parent live in turn
+        void markLive(uint32_t index) {
+            for (uint32_t parent = _nodes[index].parent; parent != QueryNode::NONE; parent = _nodes[parent].parent) {
+                if (_nodes[parent].liveChildren++ != 0) break;
+            }
+        }
 
-    struct LogicBlock {
-        std::vector<std::variant<std::shared_ptr<Condition>, std::shared_ptr<LogicBlock>>> conditions;
-        enum class Type { And, Or } type;
-        LogicBlock() = default;
-
-        LogicBlock(Type type) : type(type) {}
-
-        void AddCondition(std::shared_ptr<Condition> condition) { conditions.push_back(condition); }
-
-        void AddLogicBlock(std::shared_ptr<LogicBlock> block) { conditions.push_back(block); }
-
-        std::string toString() const {
-            std::string result;
-            std::vector<std::string> conditionStrings;
-            for (const auto& cond : conditions) {
-                if (std::holds_alternative<std::shared_ptr<Condition>>(cond)) {
-                    std::string s = std::get<std::shared_ptr<Condition>>(cond)->toString();
-                    if (s.empty()) continue;
-                    conditionStrings.emplace_back(s);
-                } else if (std::holds_alternative<std::shared_ptr<LogicBlock>>(cond)) {
-                    std::string s = std::get<std::shared_ptr<LogicBlock>>(cond)->toString();
-                    if (s.empty()) continue;
-                    conditionStrings.emplace_back(s);
-                }
+        TextRange store(std::string_view value) {
+            TextRange range{.offset = static_cast<uint32_t>(_text.size()),
+                            .size = static_cast<uint32_t>(value.size()),
+                            .capacity = static_cast<uint32_t>(value.size())};
+            _text.append(value);
+            return range;
+        }
+
+        bool live(const QueryNode& node) const { return node.type == QueryNode::Type::Condition || node.liveChildren; }
+
+        static std::string_view separator(const QueryNode& block) {
+            return block.type == QueryNode::Type::And ? " and " : " or ";
+        }
+
+        size_t operandSize(const QueryNode& node, uint32_t index) const {
+            return node.parameter ? 0 : escapedSize(operand(node, index));
+        }
+
+        // Drive compares boolean fields to the bare literals true and false, a quoted one is a string
+        bool bare(const QueryNode& node) const {
+            if (node.parameter || node.list || node.op == QueryBuilder::ComparisonOperator::In) return false;
+            auto value = operand(node, 0);
+            if (value != "true" && value != "false") return false;
+            const Fields::FieldInfo* info = Fields::findField(field(node));
+            return info && info->kind == Fields::Kind::Bool;
+        }
+
+        size_t measure(uint32_t index) const {
+            const QueryNode& node = _nodes[index];
+            if (node.type == QueryNode::Type::Condition && node.op == QueryBuilder::ComparisonOperator::In) {
+                // 'a' in field, or ('a' in field or 'b' in field)
+                size_t size = node.operandCount > 1 ? 2 + (node.operandCount - 1) * 4 : 0;
+                for (uint32_t i = 0; i < node.operandCount; ++i) size += operandSize(node, i) + 6 + field(node).size();
+                return size;
+            }
+            if (node.type == QueryNode::Type::Condition) {
+                // field op 'value', or field op value
+                return field(node).size() + ComparisonOperatorToString(node.op).size() + (bare(node) ? 2 : 4) +
+                       operandSize(node, 0);
+            }
+            size_t size = node.liveChildren > 1 ? 2 + (node.liveChildren - 1) * separator(node).size() : 0;
+            for (uint32_t child = node.firstChild; child != QueryNode::NONE; child = _nodes[child].nextSibling) {
+                if (live(_nodes[child])) size += measure(child);
+            }
+            return size;
+        }
+
+        void writeOperand(const QueryNode& node, uint32_t index, std::string& out,
+                          std::vector<QueryPlaceholder>* placeholders) const {
+            if (node.parameter) {
+                placeholders->push_back(QueryPlaceholder{.offset = out.size(), .name = operand(node, index)});
+                return;
             }
+            appendEscaped(out, operand(node, index));
+        }
 
-            if (conditionStrings.empty()) return "";
-            if (conditionStrings.size() == 1) {
-                return conditionStrings[0];
+        void write(uint32_t index, std::string& out, std::vector<QueryPlaceholder>* placeholders) const {
+            const QueryNode& node = _nodes[index];
+            if (node.type == QueryNode::Type::Condition && node.op == QueryBuilder::ComparisonOperator::In) {
+                // Drive only knows `'value' in collection`, a list matches when any of its values does
+                bool grouped = node.operandCount > 1;
+                if (grouped) out += '(';
+                for (uint32_t i = 0; i < node.operandCount; ++i) {
+                    if (i > 0) out.append(" or ");
+                    out += '\'';
+                    writeOperand(node, i, out, placeholders);
+                    out.append("' in ");
+                    out.append(field(node));
+                }
+                if (grouped) out += ')';
+                return;
             }
-            result += "(";
-            for (size_t i = 0; i < conditionStrings.size() - 1; ++i) {
-                result += std::format("{} {} ", conditionStrings[i], type == Type::And ? "and" : "or");
+            if (node.type == QueryNode::Type::Condition) {
+                out.append(field(node));
+                out += ' ';
+                out.append(ComparisonOperatorToString(node.op));
+                if (bare(node)) {
+                    out += ' ';
+                    out.append(operand(node, 0));
+                    return;
+                }
+                out.append(" '");
+                writeOperand(node, 0, out, placeholders);
+                out += '\'';
+                return;
+            }
+            bool grouped = node.liveChildren > 1;
+            if (grouped) out += '(';
+            bool first = true;
+            for (uint32_t child = node.firstChild; child != QueryNode::NONE; child = _nodes[child].nextSibling) {
+                if (!live(_nodes[child])) continue;
+                if (!first) out.append(separator(node));
+                first = false;
+                write(child, out, placeholders);
             }
-            result += conditionStrings.back() + ")";
-            return result;
+            if (grouped) out += ')';
         }
+
+        std::vector<QueryNode> _nodes;
+        std::vector<TextRange> _operands;
+        std::string _text;
+        size_t _parameters = 0;
     };
-}  // namespace GDrive
\ No newline at end of file
+}  // namespace GDrive
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cpr/cpr.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "GDriveCpp/gDrive.h"
+#include "eventLoop.hpp"
+
+namespace GCloud::Http {
+    // Request rate and concurrency shared by the schedulers of many clients. Every member gets a share in
+    // proportion to its weight among the members that sent a request within the last ACTIVE_WINDOW; idle
+    // members leave their share to the busy ones. Zero leaves that dimension unlimited. Every active member may
+    // keep at least one request in flight, so with more active members than maxConcurrency the members together
+    // exceed it by that floor.
+    class FairShareBudget {
+      public:
+        using Clock = std::chrono::steady_clock;
+
+        static constexpr Clock::duration ACTIVE_WINDOW = std::chrono::seconds{1};
+
+        struct Member {
+            double weight = 1;
+            Clock::time_point lastActive;
+            // Part of the active weight as of the last recount
+            bool counted = false;
+        };
+
+        FairShareBudget(double requestsPerSecond, uint32_t maxConcurrency);
+
+        // The member leaves the budget when the returned pointer is released
+        std::shared_ptr<Member> join(double weight);
+
+        // Current share of member, which counts as active from now on. 0 means unlimited, concurrency is never
+        // below 1 otherwise.
+        double requestsPerSecond(Member& member);
+        uint32_t concurrency(Member& member);
+
+      private:
+        // Fraction of the budget member gets; takes _mutex
+        double share(Member& member);
+
+        const double _requestsPerSecond;
+        const uint32_t _maxConcurrency;
+        std::mutex _mutex;
+        std::vector<std::weak_ptr<Member>> _members;
+        double _activeWeight = 0;
+        Clock::time_point _recounted;
+    };
+
+    // Budget of one client's Drive requests. Every attempt takes a token from a bucket refilled at
+    // requestsPerSecond and a slot under a concurrency limit that adapts AIMD style: it grows by one per limit
+    // worth of successes and halves once per round when Drive throttles or fails. Failed idempotent requests are
+    // tried again after a jittered exponential backoff; a Retry-After from the server holds off the whole client.
+    class RequestScheduler : public std::enable_shared_from_this<RequestScheduler> {
+      public:
+        using Clock = std::chrono::steady_clock;
+        // Every attempt starts over with a fresh session, which also picks up a refreshed access token
+        using Attempt = std::function<cpr::Response()>;
+        using SessionFactory = std::function<std::shared_ptr<cpr::Session>()>;
+
+        struct AsyncRequest {
+            SessionFactory makeSession;
+            // True when makeSession would block right now, e.g. on a token refresh. The session is then made on a
+            // thread of its own instead of holding up every other transfer of the loop.
+            std::function<bool()> mayBlock;
+            Method method = Method::Get;
+            // Download only: prepares the session of every attempt and returns the callback its body is written to.
+            // A header callback installed here keeps cpr from filling in the headers and reason, completeDownload
+            // adds them back before the response is judged.
+            std::function<cpr::WriteCallback(cpr::Session& session)> openDownload;
+            std::function<void(cpr::Response& response)> completeDownload;
+            bool idempotent = true;
+        };
+
+        explicit RequestScheduler(const RateLimitOptions& options);
+        // Also bound by the client's share of budget
+        RequestScheduler(const RateLimitOptions& options, std::shared_ptr<FairShareBudget> budget, double weight);
+
+        RequestScheduler(const RequestScheduler&) = delete;
+        RequestScheduler& operator=(const RequestScheduler&) = delete;
+
+        // Blocks for the budget, then runs attempt until its response is final. Returns the last response
+        // whatever its status; exceptions of attempt are not retried.
+        cpr::Response execute(const Attempt& attempt, bool idempotent = true);
+        // Same on an event loop, backoff included, without holding a thread. onComplete gets the last response.
+        void submit(std::shared_ptr<EventLoop> loop, AsyncRequest request, EventLoop::CompletionCallback onComplete,
+                    EventLoop::FailureCallback onFailure);
+
+        uint32_t getConcurrencyLimit() const;
+
+      private:
+        struct AsyncState;
+
+        // Takes a token, returns how long the caller has to wait before using it
+        Clock::duration reserveToken();
+        // Requests the client may have in flight now; takes _mutex
+        uint32_t limit() const;
+        void acquireSlot();
+        // Hands free slots to waiting asynchronous requests first, then wakes blocked callers for the rest
+        void releaseSlot();
+        // Feeds the outcome of an attempt started at started into the limits and frees its slot. Returns the
+        // delay before trying again, nothing when the response is final.
+        std::optional<Clock::duration> finish(const cpr::Response& response, Clock::time_point started,
+                                              uint32_t attempt, bool idempotent);
+
+        void schedule(std::shared_ptr<AsyncState> state, Clock::duration delay);
+        void startWhenFree(std::shared_ptr<AsyncState> state);
+        void start(std::shared_ptr<AsyncState> state);
+
+        RateLimitOptions _options;
+        mutable std::mutex _mutex;
+        std::condition_variable _slotFreed;
+        double _tokens = 0;
+        Clock::time_point _refilled;
+        Clock::time_point _pausedUntil;
+        double _limit = 1;
+        uint32_t _inFlight = 0;
+        // Responses to attempts started before the last decrease do not decrease again
+        Clock::time_point _lastDecrease;
+        std::deque<std::shared_ptr<AsyncState>> _waiting;
+        std::shared_ptr<FairShareBudget> _budget;
+        std::shared_ptr<FairShareBudget::Member> _member;
+    };
+
+    // Delay requested by a Retry-After header, in delta seconds or as an HTTP date
+    std::optional<std::chrono::seconds> parseRetryAfter(std::string_view value,
+                                                        std::chrono::system_clock::time_point now);
+}  // namespace GCloud::Http
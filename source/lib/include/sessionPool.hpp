@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cpr/cpr.h>
+#include <curl/curl.h>
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "GDriveCpp/gDrive.h"
+
+namespace GCloud::Http {
+    // Hands out cpr sessions that share one libcurl connection cache (plus DNS and TLS session caches), so
+    // consecutive requests to googleapis.com reuse warm keep-alive connections instead of handshaking again.
+    class SessionPool {
+      public:
+        explicit SessionPool(const ConnectionPoolOptions& options);
+        ~SessionPool();
+
+        SessionPool(const SessionPool&) = delete;
+        SessionPool& operator=(const SessionPool&) = delete;
+
+        // Every session starts from a clean request state; only the connection layer is shared.
+        std::shared_ptr<cpr::Session> makeSession();
+
+        const ConnectionPoolOptions& getOptions() const { return _options; }
+
+      private:
+        static void lockShare(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr);
+        static void unlockShare(CURL* handle, curl_lock_data data, void* userptr);
+
+        ConnectionPoolOptions _options;
+        CURLSH* _share = nullptr;
+        std::array<std::mutex, CURL_LOCK_DATA_LAST> _shareLocks;
+    };
+
+    // Status line and headers of a transfer made with a header callback, which keeps cpr from filling them into
+    // the response. A new status line starts over, so only the final response of redirects and 100 Continue
+    // is kept.
+    class ResponseHeaders {
+      public:
+        // Takes one header line, returns its status code when it is a status line and 0 otherwise
+        long add(std::string_view line);
+        long getStatusCode() const { return _statusCode; }
+        // Fills in the reason and headers cpr left out
+        void applyTo(cpr::Response& response) const;
+
+      private:
+        long _statusCode = 0;
+        std::string _reason;
+        cpr::Header _header;
+    };
+}  // namespace GCloud::Http
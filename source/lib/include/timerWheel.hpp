@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace GCloud::Http {
+    // Hashed timing wheel: a timer goes to the slot of the tick it is due at and the wheel visits one slot per
+    // tick, so scheduling and cancelling cost the same however many timers are pending. Timers due beyond one
+    // revolution wait in their slot for later visits. Callbacks run on the wheel's single thread, a late tick
+    // fires everything due at once.
+    class TimerWheel {
+      public:
+        using Clock = std::chrono::steady_clock;
+        using Callback = std::function<void()>;
+
+        TimerWheel(Clock::duration tick, size_t slots);
+        ~TimerWheel();
+
+        TimerWheel(const TimerWheel&) = delete;
+        TimerWheel& operator=(const TimerWheel&) = delete;
+
+        // Returns an ID for cancel, never 0. Due times in the past fire on the next tick.
+        uint64_t schedule(Clock::time_point due, Callback callback);
+        // False when the timer already fired or never existed
+        bool cancel(uint64_t id);
+        size_t size() const;
+
+        // Waits for a running callback and stops the thread; timers still pending never fire. A callback may
+        // hold the last reference to its wheel, so owners stop it explicitly rather than from the destructor.
+        void stop();
+
+      private:
+        struct Entry {
+            uint64_t id;
+            uint64_t tick;
+            Callback callback;
+        };
+
+        uint64_t tickOf(Clock::time_point time) const;
+        void run(std::stop_token stop);
+
+        const Clock::duration _tick;
+        const Clock::time_point _start;
+        mutable std::mutex _mutex;
+        std::condition_variable_any _wake;
+        std::vector<std::vector<Entry>> _slots;
+        // Slot of every pending timer
+        std::unordered_map<uint64_t, size_t> _pending;
+        // Last tick visited
+        uint64_t _current = 0;
+        uint64_t _nextId = 1;
+        // Declared last so that it starts once the wheel is complete
+        std::jthread _thread;
+    };
+}  // namespace GCloud::Http
@@ -0,0 +1,246 @@
+#include "batchScheduler.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <format>
+#include <random>
+#include <stdexcept>
+
+#include "logging.hpp"
+#include "sessionPool.hpp"
+
+namespace GCloud::Http {
+    namespace {
+        constexpr std::string_view CONTENT_ID_PREFIX = "item";
+        constexpr std::string_view RESPONSE_ID_PREFIX = "response-item";
+
+        std::string makeBoundary() {
+            static thread_local std::mt19937_64 generator{std::random_device{}()};
+            return std::format("batch_{:016x}", generator());
+        }
+
+        std::string_view trim(std::string_view value) {
+            while (!value.empty() && (value.front() == ' ' || value.front() == '\r' || value.front() == '\n'))
+                value.remove_prefix(1);
+            while (!value.empty() && (value.back() == ' ' || value.back() == '\r' || value.back() == '\n'))
+                value.remove_suffix(1);
+            return value;
+        }
+
+        // Splits "headers\r\n\r\nbody"; a missing separator means there is no body
+        std::pair<std::string_view, std::string_view> splitHeaders(std::string_view message) {
+            auto separator = message.find("\r\n\r\n");
+            if (separator == std::string_view::npos) return {message, {}};
+            return {message.substr(0, separator), message.substr(separator + 4)};
+        }
+
+        std::optional<std::string_view> findHeader(std::string_view headers, std::string_view name) {
+            size_t position = 0;
+            while (position < headers.size()) {
+                size_t end = headers.find("\r\n", position);
+                if (end == std::string_view::npos) end = headers.size();
+                std::string_view line = headers.substr(position, end - position);
+                auto colon = line.find(':');
+                if (colon == name.size() &&
+                    std::equal(name.begin(), name.end(), line.begin(),
+                               [](char a, char b) { return std::tolower(a) == std::tolower(b); })) {
+                    return trim(line.substr(colon + 1));
+                }
+                position = end + 2;
+            }
+            return std::nullopt;
+        }
+    }  // namespace
+
+    BatchScheduler::BatchScheduler(std::shared_ptr<SessionPool> sessionPool, std::shared_ptr<EventLoop> eventLoop,
+                                   std::shared_ptr<RequestScheduler> requestScheduler, const BatchOptions& options)
+        : _sessionPool(std::move(sessionPool)),
+          _eventLoop(std::move(eventLoop)),
+          _requestScheduler(std::move(requestScheduler)),
+          _options(options) {
+        _options.maxBatchSize = std::clamp<uint32_t>(_options.maxBatchSize, 1, 100);
+        _thread = std::thread(&BatchScheduler::run, this);
+    }
+
+    BatchScheduler::~BatchScheduler() {
+        {
+            std::lock_guard lock(_mutex);
+            _stopping = true;
+        }
+        _condition.notify_all();
+        if (_thread.joinable()) _thread.join();
+    }
+
+    void BatchScheduler::submit(BatchRequest request, std::string accessToken, CompletionCallback onComplete,
+                                FailureCallback onFailure) {
+        {
+            std::lock_guard lock(_mutex);
+            if (_stopping) {
+                throw std::runtime_error("Batch scheduler is shutting down");
+            }
+            _accessToken = std::move(accessToken);
+            _queue.push_back(Item{.request = std::move(request),
+                                  .onComplete = std::move(onComplete),
+                                  .onFailure = std::move(onFailure)});
+        }
+        _condition.notify_one();
+    }
+
+    void BatchScheduler::run() {
+        std::unique_lock lock(_mutex);
+        while (true) {
+            _condition.wait(lock, [this] { return _stopping || !_queue.empty(); });
+            if (_queue.empty()) break;
+
+            // Give other callers the window to join this batch unless it is already full
+            auto deadline = std::chrono::steady_clock::now() + _options.window;
+            _condition.wait_until(lock, deadline,
+                                  [this] { return _stopping || _queue.size() >= _options.maxBatchSize; });
+
+            std::vector<Item> items;
+            size_t count = std::min<size_t>(_queue.size(), _options.maxBatchSize);
+            items.reserve(count);
+            for (size_t i = 0; i < count; ++i) {
+                items.push_back(std::move(_queue.front()));
+                _queue.pop_front();
+            }
+            std::string accessToken = _accessToken;
+
+            lock.unlock();
+            flush(std::move(items), accessToken);
+            lock.lock();
+        }
+    }
+
+    void BatchScheduler::flush(std::vector<Item>&& items, const std::string& accessToken) {
+        auto batch = std::make_shared<std::vector<Item>>(std::move(items));
+        auto failAll = [batch](std::exception_ptr error) {
+            for (auto& item : *batch) {
+                if (item.onFailure) item.onFailure(error);
+            }
+        };
+
+        const std::string boundary = makeBoundary();
+        std::string body;
+        body.reserve(batch->size() * 160);
+        for (size_t i = 0; i < batch->size(); ++i) {
+            const auto& request = (*batch)[i].request;
+            body += std::format("--{}\r\nContent-Type: application/http\r\nContent-ID: <{}{}>\r\n\r\n{} {}\r\n\r\n",
+                                boundary, CONTENT_ID_PREFIX, i, request.method, request.path);
+        }
+        body += std::format("--{}--\r\n", boundary);
+
+        // The batch as a whole is retried by the request scheduler when it only holds reads
+        bool idempotent = std::ranges::all_of(*batch, [](const Item& item) { return item.request.method == "GET"; });
+        try {
+            _requestScheduler->submit(
+                _eventLoop,
+                RequestScheduler::AsyncRequest{
+                    .makeSession =
+                        [sessionPool = _sessionPool, accessToken, boundary, body = std::move(body)] {
+                            auto session = sessionPool->makeSession();
+                            session->SetUrl(cpr::Url{"https://www.googleapis.com/batch/drive/v3"});
+                            session->SetHeader(
+                                cpr::Header{{"Authorization", "Bearer " + accessToken},
+                                            {"Content-Type", "multipart/mixed; boundary=" + boundary}});
+                            session->SetBody(cpr::Body{body});
+                            return session;
+                        },
+                    .method = Method::Post,
+                    .idempotent = idempotent},
+                [batch, failAll](cpr::Response response) {
+                    if (response.status_code != 200) {
+                        failAll(std::make_exception_ptr(
+                            std::runtime_error(std::format("Batch request failed: {} - {}\n{}", response.status_code,
+                                                           response.reason, response.text))));
+                        return;
+                    }
+                    auto contentType = response.header.find("Content-Type");
+                    auto parts = parseBatchResponse(
+                        contentType == response.header.end() ? std::string_view{} : contentType->second,
+                        response.text, batch->size());
+                    for (size_t i = 0; i < batch->size(); ++i) {
+                        auto& item = (*batch)[i];
+                        try {
+                            if (!parts[i]) {
+                                throw std::runtime_error("Batch request failed: Missing response part");
+                            }
+                            if (item.onComplete) item.onComplete(std::move(*parts[i]));
+                        } catch (...) {
+                            if (item.onFailure) item.onFailure(std::current_exception());
+                        }
+                    }
+                },
+                failAll);
+        } catch (...) {
+            failAll(std::current_exception());
+        }
+    }
+
+    std::string percentEncode(const std::string_view& value) {
+        static constexpr char HEX[] = "0123456789ABCDEF";
+        std::string encoded;
+        encoded.reserve(value.size() * 3);
+        for (unsigned char c : value) {
+            if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+                encoded += static_cast<char>(c);
+            } else {
+                encoded += '%';
+                encoded += HEX[c >> 4];
+                encoded += HEX[c & 0x0F];
+            }
+        }
+        return encoded;
+    }
+
+    std::vector<std::optional<BatchResponse>> parseBatchResponse(const std::string_view& contentType,
+                                                                 const std::string_view& body, size_t partCount) {
+        std::vector<std::optional<BatchResponse>> parts(partCount);
+        auto boundaryStart = contentType.find("boundary=");
+        if (boundaryStart == std::string_view::npos) {
+            throw std::runtime_error("Batch request failed: Missing multipart boundary");
+        }
+        std::string_view boundary = contentType.substr(boundaryStart + 9);
+        boundary = boundary.substr(0, boundary.find(';'));
+        if (boundary.size() >= 2 && boundary.front() == '"' && boundary.back() == '"') {
+            boundary = boundary.substr(1, boundary.size() - 2);
+        }
+        const std::string delimiter = std::format("--{}", boundary);
+
+        size_t position = body.find(delimiter);
+        while (position != std::string_view::npos) {
+            position += delimiter.size();
+            if (body.substr(position, 2) == "--") break;  // Closing delimiter
+            size_t next = body.find(delimiter, position);
+            std::string_view part = body.substr(position, next == std::string_view::npos ? next : next - position);
+            position = next;
+
+            if (part.starts_with("\r\n")) part.remove_prefix(2);
+            auto [partHeaders, message] = splitHeaders(part);
+            auto contentId = findHeader(partHeaders, "Content-ID");
+            if (!contentId) continue;
+            std::string_view id = trim(*contentId);
+            if (id.starts_with('<')) id.remove_prefix(1);
+            if (id.ends_with('>')) id.remove_suffix(1);
+            if (!id.starts_with(RESPONSE_ID_PREFIX)) continue;
+            size_t index = 0;
+            id.remove_prefix(RESPONSE_ID_PREFIX.size());
+            if (std::from_chars(id.data(), id.data() + id.size(), index).ec != std::errc{} || index >= partCount) {
+                continue;
+            }
+
+            // Status line "HTTP/1.1 200 OK", headers, then the body of the sub-response
+            auto [responseHeaders, responseBody] = splitHeaders(message);
+            BatchResponse response;
+            auto statusStart = responseHeaders.find(' ');
+            if (statusStart != std::string_view::npos) {
+                std::string_view status = responseHeaders.substr(statusStart + 1);
+                std::from_chars(status.data(), status.data() + status.size(), response.status_code);
+            }
+            response.text = std::string(trim(responseBody));
+            parts[index] = std::move(response);
+        }
+        return parts;
+    }
+}  // namespace GCloud::Http
@@ -0,0 +1,288 @@
+#include "GDriveCpp/blobCache.h"
+
+#include <format>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "GDriveCpp/gFile.h"
+#include "cache.hpp"
+#include "io.hpp"
+#include "logging.hpp"
+
+namespace GDrive {
+    namespace {
+        constexpr std::string_view INDEX_FILE = "index.json";
+        constexpr std::string_view LOCK_FILE = "lock";
+        constexpr std::string_view TEMPORARY_MARKER = ".tmp-";
+
+        int64_t writeTime(const std::filesystem::path& path, std::error_code& error) {
+            return static_cast<int64_t>(std::filesystem::last_write_time(path, error).time_since_epoch().count());
+        }
+
+        // IDs, checksums and revision IDs are plain already, anything else is kept out of file names
+        void appendSafe(std::string& out, const std::string_view& value) {
+            for (char c : value) {
+                bool plain = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' ||
+                             c == '_';
+                out += plain ? c : '_';
+            }
+        }
+    }  // namespace
+
+    BlobCache::BlobCache(const BlobCacheOptions& options)
+        : _options(options),
+          _directory(options.directory.empty() ? GCloud::Cache::getBlobCacheDirectory() : options.directory) {
+        std::filesystem::create_directories(_directory);
+        _directoryLock = std::make_unique<utils::io::LockFile>(_directory / LOCK_FILE);
+        std::scoped_lock directory(_directoryMutex, *_directoryLock);
+        std::lock_guard lock(_mutex);
+        load();
+    }
+
+    BlobCache::~BlobCache() {
+        try {
+            std::scoped_lock directory(_directoryMutex, *_directoryLock);
+            std::lock_guard lock(_mutex);
+            sync();
+            save();
+        } catch (const std::exception& e) {
+            spdlog::warn("Failed to save blob cache index: {}", e.what());
+        }
+    }
+
+    std::optional<std::string> BlobCache::blobName(const GFile& file) {
+        if (!file.id) return std::nullopt;
+        std::string name;
+        appendSafe(name, file.id.value());
+        if (file.md5Checksum) {
+            name += ".md5-";
+            appendSafe(name, file.md5Checksum.value());
+        } else if (file.headRevisionId) {
+            name += ".rev-";
+            appendSafe(name, file.headRevisionId.value());
+        } else {
+            return std::nullopt;
+        }
+        return name;
+    }
+
+    void BlobCache::place(const std::filesystem::path& from, const std::filesystem::path& to) const {
+        std::error_code error;
+        if (_options.hardlinks) {
+            std::filesystem::create_hard_link(from, to, error);
+            if (!error) return;
+        }
+        if (utils::io::cloneFile(from, to)) return;
+        std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing);
+    }
+
+    std::filesystem::path BlobCache::temporaryPath(const std::string_view& name) const {
+        thread_local std::mt19937_64 engine{std::random_device{}()};
+        return _directory / std::format("{}{}{:x}", name, TEMPORARY_MARKER, engine());
+    }
+
+    bool BlobCache::fetch(const GFile& file, const std::filesystem::path& target) {
+        auto name = blobName(file);
+        if (!name) return false;
+        auto blob = _directory / *name;
+        auto unchanged = [&](const Entry& entry) {
+            std::error_code error;
+            uint64_t size = std::filesystem::file_size(blob, error);
+            return !error && size == entry.size && writeTime(blob, error) == entry.modified && !error;
+        };
+        bool stale = false;
+        {
+            std::lock_guard lock(_mutex);
+            auto it = _entries.find(*name);
+            if (it == _entries.end()) return false;
+            stale = !unchanged(it->second);
+            if (!stale) _recency.splice(_recency.begin(), _recency, it->second.recency);
+        }
+        if (stale) {
+            // Another process may have stored the blob again, which its saved index tells apart from a change
+            // made through a hard link
+            std::scoped_lock directory(_directoryMutex, *_directoryLock);
+            std::lock_guard lock(_mutex);
+            sync();
+            auto it = _entries.find(*name);
+            if (it == _entries.end()) return false;
+            if (!unchanged(it->second)) {
+                spdlog::warn("Cached content of file {} was changed or removed, dropping it", file.id.value());
+                drop(*name);
+                save();
+                return false;
+            }
+            _recency.splice(_recency.begin(), _recency, it->second.recency);
+        }
+        try {
+            std::filesystem::remove(target);
+            place(blob, target);
+        } catch (const std::filesystem::filesystem_error& e) {
+            // Evicted in the meantime, the caller downloads it instead
+            spdlog::debug("Failed to serve file {} from the blob cache: {}", file.id.value(), e.what());
+            return false;
+        }
+        return true;
+    }
+
+    void BlobCache::store(const GFile& file, const std::filesystem::path& source) {
+        auto name = blobName(file);
+        if (!name) return;
+        uint64_t size = std::filesystem::file_size(source);
+        if (size > _options.maxBytes) return;
+        {
+            std::lock_guard lock(_mutex);
+            if (auto it = _entries.find(*name); it != _entries.end()) {
+                _recency.splice(_recency.begin(), _recency, it->second.recency);
+                return;
+            }
+        }
+        // Held while the blob is placed, so that no other process takes the temporary file for a leftover
+        std::scoped_lock directory(_directoryMutex, *_directoryLock);
+        // Placed under a temporary name first, a blob is either complete or absent
+        auto temporary = temporaryPath(*name);
+        auto blob = _directory / *name;
+        try {
+            place(source, temporary);
+            std::filesystem::rename(temporary, blob);
+        } catch (...) {
+            std::error_code ignored;
+            std::filesystem::remove(temporary, ignored);
+            throw;
+        }
+        std::error_code error;
+        int64_t modified = writeTime(blob, error);
+        if (error) throw std::filesystem::filesystem_error("Failed to stat cached blob", blob, error);
+
+        std::lock_guard lock(_mutex);
+        sync();
+        if (auto it = _entries.find(*name); it != _entries.end()) {
+            // Stored by another thread or process as well, the content is the same
+            it->second.modified = modified;
+            _size += size - it->second.size;
+            it->second.size = size;
+        } else {
+            add(*name, size, modified);
+        }
+        _recency.splice(_recency.begin(), _recency, _entries.at(*name).recency);
+        evict();
+        save();
+    }
+
+    bool BlobCache::contains(const GFile& file) const {
+        auto name = blobName(file);
+        if (!name) return false;
+        std::lock_guard lock(_mutex);
+        return _entries.contains(*name);
+    }
+
+    void BlobCache::clear() {
+        std::scoped_lock directory(_directoryMutex, *_directoryLock);
+        std::lock_guard lock(_mutex);
+        sync();
+        while (!_recency.empty()) drop(_recency.back());
+        save();
+    }
+
+    uint64_t BlobCache::size() const {
+        std::lock_guard lock(_mutex);
+        return _size;
+    }
+
+    void BlobCache::add(const std::string& name, uint64_t size, int64_t modified) {
+        _recency.push_back(name);
+        _entries.emplace(name, Entry{.size = size, .modified = modified, .recency = std::prev(_recency.end())});
+        _size += size;
+    }
+
+    void BlobCache::forget(const std::string& name) {
+        auto it = _entries.find(name);
+        if (it == _entries.end()) return;
+        _size -= it->second.size;
+        _recency.erase(it->second.recency);
+        _entries.erase(it);
+    }
+
+    void BlobCache::drop(const std::string& name) {
+        std::error_code ignored;
+        std::filesystem::remove(_directory / name, ignored);
+        forget(name);
+    }
+
+    void BlobCache::evict() {
+        while (_size > _options.maxBytes && !_recency.empty()) drop(_recency.back());
+    }
+
+    void BlobCache::sync() {
+        std::vector<std::string> gone;
+        for (const auto& name : _recency) {
+            std::error_code error;
+            if (!std::filesystem::exists(_directory / name, error)) gone.push_back(name);
+        }
+        for (const auto& name : gone) forget(name);
+
+        std::ifstream file(_directory / INDEX_FILE);
+        if (!file.is_open()) return;
+        auto index = nlohmann::json::parse(file, nullptr, false);
+        if (!index.is_array()) return;
+        // Saved most recently used first; what this process has not seen is appended behind its own entries
+        for (const auto& item : index) {
+            if (!item.is_object() || !item.contains("name") || !item["name"].is_string()) continue;
+            auto name = item["name"].get<std::string>();
+            std::error_code error;
+            uint64_t size = std::filesystem::file_size(_directory / name, error);
+            if (error) continue;
+            int64_t modified = item.value("modified", int64_t{0});
+            auto it = _entries.find(name);
+            if (it == _entries.end()) {
+                add(name, size, modified);
+            } else if (it->second.modified != modified) {
+                // Stored again by another process
+                _size += size - it->second.size;
+                it->second.size = size;
+                it->second.modified = modified;
+            }
+        }
+    }
+
+    void BlobCache::load() {
+        sync();
+        // Leftovers of interrupted stores, and blobs missing from a lost index as the least recently used. No
+        // store is in flight while the directory is locked.
+        for (const auto& entry : std::filesystem::directory_iterator(_directory)) {
+            if (!entry.is_regular_file()) continue;
+            auto name = entry.path().filename().string();
+            if (name == INDEX_FILE || name == LOCK_FILE || _entries.contains(name)) continue;
+            std::error_code error;
+            if (name.find(TEMPORARY_MARKER) != std::string::npos) {
+                std::filesystem::remove(entry.path(), error);
+                continue;
+            }
+            int64_t modified = writeTime(entry.path(), error);
+            if (error) continue;
+            add(name, entry.file_size(), modified);
+        }
+        evict();
+    }
+
+    void BlobCache::save() const {
+        nlohmann::json index = nlohmann::json::array();
+        for (const auto& name : _recency) {
+            const Entry& entry = _entries.at(name);
+            index.push_back({{"name", name}, {"size", entry.size}, {"modified", entry.modified}});
+        }
+        // Written to a temporary file first so a crash never leaves a truncated index behind
+        auto temporary = temporaryPath(INDEX_FILE);
+        {
+            std::ofstream file(temporary, std::ios::trunc);
+            if (!file.is_open()) {
+                throw std::runtime_error("Failed to open blob cache index for writing: " + temporary.string());
+            }
+            file << index.dump();
+        }
+        std::filesystem::rename(temporary, _directory / INDEX_FILE);
+    }
+}  // namespace GDrive
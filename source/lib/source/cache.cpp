@@ -1,7 +1,11 @@
 #include "cache.hpp"
 
+#include <cstring>
 #include <fstream>
 #include <functional>
+#include <map>
+#include <mutex>
+#include <random>
 
 #include "data.hpp"
 #include "directory.hpp"
@@ -13,52 +17,248 @@ namespace GCloud::Cache {
         return utils::directory::getLocalCacheDirectory() / "GDriveCpp" / "clients" / filename;
     }
 
-    std::optional<ClientCache> getClientCache(const std::string_view& clientId, const std::string_view& clientSecret) {
-        auto cacheFile = getCacheFilePath(clientId);
-        if (!std::filesystem::exists(cacheFile)) {
-            return std::nullopt;
-        }
-        std::ifstream file(cacheFile, std::ios::binary);
-        if (!file.is_open()) {
-            return std::nullopt;
-        }
-        file.seekg(0, std::ios::end);
-        size_t fileSize = file.tellg();
+    std::filesystem::path getTokenSlotFilePath(const std::string_view& clientId) {
+        std::hash<std::string_view> hasher;
+        std::string filename = std::format("{:x}.token", hasher(clientId));
+        return utils::directory::getLocalCacheDirectory() / "GDriveCpp" / "clients" / filename;
+    }
 
-        if (fileSize == 0) {
-            return std::nullopt;
-        }
+    std::filesystem::path getPathCacheFilePath(const std::string_view& clientId) {
+        std::hash<std::string_view> hasher;
+        std::string filename = std::format("{:x}.json", hasher(clientId));
+        return utils::directory::getLocalCacheDirectory() / "GDriveCpp" / "paths" / filename;
+    }
 
-        file.seekg(0, std::ios::beg);
+    std::filesystem::path getChangesFilePath(const std::string_view& clientId) {
+        std::hash<std::string_view> hasher;
+        std::string filename = std::format("{:x}.json", hasher(clientId));
+        return utils::directory::getLocalCacheDirectory() / "GDriveCpp" / "changes" / filename;
+    }
 
-        std::vector<uint8_t> buffer(fileSize);
-        file.read(reinterpret_cast<char*>(buffer.data()), fileSize);
+    std::filesystem::path getMetadataIndexDirectory(const std::string_view& clientId) {
+        std::hash<std::string_view> hasher;
+        std::string directory = std::format("{:x}", hasher(clientId));
+        return utils::directory::getLocalCacheDirectory() / "GDriveCpp" / "index" / directory;
+    }
 
-        std::vector<uint8_t> psw{clientSecret.begin(), clientSecret.end()};
-        std::vector<uint8_t> data = utils::data::decryptAES256(buffer, psw);
-        std::string dataStr(data.begin(), data.end());
-        return ClientCache::decode(dataStr);
+    std::filesystem::path getBlobCacheDirectory() {
+        return utils::directory::getLocalCacheDirectory() / "GDriveCpp" / "blobs";
+    }
+
+    namespace {
+        // Client caches this process has loaded or written, by client id
+        std::mutex loadedMutex;
+        std::map<std::string, ClientCache, std::less<>> loaded;
+
+        constexpr uint32_t TOKEN_SLOT_MAGIC = 0x53544447;  // "GDTS"
+        constexpr size_t TOKEN_SLOT_SIZE = 4096;
+
+        // Start of the token slot file, followed by the encrypted access token
+        struct TokenSlotHeader {
+            uint32_t magic;
+            // Bytes of encrypted token, 0 while the slot is empty
+            uint32_t size;
+            // Bumped by every store, readers decrypt only what they have not seen yet
+            uint64_t sequence;
+            int64_t expiresAt;
+        };
+
+        std::optional<ClientCache> readClientCache(const std::filesystem::path& cacheFile,
+                                                   const std::string_view& clientSecret) {
+            std::ifstream file(cacheFile, std::ios::binary);
+            if (!file.is_open()) {
+                return std::nullopt;
+            }
+            file.seekg(0, std::ios::end);
+            size_t fileSize = file.tellg();
+
+            if (fileSize == 0) {
+                return std::nullopt;
+            }
+
+            file.seekg(0, std::ios::beg);
+
+            std::vector<uint8_t> buffer(fileSize);
+            file.read(reinterpret_cast<char*>(buffer.data()), fileSize);
+
+            std::vector<uint8_t> psw{clientSecret.begin(), clientSecret.end()};
+            std::vector<uint8_t> data = utils::data::decryptAES256(buffer, psw);
+            std::string dataStr(data.begin(), data.end());
+            return ClientCache::decode(dataStr);
+        }
+
+        std::filesystem::path prepareTokenSlotFile(const std::string_view& clientId) {
+            auto path = getTokenSlotFilePath(clientId);
+            std::filesystem::create_directories(path.parent_path());
+            return path;
+        }
+    }  // namespace
+
+    std::optional<ClientCache> getClientCache(const std::string_view& clientId, const std::string_view& clientSecret) {
+        std::lock_guard lock(loadedMutex);
+        if (auto it = loaded.find(clientId); it != loaded.end()) return it->second;
+        // A missing cache is not remembered, another process may still create it
+        auto clientCache = readClientCache(getCacheFilePath(clientId), clientSecret);
+        if (clientCache) loaded.emplace(std::string(clientId), *clientCache);
+        return clientCache;
     }
 
     void createClientCache(const std::string_view& clientId, const std::string_view& clientSecret,
                            const ClientCache& data) {
+        std::lock_guard lock(loadedMutex);
+        auto it = loaded.find(clientId);
+        if (it != loaded.end() && it->second.refreshToken == data.refreshToken) {
+            it->second = data;
+            return;
+        }
         auto cacheFile = getCacheFilePath(clientId);
         std::filesystem::create_directories(cacheFile.parent_path());
-        std::ofstream file(cacheFile, std::ios::binary);
-        if (!file.is_open()) {
-            throw std::runtime_error("Failed to open cache file for writing: " + cacheFile.string());
+        // Named per writer, processes storing the same client at once must not share the temporary file
+        thread_local std::mt19937_64 engine{std::random_device{}()};
+        auto temporary = cacheFile;
+        temporary += std::format(".{:x}.tmp", engine());
+        {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            if (!file.is_open()) {
+                throw std::runtime_error("Failed to open cache file for writing: " + temporary.string());
+            }
+            std::string encodedData = data.encode();
+            std::vector<uint8_t> encryptedData =
+                utils::data::encryptAES256(std::vector<uint8_t>(encodedData.begin(), encodedData.end()),
+                                           std::vector<uint8_t>(clientSecret.begin(), clientSecret.end()));
+            file.write(reinterpret_cast<const char*>(encryptedData.data()), encryptedData.size());
+            if (!file) {
+                file.close();
+                std::filesystem::remove(temporary);
+                throw std::runtime_error("Failed to write cache file: " + temporary.string());
+            }
         }
-        std::string encodedData = data.encode();
-        std::vector<uint8_t> encryptedData =
-            utils::data::encryptAES256(std::vector<uint8_t>(encodedData.begin(), encodedData.end()),
-                                       std::vector<uint8_t>(clientSecret.begin(), clientSecret.end()));
-        file.write(reinterpret_cast<const char*>(encryptedData.data()), encryptedData.size());
+        std::filesystem::rename(temporary, cacheFile);
+        loaded.insert_or_assign(std::string(clientId), data);
     }
 
     void clearClientCache(const std::string_view& clientId) {
+        {
+            std::lock_guard lock(loadedMutex);
+            if (auto it = loaded.find(clientId); it != loaded.end()) loaded.erase(it);
+        }
         auto cacheFile = getCacheFilePath(clientId);
         if (std::filesystem::exists(cacheFile)) {
             std::filesystem::remove(cacheFile);
         }
+        // Other processes may have the slot mapped, it is emptied rather than removed
+        auto slotFile = getTokenSlotFilePath(clientId);
+        if (std::filesystem::exists(slotFile)) {
+            utils::io::SharedMappedFile slot(slotFile, TOKEN_SLOT_SIZE);
+            std::lock_guard lock(slot);
+            TokenSlotHeader header{};
+            std::memcpy(&header, slot.data(), sizeof(header));
+            header.size = 0;
+            ++header.sequence;
+            std::memcpy(slot.data(), &header, sizeof(header));
+        }
+    }
+
+    SharedTokenSlot::SharedTokenSlot(const std::string_view& clientId, const std::string_view& clientSecret)
+        : _file(prepareTokenSlotFile(clientId), TOKEN_SLOT_SIZE),
+          _password(clientSecret.begin(), clientSecret.end()) {}
+
+    std::shared_ptr<const Authentication::AccessToken> SharedTokenSlot::load() {
+        TokenSlotHeader header{};
+        std::memcpy(&header, _file.data(), sizeof(header));
+        if (header.magic != TOKEN_SLOT_MAGIC || header.size == 0 ||
+            header.size > TOKEN_SLOT_SIZE - sizeof(TokenSlotHeader)) {
+            return nullptr;
+        }
+        if (header.sequence == _sequence && _token) return _token;
+        const auto* begin = reinterpret_cast<const uint8_t*>(_file.data() + sizeof(TokenSlotHeader));
+        std::vector<uint8_t> token;
+        try {
+            token = utils::data::decryptAES256(std::vector<uint8_t>(begin, begin + header.size), _password);
+        } catch (const std::exception&) {
+            // Stored under another client secret
+            return nullptr;
+        }
+        _sequence = header.sequence;
+        _token = std::make_shared<const Authentication::AccessToken>(
+            Authentication::AccessToken{.value = std::string(token.begin(), token.end()),
+                                        .expiration = std::chrono::system_clock::from_time_t(header.expiresAt)});
+        return _token;
+    }
+
+    void SharedTokenSlot::store(const Authentication::AccessToken& token) {
+        std::vector<uint8_t> encrypted =
+            utils::data::encryptAES256(std::vector<uint8_t>(token.value.begin(), token.value.end()), _password);
+        if (encrypted.size() > TOKEN_SLOT_SIZE - sizeof(TokenSlotHeader)) {
+            throw std::runtime_error(std::format("Access token of {} bytes does not fit the shared token slot",
+                                                 token.value.size()));
+        }
+        TokenSlotHeader header{};
+        std::memcpy(&header, _file.data(), sizeof(header));
+        header.magic = TOKEN_SLOT_MAGIC;
+        header.size = static_cast<uint32_t>(encrypted.size());
+        ++header.sequence;
+        header.expiresAt = std::chrono::system_clock::to_time_t(token.expiration);
+        std::memcpy(_file.data() + sizeof(TokenSlotHeader), encrypted.data(), encrypted.size());
+        std::memcpy(_file.data(), &header, sizeof(header));
+        _sequence = header.sequence;
+        _token = std::make_shared<const Authentication::AccessToken>(token);
+    }
+
+    std::shared_ptr<SharedTokenSlot> getSharedTokenSlot(const std::string_view& clientId,
+                                                        const std::string_view& clientSecret) {
+        static std::mutex slotsMutex;
+        static std::map<std::string, std::shared_ptr<SharedTokenSlot>, std::less<>> slots;
+        std::lock_guard lock(slotsMutex);
+        if (auto it = slots.find(clientId); it != slots.end()) return it->second;
+        auto slot = std::make_shared<SharedTokenSlot>(clientId, clientSecret);
+        slots.emplace(std::string(clientId), slot);
+        return slot;
+    }
+
+    namespace {
+        nlohmann::json readStartPageTokens(const std::filesystem::path& path) {
+            std::ifstream file(path);
+            if (!file.is_open()) return nlohmann::json::object();
+            auto tokens = nlohmann::json::parse(file, nullptr, false);
+            return tokens.is_object() ? tokens : nlohmann::json::object();
+        }
+
+        // Written to a temporary file first so a crash never leaves a truncated token file behind
+        void writeStartPageTokens(const std::filesystem::path& path, const nlohmann::json& tokens) {
+            std::filesystem::create_directories(path.parent_path());
+            auto temporary = path;
+            temporary += ".tmp";
+            {
+                std::ofstream file(temporary, std::ios::trunc);
+                if (!file.is_open()) {
+                    throw std::runtime_error("Failed to open changes file for writing: " + temporary.string());
+                }
+                file << tokens.dump();
+            }
+            std::filesystem::rename(temporary, path);
+        }
+    }  // namespace
+
+    std::optional<std::string> getStartPageToken(const std::string_view& clientId, const std::string_view& driveId) {
+        auto tokens = readStartPageTokens(getChangesFilePath(clientId));
+        auto it = tokens.find(driveId);
+        if (it == tokens.end() || !it->is_string()) return std::nullopt;
+        return it->get<std::string>();
+    }
+
+    void storeStartPageToken(const std::string_view& clientId, const std::string_view& driveId,
+                             const std::string_view& token) {
+        auto path = getChangesFilePath(clientId);
+        auto tokens = readStartPageTokens(path);
+        tokens[std::string(driveId)] = token;
+        writeStartPageTokens(path, tokens);
+    }
+
+    void clearStartPageToken(const std::string_view& clientId, const std::string_view& driveId) {
+        auto path = getChangesFilePath(clientId);
+        auto tokens = readStartPageTokens(path);
+        if (tokens.erase(std::string(driveId)) == 0) return;
+        writeStartPageTokens(path, tokens);
     }
 }  // namespace GCloud::Cache
@@ -0,0 +1,156 @@
+#include "GDriveCpp/changeTracker.h"
+
+#include <cpr/cpr.h>
+
+#include <format>
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+
+#include "cache.hpp"
+#include "constants.hpp"
+#include "fileListParser.hpp"
+#include "logging.hpp"
+#include "requestScheduler.hpp"
+#include "sessionPool.hpp"
+
+namespace GDrive {
+    namespace {
+        std::shared_ptr<cpr::Session> makeChangesSession(GCloud::Authentication::OAuthAgent& agent,
+                                                         const std::string& url, cpr::Parameters&& parameters) {
+            auto session = agent.getSessionPool()->makeSession();
+            session->SetUrl(cpr::Url{url});
+            session->SetParameters(std::move(parameters));
+            session->SetHeader(cpr::Header{{"Authorization", "Bearer " + agent.getAccessToken()}});
+            return session;
+        }
+    }  // namespace
+
+    ChangeTracker::ChangeTracker(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                                 ChangeTrackerOptions options)
+        : _client(client), _options(std::move(options)) {
+        _options.fields.set(GFileField::id)
+            .set(GFileField::parents)
+            .set(GFileField::mimeType)
+            .set(GFileField::trashed);
+    }
+
+    bool ChangeTracker::initialize() {
+        auto agent = _client.lock();
+        if (!agent) {
+            throw std::runtime_error("Failed to initialize change tracking: Client is no longer valid");
+        }
+        if (_options.persistToken) {
+            if (auto token = GCloud::Cache::getStartPageToken(agent->getClientId(), _options.driveId)) {
+                _pageToken = std::move(*token);
+                return true;
+            }
+        }
+        _pageToken = fetchStartPageToken(*agent);
+        if (_options.persistToken) {
+            GCloud::Cache::storeStartPageToken(agent->getClientId(), _options.driveId, _pageToken);
+        }
+        return false;
+    }
+
+    std::string ChangeTracker::fetchStartPageToken(GCloud::Authentication::OAuthAgent& agent) const {
+        cpr::Parameters parameters{{"supportsAllDrives", "true"}};
+        if (!_options.driveId.empty()) parameters.Add({"driveId", _options.driveId});
+        auto response = agent.getRequestScheduler()->execute([&] {
+            return makeChangesSession(agent, "https://www.googleapis.com/drive/v3/changes/startPageToken",
+                                      cpr::Parameters(parameters))
+                ->Get();
+        });
+        if (response.status_code != 200) {
+            throw std::runtime_error(std::format("Failed to fetch start page token: {} - {}\n{}",
+                                                 response.status_code, response.reason, response.text));
+        }
+        auto json = nlohmann::json::parse(response.text);
+        if (!json.contains("startPageToken")) {
+            throw std::runtime_error("Failed to fetch start page token: Invalid JSON Response, missing token");
+        }
+        return json["startPageToken"].get<std::string>();
+    }
+
+    void ChangeTracker::poll(const ChangeCallback& onChange) {
+        if (_pageToken.empty()) {
+            throw std::logic_error("ChangeTracker::initialize must be called before polling");
+        }
+        auto agent = _client.lock();
+        if (!agent) {
+            throw std::runtime_error("Failed to fetch changes: Client is no longer valid");
+        }
+        std::string fields = std::format("nextPageToken,newStartPageToken,changes(fileId,removed,time,file({}))",
+                                         _options.fields.toString());
+        std::string pageToken = _pageToken;
+        while (true) {
+            cpr::Parameters parameters{{"pageToken", pageToken},
+                                       {"pageSize", std::to_string(_options.pageSize)},
+                                       {"includeRemoved", "true"},
+                                       {"includeItemsFromAllDrives", "true"},
+                                       {"supportsAllDrives", "true"},
+                                       {"fields", fields}};
+            if (!_options.driveId.empty()) parameters.Add({"driveId", _options.driveId});
+            auto response = agent->getRequestScheduler()->execute([&] {
+                return makeChangesSession(*agent, "https://www.googleapis.com/drive/v3/changes",
+                                          cpr::Parameters(parameters))
+                    ->Get();
+            });
+            if (response.status_code != 200) {
+                throw std::runtime_error(std::format("Failed to fetch changes: {} - {}\n{}", response.status_code,
+                                                     response.reason, response.text));
+            }
+            auto page = nlohmann::json::parse(response.text);
+            for (const auto& item : page.value("changes", nlohmann::json::array())) {
+                GFileChange change{.fileId = item.value("fileId", ""),
+                                   .time = item.value("time", ""),
+                                   .removed = item.value("removed", false)};
+                if (!change.removed && item.contains("file")) {
+                    change.file = std::make_shared<GFile>(_client);
+                    applyJsonFields(*change.file, item["file"]);
+                }
+                apply(change);
+                if (onChange) onChange(change);
+            }
+            if (page.contains("newStartPageToken")) {
+                // Last page: everything up to now was applied
+                _pageToken = page["newStartPageToken"].get<std::string>();
+                break;
+            }
+            if (!page.contains("nextPageToken")) {
+                throw std::runtime_error("Failed to fetch changes: Invalid JSON Response, missing page token");
+            }
+            pageToken = page["nextPageToken"].get<std::string>();
+        }
+        if (_options.persistToken) {
+            GCloud::Cache::storeStartPageToken(agent->getClientId(), _options.driveId, _pageToken);
+        }
+    }
+
+    std::vector<GFileChange> ChangeTracker::poll() {
+        std::vector<GFileChange> changes;
+        poll([&changes](const GFileChange& change) { changes.push_back(change); });
+        return changes;
+    }
+
+    void ChangeTracker::reset() {
+        _pageToken.clear();
+        if (!_options.persistToken) return;
+        if (auto agent = _client.lock()) {
+            GCloud::Cache::clearStartPageToken(agent->getClientId(), _options.driveId);
+        }
+    }
+
+    void ChangeTracker::apply(const GFileChange& change) const {
+        bool gone = change.removed || !change.file || change.file->trashed.value_or(false);
+        if (_options.pathCache && (gone || change.file->mimeType == FOLDER_MIME_TYPE)) {
+            // A removed file may have been a folder, invalidating an unknown ID is cheap
+            _options.pathCache->invalidateFolder(change.fileId);
+        }
+        if (!_options.index) return;
+        if (gone) {
+            _options.index->remove(change.fileId);
+        } else {
+            _options.index->put(change.file);
+        }
+    }
+}  // namespace GDrive
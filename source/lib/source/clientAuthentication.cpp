@@ -1,5 +1,6 @@
 #include <cpr/cpr.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <format>
 #include <iostream>
@@ -9,11 +10,41 @@
 #include "GDriveCpp/gDrive.h"
 #include "actions.hpp"
 #include "cache.hpp"
+#include "batchScheduler.hpp"
 #include "callbackListener.hpp"
+#include "eventLoop.hpp"
+#include "logging.hpp"
+#include "requestScheduler.hpp"
+#include "sessionPool.hpp"
 
 namespace GCloud::Authentication {
-    OAuthAgent::OAuthAgent(std::string& clientId, std::string& clientSecret)
-        : _clientId(clientId), _clientSecret(clientSecret) {}
+    namespace {
+        // A token this close to its expiration could expire while a request is in flight
+        constexpr std::chrono::seconds TOKEN_EXPIRY_SKEW{60};
+        // Least time between two background refreshes, even of a token the endpoint hands out already expired
+        constexpr std::chrono::seconds MIN_REFRESH_INTERVAL{1};
+    }  // namespace
+
+    OAuthAgent::OAuthAgent(std::string& clientId, std::string& clientSecret, const OAuthAgentOptions& options)
+        : OAuthAgent(clientId, clientSecret, options, std::make_shared<Http::SessionPool>(options.connectionPool),
+                     nullptr, std::make_shared<Http::RequestScheduler>(options.rateLimit)) {}
+
+    OAuthAgent::OAuthAgent(std::string& clientId, std::string& clientSecret, const OAuthAgentOptions& options,
+                           std::shared_ptr<Http::SessionPool> sessionPool, std::shared_ptr<Http::EventLoop> eventLoop,
+                           std::shared_ptr<Http::RequestScheduler> requestScheduler)
+        : _clientId(clientId),
+          _clientSecret(clientSecret),
+          _options(options),
+          _sessionPool(std::move(sessionPool)),
+          _eventLoop(std::move(eventLoop)),
+          _requestScheduler(std::move(requestScheduler)) {
+        try {
+            _sharedToken = Cache::getSharedTokenSlot(_clientId, _clientSecret);
+        } catch (const std::exception& e) {
+            // Not fatal, this process then refreshes its tokens on its own
+            spdlog::warn("Failed to open the shared token slot: {}", e.what());
+        }
+    }
 
     OAuthAgent::~OAuthAgent() {}
 
@@ -24,9 +55,9 @@ namespace GCloud::Authentication {
             clientCache = GCloud::Cache::getClientCache(_clientId, _clientSecret);
             if (clientCache.has_value()) {
                 _refreshToken = clientCache->refreshToken;
-                _accessToken = clientCache->accessToken;
-                _expirationTime = clientCache->accessTokenExpiration;
-                if (!checkToken()) refreshAccessToken();
+                _token.store(std::make_shared<const AccessToken>(AccessToken{
+                    .value = clientCache->accessToken, .expiration = clientCache->accessTokenExpiration}));
+                if (!isFresh(*_token.load())) refreshAccessToken();
                 return;
             }
         } catch (const std::exception& e) {
@@ -40,13 +71,14 @@ namespace GCloud::Authentication {
             _clientId, "http://localhost:8080", "https://www.googleapis.com/auth/drive");
         utils::actions::openBrowser(authURI);
         _code = GCloud::Authentication::listenForCode(8080);
-        auto response = cpr::Post(cpr::Url{"https://oauth2.googleapis.com/token"},
-                                  cpr::Parameters{{"code", _code},
-                                                  {"client_id", _clientId},
-                                                  {"client_secret", _clientSecret},
-                                                  {"redirect_uri", "http://localhost:8080"},
-                                                  {"grant_type", "authorization_code"}},
-                                  cpr::VerifySsl(0));
+        auto session = _sessionPool->makeSession();
+        session->SetUrl(cpr::Url{"https://oauth2.googleapis.com/token"});
+        session->SetParameters(cpr::Parameters{{"code", _code},
+                                               {"client_id", _clientId},
+                                               {"client_secret", _clientSecret},
+                                               {"redirect_uri", "http://localhost:8080"},
+                                               {"grant_type", "authorization_code"}});
+        auto response = session->Post();
         if (response.status_code != 200) {
             throw std::runtime_error(std::format("Failed to fetch access token: {} - {}\n{}", response.status_code,
                                                  response.reason, response.text));
@@ -57,27 +89,28 @@ namespace GCloud::Authentication {
             throw std::runtime_error("Failed to fetch access token: Invalid JSON Response");
             return;
         }
-        _accessToken = jsonResponse["access_token"];
-        int expiresIn = jsonResponse.value("expires_in", 3600);  // Default to 1 hour if not provided
-        _expirationTime = std::chrono::system_clock::now() + std::chrono::seconds(expiresIn);
+        storeToken(jsonResponse["access_token"], jsonResponse.value("expires_in", 3600));
         _refreshToken = jsonResponse["refresh_token"];
 
+        auto token = _token.load();
         GCloud::Cache::createClientCache(
             _clientId, _clientSecret,
-            GCloud::Cache::ClientCache{
-                .accessToken = _accessToken, .accessTokenExpiration = _expirationTime, .refreshToken = _refreshToken});
+            GCloud::Cache::ClientCache{.accessToken = token->value,
+                                       .accessTokenExpiration = token->expiration,
+                                       .refreshToken = _refreshToken});
     }
 
     void OAuthAgent::refreshAccessToken() {
         if (_refreshToken.empty()) {
             throw std::runtime_error("No refresh token available. Please authenticate first.");
         }
-        auto response = cpr::Post(cpr::Url{"https://oauth2.googleapis.com/token"},
-                                  cpr::Parameters{{"client_id", _clientId},
-                                                  {"client_secret", _clientSecret},
-                                                  {"refresh_token", _refreshToken},
-                                                  {"grant_type", "refresh_token"}},
-                                  cpr::VerifySsl(0));
+        auto session = _sessionPool->makeSession();
+        session->SetUrl(cpr::Url{"https://oauth2.googleapis.com/token"});
+        session->SetParameters(cpr::Parameters{{"client_id", _clientId},
+                                               {"client_secret", _clientSecret},
+                                               {"refresh_token", _refreshToken},
+                                               {"grant_type", "refresh_token"}});
+        auto response = session->Post();
         if (response.status_code != 200) {
             throw std::runtime_error(std::format("Failed to refresh access token: {} - {}\n{}", response.status_code,
                                                  response.reason, response.text));
@@ -86,30 +119,137 @@ namespace GCloud::Authentication {
         if (!jsonResponse.contains("access_token")) {
             throw std::runtime_error("Failed to refresh access token: Invalid JSON Response");
         }
-        _accessToken = jsonResponse["access_token"];
-        int expiresIn = jsonResponse.value("expires_in", 3600);  // Default to 1 hour if not provided
-        _expirationTime = std::chrono::system_clock::now() + std::chrono::seconds(expiresIn);
+        storeToken(jsonResponse["access_token"], jsonResponse.value("expires_in", 3600));
 
+        auto token = _token.load();
         GCloud::Cache::createClientCache(
             _clientId, _clientSecret,
-            GCloud::Cache::ClientCache{
-                .accessToken = _accessToken, .accessTokenExpiration = _expirationTime, .refreshToken = _refreshToken});
+            GCloud::Cache::ClientCache{.accessToken = token->value,
+                                       .accessTokenExpiration = token->expiration,
+                                       .refreshToken = _refreshToken});
+    }
+
+    void OAuthAgent::storeToken(std::string accessToken, int expiresIn) {
+        _token.store(std::make_shared<const AccessToken>(
+            AccessToken{.value = std::move(accessToken),
+                        .expiration = std::chrono::system_clock::now() + std::chrono::seconds(expiresIn)}));
+    }
+
+    bool OAuthAgent::isFresh(const AccessToken& token) const {
+        return !token.value.empty() && std::chrono::system_clock::now() + TOKEN_EXPIRY_SKEW < token.expiration;
     }
 
-    bool OAuthAgent::checkToken() {
-        if (_refreshToken.empty() || _accessToken.empty() || std::chrono::system_clock::now() >= _expirationTime) {
-            return false;
+    void OAuthAgent::publishToken() {
+        if (!_sharedToken) return;
+        try {
+            _sharedToken->store(*_token.load());
+        } catch (const std::exception& e) {
+            spdlog::warn("Failed to share the access token with other processes: {}", e.what());
         }
-        return true;
     }
 
-    std::string OAuthAgent::getAccessToken() {
-        if (_refreshToken.empty()) {
-            authenticate();
+    std::shared_ptr<const AccessToken> OAuthAgent::refresh(const std::shared_ptr<const AccessToken>& seen,
+                                                           bool background) {
+        std::lock_guard lock(_refreshMutex);
+        // Callers that found the same stale token queue up here, only the first one goes to the endpoint
+        auto current = _token.load();
+        if (current != seen && current && isFresh(*current)) return current;
+        {
+            // Processes sharing the client queue up the same way, one of them refreshes for all
+            std::unique_lock<Cache::SharedTokenSlot> shared;
+            if (_sharedToken) shared = std::unique_lock(*_sharedToken);
+            auto published = _sharedToken ? _sharedToken->load() : nullptr;
+            if (published && isFresh(*published) && (!seen || published->value != seen->value)) {
+                _token.store(published);
+            } else {
+                if (_refreshToken.empty()) {
+                    if (background) return current;
+                    authenticate();
+                } else {
+                    refreshAccessToken();
+                }
+                publishToken();
+            }
         }
-        if (!checkToken()) {
-            refreshAccessToken();
+        auto token = _token.load();
+        if (_onRefreshed) {
+            _onRefreshed(token);
+        } else if (_options.tokenRefreshMargin.count() > 0) {
+            if (!_refresher.joinable()) {
+                _refresher = std::jthread([this](std::stop_token stop) { runRefresher(stop); });
+            } else {
+                std::lock_guard wake(_refresherMutex);
+                _refresherWake.notify_all();
+            }
+        }
+        return token;
+    }
+
+    std::chrono::system_clock::time_point OAuthAgent::refreshDue(const AccessToken& token) const {
+        auto now = std::chrono::system_clock::now();
+        auto halfway = std::max<std::chrono::system_clock::duration>((token.expiration - now) / 2,
+                                                                     MIN_REFRESH_INTERVAL);
+        return std::max(token.expiration - _options.tokenRefreshMargin, now + halfway);
+    }
+
+    void OAuthAgent::runRefresher(std::stop_token stop) {
+        std::chrono::seconds backoff{0};
+        std::unique_lock lock(_refresherMutex);
+        while (!stop.stop_requested()) {
+            auto token = _token.load();
+            auto due = backoff.count() ? std::chrono::system_clock::now() + backoff : refreshDue(*token);
+            _refresherWake.wait_until(lock, stop, due, [] { return false; });
+            if (stop.stop_requested()) break;
+            lock.unlock();
+            std::shared_ptr<const AccessToken> refreshed;
+            try {
+                refreshed = refresh(token, true);
+                backoff = std::chrono::seconds{0};
+            } catch (const std::exception& e) {
+                backoff = std::clamp(backoff * 2, std::chrono::seconds{1}, std::chrono::seconds{60});
+                spdlog::warn("Background token refresh failed, retrying in {}s: {}", backoff.count(), e.what());
+            }
+            lock.lock();
+            if (refreshed == token) {
+                // Without a refresh token, e.g. one taken from another process, only a request authenticating
+                // again brings a new token
+                _refresherWake.wait(lock, stop, [&] { return _token.load() != token; });
+            }
+        }
+    }
+
+    std::shared_ptr<const AccessToken> OAuthAgent::getToken() {
+        auto token = _token.load(std::memory_order_acquire);
+        if (token && isFresh(*token)) return token;
+        return refresh(token);
+    }
+
+    std::string OAuthAgent::getAccessToken() { return getToken()->value; }
+
+    bool OAuthAgent::hasFreshToken() const {
+        auto token = _token.load(std::memory_order_acquire);
+        return token && isFresh(*token);
+    }
+
+    std::shared_ptr<Http::SessionPool> OAuthAgent::getSessionPool() const { return _sessionPool; }
+
+    std::shared_ptr<Http::RequestScheduler> OAuthAgent::getRequestScheduler() const { return _requestScheduler; }
+
+    std::shared_ptr<Http::EventLoop> OAuthAgent::getEventLoop() {
+        std::lock_guard lock(_lazyResourceMutex);
+        if (!_eventLoop) {
+            _eventLoop = std::make_shared<Http::EventLoop>(_options.connectionPool);
+        }
+        return _eventLoop;
+    }
+
+    std::shared_ptr<Http::BatchScheduler> OAuthAgent::getBatchScheduler() {
+        auto eventLoop = getEventLoop();
+        std::lock_guard lock(_lazyResourceMutex);
+        if (!_batchScheduler) {
+            _batchScheduler =
+                std::make_shared<Http::BatchScheduler>(_sessionPool, eventLoop, _requestScheduler, _options.batch);
         }
-        return _accessToken;
+        return _batchScheduler;
     }
 }  // namespace GCloud::Authentication
@@ -0,0 +1,111 @@
+#include "GDriveCpp/clientManager.h"
+
+#include <algorithm>
+#include <format>
+#include <stdexcept>
+
+#include "eventLoop.hpp"
+#include "logging.hpp"
+#include "requestScheduler.hpp"
+#include "sessionPool.hpp"
+#include "timerWheel.hpp"
+
+namespace GCloud::Authentication {
+    struct ClientManager::Tenant {
+        std::shared_ptr<OAuthAgent> client;
+        std::mutex timerMutex;
+        // Pending refresh on the wheel, 0 when there is none
+        uint64_t timer = 0;
+        bool removed = false;
+    };
+
+    ClientManager::ClientManager(const ClientManagerOptions& options)
+        : _options(options),
+          _sessionPool(std::make_shared<Http::SessionPool>(options.client.connectionPool)),
+          _eventLoop(std::make_shared<Http::EventLoop>(options.client.connectionPool)),
+          _budget(std::make_shared<Http::FairShareBudget>(options.totalRequestsPerSecond, options.totalConcurrency)),
+          _refreshWheel(std::make_shared<Http::TimerWheel>(options.refreshTick, options.refreshSlots)) {}
+
+    ClientManager::~ClientManager() {
+        // Refreshes in progress finish first, none start afterwards
+        _refreshWheel->stop();
+    }
+
+    std::shared_ptr<OAuthAgent> ClientManager::addClient(const std::string_view& tenant, std::string clientId,
+                                                         std::string clientSecret, double weight) {
+        if (!(weight > 0)) {
+            throw std::invalid_argument(std::format("Weight of tenant '{}' must be positive", tenant));
+        }
+        std::lock_guard lock(_mutex);
+        if (_tenants.contains(tenant)) {
+            throw std::invalid_argument(std::format("Tenant '{}' is already registered", tenant));
+        }
+        auto requestScheduler = std::make_shared<Http::RequestScheduler>(_options.client.rateLimit, _budget, weight);
+        auto entry = std::make_shared<Tenant>();
+        entry->client = std::shared_ptr<OAuthAgent>(
+            new OAuthAgent(clientId, clientSecret, _options.client, _sessionPool, _eventLoop, requestScheduler));
+        if (_options.client.tokenRefreshMargin.count() > 0) {
+            entry->client->_onRefreshed = [wheel = std::weak_ptr(_refreshWheel), weak = std::weak_ptr(entry)](
+                                              const std::shared_ptr<const AccessToken>& token) {
+                if (auto refreshWheel = wheel.lock()) scheduleRefresh(refreshWheel, weak, token, {});
+            };
+        }
+        _tenants.emplace(std::string(tenant), entry);
+        return entry->client;
+    }
+
+    std::shared_ptr<OAuthAgent> ClientManager::getClient(const std::string_view& tenant) const {
+        std::lock_guard lock(_mutex);
+        auto it = _tenants.find(tenant);
+        return it == _tenants.end() ? nullptr : it->second->client;
+    }
+
+    bool ClientManager::removeClient(const std::string_view& tenant) {
+        std::shared_ptr<Tenant> removed;
+        {
+            std::lock_guard lock(_mutex);
+            auto it = _tenants.find(tenant);
+            if (it == _tenants.end()) return false;
+            removed = std::move(it->second);
+            _tenants.erase(it);
+        }
+        std::lock_guard lock(removed->timerMutex);
+        removed->removed = true;
+        if (removed->timer) _refreshWheel->cancel(removed->timer);
+        removed->timer = 0;
+        return true;
+    }
+
+    size_t ClientManager::getClientCount() const {
+        std::lock_guard lock(_mutex);
+        return _tenants.size();
+    }
+
+    void ClientManager::scheduleRefresh(const std::shared_ptr<Http::TimerWheel>& wheel,
+                                        const std::weak_ptr<Tenant>& weak,
+                                        const std::shared_ptr<const AccessToken>& token,
+                                        std::chrono::seconds backoff) {
+        auto tenant = weak.lock();
+        if (!tenant) return;
+        auto delay = std::chrono::duration_cast<Http::TimerWheel::Clock::duration>(
+            backoff.count() ? backoff : tenant->client->refreshDue(*token) - std::chrono::system_clock::now());
+        std::lock_guard lock(tenant->timerMutex);
+        if (tenant->removed) return;
+        if (tenant->timer) wheel->cancel(tenant->timer);
+        tenant->timer = wheel->schedule(
+            Http::TimerWheel::Clock::now() + delay, [wheel = std::weak_ptr(wheel), weak, token, backoff] {
+                auto tenant = weak.lock();
+                if (!tenant) return;
+                try {
+                    // The new token schedules the next refresh through _onRefreshed. A client without a refresh
+                    // token is left to authenticate on its next request, never on the wheel.
+                    tenant->client->refresh(token, true);
+                } catch (const std::exception& e) {
+                    auto retry = std::clamp(backoff * 2, std::chrono::seconds{1}, std::chrono::seconds{60});
+                    spdlog::warn("Token refresh of client {} failed, retrying in {}s: {}",
+                                 tenant->client->getClientId(), retry.count(), e.what());
+                    if (auto refreshWheel = wheel.lock()) scheduleRefresh(refreshWheel, weak, token, retry);
+                }
+            });
+    }
+}  // namespace GCloud::Authentication
@@ -0,0 +1,211 @@
+#include "GDriveCpp/directoryCrawler.h"
+
+#include <format>
+#include <stdexcept>
+
+#include "GDriveCpp/queryBuilder.h"
+#include "constants.hpp"
+#include "logging.hpp"
+
+namespace GDrive {
+    namespace {
+        // Children of one folder, the folder ID being the only parameter
+        QueryTemplate compileQuery(bool includeTrashed) {
+            return QueryBuilder()
+                .AddParameter("parents", QueryBuilder::ComparisonOperator::In, "folder")
+                .AddCondition("trashed", QueryBuilder::ComparisonOperator::Equal, "false", !includeTrashed)
+                .Compile();
+        }
+    }  // namespace
+
+    DirectoryCrawler::DirectoryCrawler(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                                       CrawlerOptions options)
+        : _client(client), _options(std::move(options)), _query(compileQuery(_options.includeTrashed)) {
+        if (_options.maxConcurrentRequests == 0) _options.maxConcurrentRequests = 1;
+        _options.fields.set(GFileField::id).set(GFileField::mimeType);
+    }
+
+    DirectoryCrawler::~DirectoryCrawler() {
+        cancel();
+        _threads.clear();
+    }
+
+    void DirectoryCrawler::start(const std::string& rootFolderId, FileCallback onFile, ErrorCallback onError) {
+        if (!onFile) {
+            throw std::invalid_argument("Crawler file callback must not be empty, use the queue mode instead");
+        }
+        _onFile = std::move(onFile);
+        _onError = std::move(onError);
+        launch(rootFolderId);
+    }
+
+    void DirectoryCrawler::start(const std::string& rootFolderId) { launch(rootFolderId); }
+
+    void DirectoryCrawler::launch(const std::string& rootFolderId) {
+        if (!_threads.empty()) {
+            throw std::logic_error("Crawler was already started");
+        }
+        for (uint32_t i = 0; i < _options.maxConcurrentRequests; ++i) {
+            _workers.push_back(std::make_unique<Worker>());
+        }
+        push(0, Task{.folderId = rootFolderId}, false);
+        for (size_t i = 0; i < _workers.size(); ++i) {
+            _threads.emplace_back(&DirectoryCrawler::run, this, i);
+        }
+    }
+
+    std::optional<std::shared_ptr<GFile>> DirectoryCrawler::next() {
+        std::unique_lock lock(_queueMutex);
+        _queueReadable.wait(lock, [this] { return !_queue.empty() || isFinished(); });
+        if (_queue.empty()) return std::nullopt;
+        auto file = std::move(_queue.front());
+        _queue.pop_front();
+        _queueWritable.notify_one();
+        return file;
+    }
+
+    void DirectoryCrawler::wait() {
+        std::unique_lock lock(_idleMutex);
+        _idle.wait(lock, [this] { return isFinished(); });
+    }
+
+    void DirectoryCrawler::cancel() {
+        _cancelled = true;
+        {
+            std::lock_guard lock(_idleMutex);
+        }
+        _idle.notify_all();
+        std::lock_guard lock(_queueMutex);
+        _queueReadable.notify_all();
+        _queueWritable.notify_all();
+    }
+
+    bool DirectoryCrawler::isFinished() const { return _cancelled || _pending == 0; }
+
+    CrawlerStats DirectoryCrawler::getStats() const {
+        return CrawlerStats{.inFlightRequests = _inFlight,
+                            .completedRequests = _completed,
+                            .failedRequests = _failed,
+                            .queuedTasks = _queued,
+                            .discoveredFiles = _files,
+                            .discoveredFolders = _folders,
+                            .steals = _steals};
+    }
+
+    void DirectoryCrawler::run(size_t index) {
+        while (!isFinished()) {
+            auto task = take(index);
+            if (!task) {
+                std::unique_lock lock(_idleMutex);
+                _idle.wait(lock, [this] { return _queued > 0 || isFinished(); });
+                continue;
+            }
+            process(index, *task);
+            finishTask();
+        }
+    }
+
+    std::optional<DirectoryCrawler::Task> DirectoryCrawler::take(size_t index) {
+        for (size_t offset = 0; offset < _workers.size(); ++offset) {
+            Worker& worker = *_workers[(index + offset) % _workers.size()];
+            std::lock_guard lock(worker.mutex);
+            if (worker.tasks.empty()) continue;
+            Task task;
+            if (offset == 0) {
+                task = std::move(worker.tasks.front());
+                worker.tasks.pop_front();
+            } else {
+                task = std::move(worker.tasks.back());
+                worker.tasks.pop_back();
+                ++_steals;
+            }
+            --_queued;
+            return task;
+        }
+        return std::nullopt;
+    }
+
+    void DirectoryCrawler::push(size_t index, Task&& task, bool front) {
+        ++_pending;
+        {
+            Worker& worker = *_workers[index];
+            std::lock_guard lock(worker.mutex);
+            if (front) {
+                worker.tasks.push_front(std::move(task));
+            } else {
+                worker.tasks.push_back(std::move(task));
+            }
+            ++_queued;
+        }
+        // Taking the idle lock orders the wake up after a waiter's predicate check
+        {
+            std::lock_guard lock(_idleMutex);
+        }
+        _idle.notify_one();
+    }
+
+    GFileListRequest DirectoryCrawler::makeRequest(const Task& task) const {
+        return GFileListRequest{.corpora = "user",
+                                .includeItemsFromAllDrives = true,
+                                .pageSize = _options.pageSize,
+                                .pageToken = task.pageToken,
+                                .q = _query.Build({task.folderId}),
+                                .supportsAllDrives = true,
+                                .fieldMask = _options.fields};
+    }
+
+    void DirectoryCrawler::process(size_t index, const Task& task) {
+        std::optional<GFileList> page;
+        ++_inFlight;
+        try {
+            page.emplace(_client, makeRequest(task));
+        } catch (...) {
+            --_inFlight;
+            ++_failed;
+            spdlog::warn("Failed to list folder '{}' while crawling", task.folderId);
+            if (_onError) _onError(task.folderId, std::current_exception());
+            return;
+        }
+        --_inFlight;
+        ++_completed;
+
+        // The next page of the same folder is requested by this worker right away, its subfolders can be stolen
+        if (!page->getNextPageToken().empty()) {
+            push(index, Task{.folderId = task.folderId, .pageToken = page->getNextPageToken()}, true);
+        }
+        for (auto& file : page->files) {
+            if (_options.index) _options.index->put(std::make_shared<const GFile>(*file));
+            if (file->id.has_value() && file->mimeType == FOLDER_MIME_TYPE) {
+                ++_folders;
+                push(index, Task{.folderId = *file->id}, false);
+            }
+            ++_files;
+            deliver(std::move(file));
+        }
+        if (_options.index && page->getNextPageToken().empty()) {
+            _options.index->markListed(task.folderId, _options.fields, _options.includeTrashed);
+        }
+    }
+
+    void DirectoryCrawler::deliver(std::shared_ptr<GFile> file) {
+        if (_onFile) {
+            _onFile(std::move(file));
+            return;
+        }
+        std::unique_lock lock(_queueMutex);
+        _queueWritable.wait(lock, [this] { return _queue.size() < _options.queueCapacity || _cancelled; });
+        if (_cancelled) return;
+        _queue.push_back(std::move(file));
+        _queueReadable.notify_one();
+    }
+
+    void DirectoryCrawler::finishTask() {
+        if (--_pending != 0) return;
+        {
+            std::lock_guard lock(_idleMutex);
+        }
+        _idle.notify_all();
+        std::lock_guard lock(_queueMutex);
+        _queueReadable.notify_all();
+    }
+}  // namespace GDrive
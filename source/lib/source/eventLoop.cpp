@@ -0,0 +1,254 @@
+#include "eventLoop.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "logging.hpp"
+
+namespace GCloud::Http {
+    class EventLoop::Core {
+      public:
+        struct Transfer {
+            std::shared_ptr<cpr::Session> session;
+            Method method;
+            cpr::WriteCallback write;
+            CompletionCallback onComplete;
+            FailureCallback onFailure;
+        };
+
+        struct Timer {
+            Task task;
+            FailureCallback onFailure;
+        };
+
+        explicit Core(const ConnectionPoolOptions& options);
+        ~Core();
+
+        void enqueue(Transfer&& transfer);
+        void schedule(std::chrono::steady_clock::duration delay, Task task, FailureCallback onFailure);
+        void stop();
+        void run();
+
+        size_t getActiveTransfers() const { return _activeCount.load(std::memory_order_relaxed); }
+
+      private:
+        // Milliseconds curl_multi_poll may sleep before the next timer is due
+        int runTimers();
+        void start(Transfer&& transfer);
+        void finish(CURL* handle, CURLcode result);
+        void cancelAll();
+
+        CURLM* _multi = nullptr;
+        std::mutex _mutex;
+        std::deque<Transfer> _pending;
+        std::multimap<std::chrono::steady_clock::time_point, Timer> _timers;
+        std::unordered_map<CURL*, Transfer> _active;
+        std::atomic<size_t> _activeCount{0};
+        std::atomic<bool> _running{true};
+    };
+
+    EventLoop::EventLoop(const ConnectionPoolOptions& options) : _core(std::make_shared<Core>(options)) {
+        _thread = std::thread([core = _core] { core->run(); });
+    }
+
+    EventLoop::~EventLoop() {
+        _core->stop();
+        if (isLoopThread()) {
+            // Dropped by one of its own callbacks; the thread holds on to the core until it has cancelled the rest
+            _thread.detach();
+        } else if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
+
+    void EventLoop::submit(std::shared_ptr<cpr::Session> session, Method method, CompletionCallback onComplete,
+                           FailureCallback onFailure) {
+        if (method == Method::Download) {
+            throw std::invalid_argument("Download transfers must be submitted through submitDownload");
+        }
+        _core->enqueue(Core::Transfer{.session = std::move(session),
+                                      .method = method,
+                                      .onComplete = std::move(onComplete),
+                                      .onFailure = std::move(onFailure)});
+    }
+
+    void EventLoop::submitDownload(std::shared_ptr<cpr::Session> session, cpr::WriteCallback write,
+                                   CompletionCallback onComplete, FailureCallback onFailure) {
+        _core->enqueue(Core::Transfer{.session = std::move(session),
+                                      .method = Method::Download,
+                                      .write = std::move(write),
+                                      .onComplete = std::move(onComplete),
+                                      .onFailure = std::move(onFailure)});
+    }
+
+    void EventLoop::schedule(std::chrono::steady_clock::duration delay, Task task, FailureCallback onFailure) {
+        _core->schedule(delay, std::move(task), std::move(onFailure));
+    }
+
+    size_t EventLoop::getActiveTransfers() const { return _core->getActiveTransfers(); }
+
+    EventLoop::Core::Core(const ConnectionPoolOptions& options) {
+        _multi = curl_multi_init();
+        if (!_multi) {
+            throw std::runtime_error("Failed to create request event loop");
+        }
+        curl_multi_setopt(_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        curl_multi_setopt(_multi, CURLMOPT_MAX_HOST_CONNECTIONS, static_cast<long>(options.maxConnections));
+    }
+
+    EventLoop::Core::~Core() { curl_multi_cleanup(_multi); }
+
+    void EventLoop::Core::stop() {
+        {
+            // Taken so that nothing is queued behind cancelAll once it has emptied the queues
+            std::lock_guard lock(_mutex);
+            _running = false;
+        }
+        curl_multi_wakeup(_multi);
+    }
+
+    void EventLoop::Core::schedule(std::chrono::steady_clock::duration delay, Task task, FailureCallback onFailure) {
+        {
+            std::lock_guard lock(_mutex);
+            if (!_running) {
+                throw std::runtime_error("Request event loop is not running");
+            }
+            _timers.emplace(std::chrono::steady_clock::now() + delay,
+                            Timer{.task = std::move(task), .onFailure = std::move(onFailure)});
+        }
+        curl_multi_wakeup(_multi);
+    }
+
+    void EventLoop::Core::enqueue(Transfer&& transfer) {
+        {
+            std::lock_guard lock(_mutex);
+            if (!_running) {
+                throw std::runtime_error("Request event loop is not running");
+            }
+            _pending.push_back(std::move(transfer));
+        }
+        curl_multi_wakeup(_multi);
+    }
+
+    void EventLoop::Core::run() {
+        while (_running) {
+            std::deque<Transfer> pending;
+            {
+                std::lock_guard lock(_mutex);
+                pending.swap(_pending);
+            }
+            for (auto& transfer : pending) start(std::move(transfer));
+            int timeout = runTimers();
+
+            int stillRunning = 0;
+            curl_multi_perform(_multi, &stillRunning);
+
+            int queued = 0;
+            while (CURLMsg* message = curl_multi_info_read(_multi, &queued)) {
+                if (message->msg == CURLMSG_DONE) finish(message->easy_handle, message->data.result);
+            }
+
+            curl_multi_poll(_multi, nullptr, 0, timeout, nullptr);
+        }
+        cancelAll();
+    }
+
+    int EventLoop::Core::runTimers() {
+        std::vector<Timer> due;
+        int timeout = 1000;
+        {
+            std::lock_guard lock(_mutex);
+            auto now = std::chrono::steady_clock::now();
+            while (!_timers.empty() && _timers.begin()->first <= now) {
+                due.push_back(std::move(_timers.begin()->second));
+                _timers.erase(_timers.begin());
+            }
+            if (!_timers.empty()) {
+                auto wait = std::chrono::ceil<std::chrono::milliseconds>(_timers.begin()->first - now).count();
+                timeout = static_cast<int>(std::min<int64_t>(timeout, wait));
+            }
+        }
+        // Tasks may submit transfers or schedule again, which takes the lock
+        for (auto& timer : due) {
+            try {
+                timer.task();
+            } catch (...) {
+                if (timer.onFailure) timer.onFailure(std::current_exception());
+            }
+        }
+        return due.empty() ? timeout : 0;
+    }
+
+    void EventLoop::Core::start(Transfer&& transfer) {
+        try {
+            switch (transfer.method) {
+                case Method::Get: transfer.session->PrepareGet(); break;
+                case Method::Post: transfer.session->PreparePost(); break;
+                case Method::Put: transfer.session->PreparePut(); break;
+                case Method::Patch: transfer.session->PreparePatch(); break;
+                case Method::Download: transfer.session->PrepareDownload(transfer.write); break;
+            }
+            CURL* handle = transfer.session->GetCurlHolder()->handle;
+            if (curl_multi_add_handle(_multi, handle) != CURLM_OK) {
+                throw std::runtime_error("Failed to add transfer to the request event loop");
+            }
+            _active.emplace(handle, std::move(transfer));
+            ++_activeCount;
+        } catch (...) {
+            if (transfer.onFailure) transfer.onFailure(std::current_exception());
+        }
+    }
+
+    void EventLoop::Core::finish(CURL* handle, CURLcode result) {
+        auto it = _active.find(handle);
+        if (it == _active.end()) return;
+        Transfer transfer = std::move(it->second);
+        _active.erase(it);
+        --_activeCount;
+        curl_multi_remove_handle(_multi, handle);
+
+        try {
+            cpr::Response response = transfer.method == Method::Download
+                                         ? transfer.session->CompleteDownload(result)
+                                         : transfer.session->Complete(result);
+            if (transfer.onComplete) transfer.onComplete(std::move(response));
+        } catch (...) {
+            if (transfer.onFailure) {
+                transfer.onFailure(std::current_exception());
+            } else {
+                spdlog::error("Unhandled error in request completion callback");
+            }
+        }
+    }
+
+    void EventLoop::Core::cancelAll() {
+        auto cancelled = std::make_exception_ptr(std::runtime_error("Request event loop stopped"));
+        for (auto& [handle, transfer] : _active) {
+            curl_multi_remove_handle(_multi, handle);
+            if (transfer.onFailure) transfer.onFailure(cancelled);
+        }
+        _active.clear();
+        _activeCount = 0;
+
+        // Callbacks may submit again, which enqueue refuses now, so they must not be called under the lock
+        std::deque<Transfer> pending;
+        std::multimap<std::chrono::steady_clock::time_point, Timer> timers;
+        {
+            std::lock_guard lock(_mutex);
+            pending.swap(_pending);
+            timers.swap(_timers);
+        }
+        for (auto& transfer : pending) {
+            if (transfer.onFailure) transfer.onFailure(cancelled);
+        }
+        for (auto& [due, timer] : timers) {
+            if (timer.onFailure) timer.onFailure(cancelled);
+        }
+    }
+}  // namespace GCloud::Http
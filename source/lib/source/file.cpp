@@ -1,122 +1,1066 @@
 #include <cpr/cpr.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <format>
+#include <fstream>
+#include <map>
+#include <mutex>
 #include <nlohmann/json.hpp>
+#include <thread>
 
+#include "GDriveCpp/blobCache.h"
 #include "GDriveCpp/gDrive.h"
 #include "GDriveCpp/gFile.h"
+#include "GDriveCpp/metadataIndex.h"
+#include "GDriveCpp/queryBuilder.h"
+#include "batchScheduler.hpp"
 #include "constants.hpp"
+#include "data.hpp"
+#include "eventLoop.hpp"
+#include "fileFields.hpp"
+#include "fileListParser.hpp"
+#include "io.hpp"
 #include "logging.hpp"
+#include "requestScheduler.hpp"
+#include "sessionPool.hpp"
 
 namespace GDrive {
-    std::optional<GFileList> GFileList::QueryDirectory(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
-                                                       std::shared_ptr<const GFile> root,
-                                                       const std::string& searchPath) {
-        std::filesystem::path path(searchPath);
-        std::filesystem::path currentPath;
-        std::unique_ptr<GFileList> nextDir;
-        for (auto it = path.begin(); it != path.end(); ++it) {
-            bool isLast = std::next(it) == path.end();
-            if (it->empty() && !isLast) continue;  // Skip empty parts
-            if (*it == ".") continue;              // Skip current directory
-            if (*it == "..") {
-                spdlog::error("Cannot go up directories. Not implemented!");
+    namespace {
+        struct DirectoryStep {
+            std::string name;
+            bool isLast;
+        };
+
+        std::optional<std::vector<DirectoryStep>> splitSearchPath(const std::string& searchPath) {
+            std::filesystem::path path(searchPath);
+            std::vector<DirectoryStep> steps;
+            for (auto it = path.begin(); it != path.end(); ++it) {
+                bool isLast = std::next(it) == path.end();
+                if (it->empty() && !isLast) continue;  // Skip empty parts
+                if (*it == ".") continue;              // Skip current directory
+                if (*it == "..") {
+                    spdlog::error("Cannot go up directories. Not implemented!");
+                    return std::nullopt;
+                }
+                steps.push_back(DirectoryStep{.name = it->generic_string(), .isLast = isLast});
+            }
+            if (steps.empty()) {
+                spdlog::error("Search path '{}' does not contain any directory", searchPath);
                 return std::nullopt;
-            } else {
-                if (!root) {
-                    nextDir = std::make_unique<GFileList>(
-                        client, GFileListRequest{
-                                    .corpora = "user",
+            }
+            return steps;
+        }
+
+        // Intermediate folders are only needed for their id, the last step returns the caller's fields
+        GFileFieldMask directoryStepFields(const DirectoryStep& step, const GFileFieldMask& listedFields) {
+            return step.isLast ? listedFields | GFileFieldMask{GFileField::id}
+                               : GFileFieldMask{GFileField::id, GFileField::name};
+        }
+
+        // Query of a directory step. Every shape is compiled once and shared, values are escaped while copied in.
+        std::string directoryStepQuery(const GFile* root, const DirectoryStep& step) {
+            using Operator = QueryBuilder::ComparisonOperator;
+            static const QueryTemplate TOP_LEVEL = QueryBuilder()
+                                                       .AddParameter("name", Operator::Equal, "name")
+                                                       .AddCondition("mimeType", Operator::Equal,
+                                                                     std::string(FOLDER_MIME_TYPE))
+                                                       .Compile();
+            // Indexed by 2 * (folders only) + (named)
+            static const std::array<QueryTemplate, 4> CHILD = [] {
+                auto compile = [](bool folder, bool named) {
+                    return QueryBuilder()
+                        .AddParameter("parents", Operator::In, "parent")
+                        .AddCondition("mimeType", Operator::Equal, std::string(FOLDER_MIME_TYPE), folder)
+                        .AddParameter("name", Operator::Equal, "name", named)
+                        .Compile();
+                };
+                return std::array{compile(false, false), compile(false, true), compile(true, false),
+                                  compile(true, true)};
+            }();
+            if (!root) return TOP_LEVEL.Build({step.name});
+            const QueryTemplate& query = CHILD[(step.isLast ? 0 : 2) + (step.name.empty() ? 0 : 1)];
+            if (step.name.empty()) return query.Build({root->id.value()});
+            return query.Build({root->id.value(), step.name});
+        }
+
+        std::optional<GFileListRequest> makeDirectoryStepRequest(const GFile* root, const DirectoryStep& step,
+                                                                 const GFileFieldMask& listedFields) {
+            GFileFieldMask fields = directoryStepFields(step, listedFields);
+            if (!root) {
+                return GFileListRequest{
+                    .corpora = "user",
+                    .includeItemsFromAllDrives = false,
+                    .orderBy = "createdTime desc",
+                    .pageSize = 1,
+                    .q = directoryStepQuery(nullptr, step),
+                    .supportsAllDrives = true,
+                    .fieldMask = fields};
+            }
+            if (!root->id.has_value()) {
+                spdlog::error("Root file ID is missing, cannot query directory");
+                return std::nullopt;
+            }
+            return GFileListRequest{.corpora = "user",
                                     .includeItemsFromAllDrives = false,
                                     .orderBy = "createdTime desc",
-                                    .pageSize = 1,
-                                    .q = std::format("name = '{}' and mimeType = 'application/vnd.google-apps.folder'",
-                                                     it->generic_string()),
+                                    .pageSize = (step.isLast) ? 20u : 1u,
+                                    .q = directoryStepQuery(root, step),
                                     .supportsAllDrives = true,
-                                    .fields = "nextPageToken, files(name, id, createdTime)"});
+                                    .fieldMask = fields};
+        }
+
+        // Checks the result of one directory step. Returns false when the walk cannot continue.
+        bool checkDirectoryStep(const GFileList& list, const DirectoryStep& step,
+                                const std::filesystem::path& current) {
+            if (list.files.empty()) {
+                // Listing an empty folder is a valid result for a trailing separator
+                if (step.isLast && step.name.empty()) return true;
+                spdlog::error("Directory '{}' not found in Google Drive under {}", step.name, current.generic_string());
+                return false;
+            }
+            if (!list.files[0]->id.has_value()) {
+                spdlog::error("Directory ID is missing for '{}'", step.name);
+                return false;
+            }
+            return true;
+        }
+
+        // Position of a directory walk, shared by the synchronous and asynchronous QueryDirectory
+        struct DirectoryWalk {
+            std::vector<DirectoryStep> steps;
+            size_t index = 0;
+            std::shared_ptr<const GFile> root;
+            std::string rootId;
+            std::filesystem::path currentPath;
+            std::shared_ptr<PathCache> pathCache;
+            std::shared_ptr<MetadataIndex> metadataIndex;
+            GFileFieldMask fields;
+            // Number of leading steps taken from the cache instead of the server
+            size_t cachedDepth = 0;
+
+            bool start(const std::weak_ptr<GCloud::Authentication::OAuthAgent>& client,
+                       std::shared_ptr<const GFile> startRoot, const std::string& searchPath,
+                       const GDirectoryQueryOptions& options) {
+                auto split = splitSearchPath(searchPath);
+                if (!split) return false;
+                steps = std::move(*split);
+                root = std::move(startRoot);
+                if (root && root->id.has_value()) rootId = root->id.value();
+                pathCache = options.pathCache;
+                metadataIndex = options.index;
+                fields = options.fields;
+                if (pathCache) skipCachedSteps(client);
+                return true;
+            }
+
+            // Jumps to the deepest folder prefix the cache already resolved. The last step always
+            // goes to the server since its result is the listing itself.
+            void skipCachedSteps(const std::weak_ptr<GCloud::Authentication::OAuthAgent>& client) {
+                for (size_t depth = steps.size() - 1; depth > 0; --depth) {
+                    auto folderId = pathCache->lookup(rootId, prefix(depth));
+                    if (!folderId) continue;
+                    auto cachedRoot = std::make_shared<GFile>(client);
+                    cachedRoot->id = *folderId;
+                    cachedRoot->name = steps[depth - 1].name;
+                    root = cachedRoot;
+                    cachedDepth = depth;
+                    for (index = 0; index < depth; ++index) currentPath /= steps[index].name;
+                    return;
+                }
+            }
+
+            // Path of the first `depth` steps, used as cache key
+            std::string prefix(size_t depth) const {
+                std::string path;
+                for (size_t i = 0; i < depth; ++i) {
+                    if (i > 0) path += '/';
+                    path += steps[i].name;
+                }
+                return path;
+            }
+
+            // A cached folder that no longer leads anywhere is dropped so the walk can be retried from scratch
+            bool dropStaleCache() {
+                if (!cachedDepth) return false;
+                spdlog::debug("Cached folder '{}' is stale, resolving it again", prefix(cachedDepth));
+                pathCache->invalidate(rootId, prefix(cachedDepth));
+                return true;
+            }
+
+            // Answers the current step locally when the index holds the complete listing of its folder with
+            // every member the step needs. Returns nothing when the server has to be asked.
+            std::optional<GFileList> listFromIndex(const std::weak_ptr<GCloud::Authentication::OAuthAgent>& client) {
+                if (!metadataIndex || !root || !root->id.has_value()) return std::nullopt;
+                const DirectoryStep& step = steps[index];
+                GFileFieldMask needed = directoryStepFields(step, fields);
+                // Intermediate steps only follow folders
+                if (!step.isLast) needed.set(GFileField::mimeType);
+                // Directory steps do not filter on trashed, neither may the listing they are answered from
+                auto listed = metadataIndex->listedFields(root->id.value(), true);
+                if (!listed || (*listed & needed) != needed) return std::nullopt;
 
+                auto found = step.name.empty() ? metadataIndex->children(root->id.value())
+                                               : metadataIndex->findChild(root->id.value(), step.name);
+                std::vector<std::shared_ptr<GFile>> files;
+                for (const auto& file : found) {
+                    if (!step.isLast && file->mimeType != FOLDER_MIME_TYPE) continue;
+                    // Entries of the index are shared and immutable, the caller gets its own copies
+                    files.push_back(std::make_shared<GFile>(*file));
+                }
+                // Same order as the server's createdTime desc
+                std::ranges::stable_sort(files, std::ranges::greater{},
+                                         [](const auto& file) { return file->createdTime.value_or(""); });
+                return GFileList(client, std::move(files));
+            }
+
+            // Stores the listing fetched for the last step; a complete listing of a folder marks it as listed
+            void storeListing(const GFileList& list) {
+                const DirectoryStep& step = steps[index];
+                if (!metadataIndex || !step.isLast || !root || !root->id.has_value()) return;
+                for (const auto& file : list.files) metadataIndex->put(std::make_shared<const GFile>(*file));
+                if (step.name.empty() && list.getNextPageToken().empty()) {
+                    metadataIndex->markListed(root->id.value(), directoryStepFields(step, fields), true);
+                }
+            }
+
+            bool completeStep(const GFileList& list) {
+                const DirectoryStep& step = steps[index];
+                if (!checkDirectoryStep(list, step, currentPath)) return false;
+                currentPath /= step.name;
+                if (!step.isLast) {
+                    root = list.files[0];
+                    if (pathCache) pathCache->store(rootId, prefix(index + 1), root->id.value());
+                }
+                return true;
+            }
+        };
+
+        std::string makeBatchPath(const std::string& path,
+                                  const std::vector<std::pair<std::string, std::string>>& query) {
+            std::string result = path;
+            for (size_t i = 0; i < query.size(); ++i) {
+                result += i == 0 ? '?' : '&';
+                result += GCloud::Http::percentEncode(query[i].first);
+                result += '=';
+                result += GCloud::Http::percentEncode(query[i].second);
+            }
+            return result;
+        }
+
+        std::filesystem::path resolveDownloadPath(const GFile& file, const std::string& path) {
+            std::filesystem::path finalPath = std::filesystem::path(path);
+            if (!finalPath.has_filename()) {
+                if (file.name.has_value()) {
+                    finalPath /= file.name.value();
                 } else {
-                    if (!root->id.has_value()) {
-                        spdlog::error("Root file ID is missing, cannot query directory");
-                        return std::nullopt;
+                    finalPath /= file.id.value();
+                }
+            }
+            return finalPath;
+        }
+
+        // Sessions of asynchronous requests carry the access token, refreshing it would stall the event loop
+        std::function<bool()> waitsForToken(std::weak_ptr<GCloud::Authentication::OAuthAgent> client) {
+            return [client] {
+                auto agent = client.lock();
+                return agent && !agent->hasFreshToken();
+            };
+        }
+
+        std::shared_ptr<cpr::Session> makeDownloadSession(GCloud::Authentication::OAuthAgent& agent,
+                                                          const std::string& fileId) {
+            auto session = agent.getSessionPool()->makeSession();
+            session->SetUrl(cpr::Url{"https://www.googleapis.com/drive/v3/files/" + fileId + "?alt=media"});
+            session->SetBearer(cpr::Bearer{agent.getAccessToken()});
+            return session;
+        }
+
+        bool isRetryableStatus(long statusCode) {
+            // 0 means the transfer itself failed (connection reset, timeout, ...)
+            return statusCode == 0 || statusCode == 429 || statusCode >= 500;
+        }
+
+        struct Checksum {
+            utils::data::Digest::Algorithm algorithm;
+            std::string_view name;
+            std::string value;
+        };
+
+        // Strongest checksum in the metadata of file
+        std::optional<Checksum> expectedChecksum(const GFile& file) {
+            using Algorithm = utils::data::Digest::Algorithm;
+            if (file.sha256Checksum) return Checksum{Algorithm::Sha256, "SHA-256", file.sha256Checksum.value()};
+            if (file.sha1Checksum) return Checksum{Algorithm::Sha1, "SHA-1", file.sha1Checksum.value()};
+            if (file.md5Checksum) return Checksum{Algorithm::Md5, "MD5", file.md5Checksum.value()};
+            return std::nullopt;
+        }
+
+        // Digest of a file written out of order by several ranged downloads. Bytes written at the hashed prefix
+        // go into the digest as they arrive; ranges written ahead are noted and read back from the file, still
+        // in the page cache, once the prefix reaches them. Only one writer hashes at a time, the others just
+        // note their range, so the fetches are never serialized behind the digest.
+        class OrderedDigest {
+          public:
+            OrderedDigest(utils::data::Digest::Algorithm algorithm, const utils::io::RandomAccessFile& file)
+                : _digest(algorithm), _file(file) {}
+
+            // data was written to the file at offset
+            void add(uint64_t offset, std::string_view data) {
+                std::unique_lock lock(_mutex);
+                if (_hashing || offset != _hashed) {
+                    note(offset, data.size());
+                    return;
+                }
+                _hashing = true;
+                lock.unlock();
+                try {
+                    _digest.update(data);
+                } catch (...) {
+                    lock.lock();
+                    _hashing = false;
+                    throw;
+                }
+                lock.lock();
+                _hashed += data.size();
+                drain(lock);
+            }
+
+            std::string finish() {
+                std::unique_lock lock(_mutex);
+                _hashing = true;
+                drain(lock);
+                return _digest.finish();
+            }
+
+          private:
+            static constexpr size_t READ_BACK_BLOCK = 1024 * 1024;
+
+            void note(uint64_t offset, uint64_t size) {
+                uint64_t end = offset + size;
+                // Writes of one range arrive in order, most extend the range noted before
+                auto it = _ahead.lower_bound(offset);
+                if (it != _ahead.begin() && std::prev(it)->second == offset) {
+                    --it;
+                    it->second = end;
+                } else {
+                    it = _ahead.emplace(offset, end).first;
+                }
+                auto next = std::next(it);
+                if (next != _ahead.end() && next->first == end) {
+                    it->second = next->second;
+                    _ahead.erase(next);
+                }
+            }
+
+            // Hashes the noted ranges that continue the prefix; called with _hashing set, clears it
+            void drain(std::unique_lock<std::mutex>& lock) {
+                std::string buffer;
+                while (!_ahead.empty() && _ahead.begin()->first == _hashed) {
+                    uint64_t end = _ahead.begin()->second;
+                    _ahead.erase(_ahead.begin());
+                    lock.unlock();
+                    try {
+                        buffer.resize(READ_BACK_BLOCK);
+                        for (uint64_t offset = _hashed; offset < end;) {
+                            size_t size = static_cast<size_t>(std::min<uint64_t>(READ_BACK_BLOCK, end - offset));
+                            if (_file.readAt(offset, buffer.data(), size) != size) {
+                                throw std::runtime_error("File download failed: Downloaded range cannot be read back");
+                            }
+                            _digest.update(std::string_view(buffer.data(), size));
+                            offset += size;
+                        }
+                    } catch (...) {
+                        lock.lock();
+                        _hashing = false;
+                        throw;
                     }
-                    std::string q = std::format("'{}' in parents", root->id.value());
-                    if (!isLast) q += " and mimeType = 'application/vnd.google-apps.folder'";
-                    if (!it->empty()) q += std::format(" and name = '{}'", it->generic_string());
-
-                    nextDir = std::make_unique<GFileList>(
-                        client, GFileListRequest{.corpora = "user",
-                                                 .includeItemsFromAllDrives = false,
-                                                 .orderBy = "createdTime desc",
-                                                 .pageSize = (isLast) ? 20u : 1u,
-                                                 .q = q,
-                                                 .supportsAllDrives = true,
-                                                 .fields = "nextPageToken, files(name, id, createdTime)"});
-                }
-                if (nextDir->files.empty()) {
-                    spdlog::error("Directory '{}' not found in Google Drive under {}", it->generic_string(),
-                                  currentPath.generic_string());
-                }
-                if (!nextDir->files[0]->id.has_value()) {
-                    spdlog::error("Directory ID is missing for '{}'", it->generic_string());
-                    return std::nullopt;
+                    lock.lock();
+                    _hashed = end;
+                }
+                _hashing = false;
+            }
+
+            utils::data::Digest _digest;
+            const utils::io::RandomAccessFile& _file;
+            std::mutex _mutex;
+            // Bytes hashed so far, all at the start of the file
+            uint64_t _hashed = 0;
+            bool _hashing = false;
+            // Written ranges past _hashed, start to end
+            std::map<uint64_t, uint64_t> _ahead;
+        };
+
+        void downloadRange(GCloud::Authentication::OAuthAgent& agent, const std::string& fileId,
+                           utils::io::RandomAccessFile& file, OrderedDigest* digest, uint64_t first, uint64_t last,
+                           uint32_t maxRetries) {
+            uint64_t offset = first;
+            for (uint32_t attempt = 0;; ++attempt) {
+                std::exception_ptr writeError;
+                // Throttled and failed attempts are retried by the scheduler, each resuming at the current offset
+                auto response = agent.getRequestScheduler()->execute([&] {
+                    auto session = makeDownloadSession(agent, fileId);
+                    session->SetHeader(cpr::Header{{"Range", std::format("bytes={}-{}", offset, last)}});
+                    GCloud::Http::ResponseHeaders headers;
+                    // Kept for the error message and the scheduler, which looks for rate limit reasons in it
+                    std::string errorBody;
+                    // A server ignoring the range sends the whole file, the bytes ahead of offset are dropped
+                    uint64_t skip = 0;
+                    session->SetHeaderCallback(cpr::HeaderCallback{[&](const std::string_view& header, intptr_t) {
+                        if (long status = headers.add(header)) skip = status == 200 ? offset : 0;
+                        return true;
+                    }});
+                    auto result = session->Download(cpr::WriteCallback{[&](const std::string_view& data, intptr_t) {
+                        // Error bodies are not file content
+                        long statusCode = headers.getStatusCode();
+                        if (statusCode != 200 && statusCode != 206) {
+                            errorBody.append(data);
+                            return true;
+                        }
+                        std::string_view content = data;
+                        uint64_t skipped = std::min<uint64_t>(skip, content.size());
+                        content.remove_prefix(static_cast<size_t>(skipped));
+                        skip -= skipped;
+                        if (content.empty()) return true;
+                        // Never write past the chunk, what follows belongs to other workers
+                        bool beyond = offset + content.size() > last + 1;
+                        if (beyond) content = content.substr(0, static_cast<size_t>(last + 1 - offset));
+                        try {
+                            file.writeAt(offset, content.data(), content.size());
+                            if (digest) digest->add(offset, content);
+                        } catch (...) {
+                            writeError = std::current_exception();
+                            return false;
+                        }
+                        offset += content.size();
+                        return !beyond;
+                    }});
+                    headers.applyTo(result);
+                    if (result.status_code != 200 && result.status_code != 206) result.text = std::move(errorBody);
+                    return result;
+                });
+                if (writeError) std::rethrow_exception(writeError);
+                bool content = response.status_code == 200 || response.status_code == 206;
+                if (content && offset == last + 1) return;
+                if (content) {
+                    // Short body; whatever arrived is kept and the rest is requested again
+                } else if (!isRetryableStatus(response.status_code)) {
+                    throw std::runtime_error(std::format("File download failed: {} - {}\n{}", response.status_code,
+                                                         response.reason, response.text));
+                }
+                if (attempt >= maxRetries) {
+                    throw std::runtime_error(
+                        std::format("File download failed: bytes {}-{} missing after {} attempts ({})", offset,
+                                    last, attempt + 1, response.error.message));
+                }
+                spdlog::warn("Retrying bytes {}-{} of file {} ({} - {})", offset, last, fileId, response.status_code,
+                             response.error.message);
+            }
+        }
+
+        // Resumes interrupted transfers with a Range request, so sink sees every byte exactly once. Returns false
+        // when the sink stopped the download.
+        bool streamDownload(GCloud::Authentication::OAuthAgent& agent, const std::string& fileId,
+                            const GFileContentSink& sink, uint32_t maxRetries) {
+            uint64_t offset = 0;
+            for (uint32_t attempt = 0;; ++attempt) {
+                std::exception_ptr sinkError;
+                bool stopped = false;
+                auto response = agent.getRequestScheduler()->execute([&] {
+                    auto session = makeDownloadSession(agent, fileId);
+                    if (offset > 0) session->SetHeader(cpr::Header{{"Range", std::format("bytes={}-", offset)}});
+                    GCloud::Http::ResponseHeaders headers;
+                    // Kept for the error message and the scheduler, which looks for rate limit reasons in it
+                    std::string errorBody;
+                    // Content already delivered, to be dropped when the server ignores the range
+                    uint64_t skip = 0;
+                    session->SetHeaderCallback(cpr::HeaderCallback{[&](const std::string_view& header, intptr_t) {
+                        if (long status = headers.add(header)) skip = status == 200 ? offset : 0;
+                        return true;
+                    }});
+                    auto result = session->Download(cpr::WriteCallback{[&](const std::string_view& data, intptr_t) {
+                        // Error bodies are not file content
+                        long statusCode = headers.getStatusCode();
+                        if (statusCode != 200 && statusCode != 206) {
+                            errorBody.append(data);
+                            return true;
+                        }
+                        std::string_view content = data;
+                        uint64_t skipped = std::min<uint64_t>(skip, content.size());
+                        content.remove_prefix(static_cast<size_t>(skipped));
+                        skip -= skipped;
+                        if (content.empty()) return true;
+                        try {
+                            stopped = !sink(content);
+                        } catch (...) {
+                            sinkError = std::current_exception();
+                            return false;
+                        }
+                        if (!stopped) offset += content.size();
+                        return !stopped;
+                    }});
+                    headers.applyTo(result);
+                    if (result.status_code != 200 && result.status_code != 206) result.text = std::move(errorBody);
+                    return result;
+                });
+                if (sinkError) std::rethrow_exception(sinkError);
+                if (stopped) return false;
+                bool content = response.status_code == 200 || response.status_code == 206;
+                if (content && response.error.code == cpr::ErrorCode::OK) return true;
+                // The previous attempt broke off after the last byte
+                if (response.status_code == 416 && offset > 0) return true;
+                if (!content && !isRetryableStatus(response.status_code)) {
+                    throw std::runtime_error(std::format("File download failed: {} - {}\n{}", response.status_code,
+                                                         response.reason, response.text));
+                }
+                if (attempt >= maxRetries) {
+                    throw std::runtime_error(std::format("File download failed after {} bytes and {} attempts ({})",
+                                                         offset, attempt + 1, response.error.message));
+                }
+                spdlog::warn("Resuming file {} at byte {} ({} - {})", fileId, offset, response.status_code,
+                             response.error.message);
+            }
+        }
+
+        // Returns the digest of the content when checksum is given
+        std::string downloadInChunks(GCloud::Authentication::OAuthAgent& agent, const std::string& fileId,
+                                     const std::filesystem::path& path, uint64_t size,
+                                     const GFileDownloadOptions& options, const std::optional<Checksum>& checksum) {
+            utils::io::RandomAccessFile file(path, utils::io::RandomAccessFile::Mode::Overwrite);
+            file.preallocate(size);
+            std::optional<OrderedDigest> digest;
+            if (checksum) digest.emplace(checksum->algorithm, file);
+
+            const uint64_t chunkSize = std::max<uint64_t>(options.chunkSize, 1);
+            const uint64_t chunkCount = (size + chunkSize - 1) / chunkSize;
+            std::atomic<uint64_t> nextChunk{0};
+            std::atomic<bool> failed{false};
+            std::exception_ptr firstError;
+            std::mutex errorMutex;
+
+            auto worker = [&]() {
+                while (!failed) {
+                    uint64_t chunk = nextChunk++;
+                    if (chunk >= chunkCount) return;
+                    uint64_t first = chunk * chunkSize;
+                    uint64_t last = std::min(first + chunkSize, size) - 1;
+                    try {
+                        downloadRange(agent, fileId, file, digest ? &*digest : nullptr, first, last,
+                                      options.maxChunkRetries);
+                    } catch (...) {
+                        std::lock_guard lock(errorMutex);
+                        if (!firstError) firstError = std::current_exception();
+                        failed = true;
+                    }
+                }
+            };
+
+            {
+                const uint64_t workerCount = std::clamp<uint64_t>(options.concurrency, 1, chunkCount);
+                std::vector<std::jthread> workers;
+                workers.reserve(workerCount);
+                for (uint64_t i = 0; i < workerCount; ++i) workers.emplace_back(worker);
+            }
+            if (firstError) std::rethrow_exception(firstError);
+            return digest ? digest->finish() : std::string();
+        }
+
+        // Single stream into path, hashed on the way when checksum is given
+        std::string downloadToFile(GCloud::Authentication::OAuthAgent& agent, const std::string& fileId,
+                                   const std::filesystem::path& path, const GFileDownloadOptions& options,
+                                   const std::optional<Checksum>& checksum) {
+            std::ofstream outFile(path, std::ios::binary | std::ios::trunc);
+            if (!outFile.is_open()) {
+                throw std::runtime_error("File download failed: Cannot open " + path.string());
+            }
+            std::optional<utils::data::Digest> digest;
+            if (checksum) digest.emplace(checksum->algorithm);
+            streamDownload(agent, fileId,
+                           [&](std::string_view data) {
+                               outFile.write(data.data(), static_cast<std::streamsize>(data.size()));
+                               if (digest) digest->update(data);
+                               return outFile.good();
+                           },
+                           options.maxChunkRetries);
+            outFile.close();
+            if (outFile.fail()) {
+                throw std::runtime_error("File download failed: Cannot write " + path.string());
+            }
+            return digest ? digest->finish() : std::string();
+        }
+
+        // Download into a file on the client's event loop, hashed as the content arrives. Broken transfers and
+        // checksum mismatches start it over; a file it gave up on is removed again.
+        class AsyncDownload : public std::enable_shared_from_this<AsyncDownload> {
+          public:
+            AsyncDownload(std::weak_ptr<GCloud::Authentication::OAuthAgent> client, const GFile& file,
+                          std::filesystem::path target, const GFileDownloadOptions& options)
+                : _client(std::move(client)),
+                  _file(file),
+                  _target(std::move(target)),
+                  _options(options),
+                  _checksum(options.verifyChecksum ? expectedChecksum(file) : std::nullopt) {}
+
+            std::future<void> getFuture() { return _promise.get_future(); }
+
+            void submit() {
+                auto client = _client.lock();
+                if (!client) throw std::runtime_error("File download failed: Client is no longer valid");
+                auto self = shared_from_this();
+                client->getRequestScheduler()->submit(
+                    client->getEventLoop(),
+                    GCloud::Http::RequestScheduler::AsyncRequest{
+                        .makeSession =
+                            [self] {
+                                auto agent = self->_client.lock();
+                                if (!agent) throw std::runtime_error("File download failed: Client is no longer valid");
+                                return makeDownloadSession(*agent, self->_file.id.value());
+                            },
+                        .mayBlock = waitsForToken(_client),
+                        .method = GCloud::Http::Method::Download,
+                        .openDownload = [self](cpr::Session& session) { return self->open(session); },
+                        .completeDownload =
+                            [self](cpr::Response& response) {
+                                self->_headers.applyTo(response);
+                                if (response.status_code != 200) response.text = std::move(self->_errorBody);
+                            }},
+                    [self](cpr::Response response) { self->complete(std::move(response)); },
+                    [self](std::exception_ptr error) { self->fail(error); });
+            }
+
+          private:
+            cpr::WriteCallback open(cpr::Session& session) {
+                // Every attempt starts the file over
+                if (_out.is_open()) _out.close();
+                _headers = {};
+                _errorBody.clear();
+                _writeFailed = false;
+                if (_checksum) _digest.emplace(_checksum->algorithm);
+                auto self = shared_from_this();
+                session.SetHeaderCallback(cpr::HeaderCallback{[self](const std::string_view& header, intptr_t) {
+                    self->_headers.add(header);
+                    return true;
+                }});
+                return cpr::WriteCallback{
+                    [self](const std::string_view& data, intptr_t) { return self->write(data); }};
+            }
+
+            bool write(std::string_view data) {
+                // Error bodies are not file content
+                if (_headers.getStatusCode() != 200) {
+                    _errorBody.append(data);
+                    return true;
+                }
+                if (!_out.is_open()) {
+                    _out.clear();
+                    _out.open(_target, std::ios::binary | std::ios::trunc);
+                    _created = true;
+                }
+                _out.write(data.data(), static_cast<std::streamsize>(data.size()));
+                if (_digest) _digest->update(data);
+                _writeFailed = !_out.good();
+                return !_writeFailed;
+            }
+
+            void complete(cpr::Response response) {
+                if (_out.is_open()) {
+                    _out.close();
+                    if (_out.fail()) _writeFailed = true;
+                }
+                if (response.status_code != 200) {
+                    return fail(std::format("File download failed: {} - {}\n{}", response.status_code,
+                                            response.reason, response.text));
+                }
+                if (_writeFailed) return fail("File download failed: Cannot write " + _target.string());
+                if (response.error) {
+                    if (_restarts++ < _options.maxChunkRetries) {
+                        spdlog::warn("Download of file {} broke off ({}), starting over", _file.id.value(),
+                                     response.error.message);
+                        return restart();
+                    }
+                    return fail(std::format("File download failed after {} attempts ({})", _restarts,
+                                            response.error.message));
+                }
+                if (!_created) {
+                    // Empty content never reached write
+                    std::ofstream empty(_target, std::ios::binary | std::ios::trunc);
+                    _created = true;
+                    if (!empty.is_open()) return fail("File download failed: Cannot open " + _target.string());
+                }
+                if (_digest) {
+                    if (auto actual = _digest->finish(); actual != _checksum->value) {
+                        if (_mismatches++ < _options.maxChecksumRetries) {
+                            spdlog::warn("{} mismatch for file {}, downloading it again", _checksum->name,
+                                         _file.id.value());
+                            return restart();
+                        }
+                        return fail(std::format("File download failed: {} mismatch for file {}, expected {}, got {}",
+                                                _checksum->name, _file.id.value(), _checksum->value, actual));
+                    }
+                }
+                if (!_options.cache) {
+                    _promise.set_value();
+                    return;
+                }
+                // Copying into the cache may take a while, which the other transfers of the loop must not wait for
+                std::thread([self = shared_from_this()] {
+                    try {
+                        self->_options.cache->store(self->_file, self->_target);
+                    } catch (const std::exception& e) {
+                        spdlog::warn("Failed to add file {} to the blob cache: {}", self->_file.id.value(), e.what());
+                    }
+                    self->_promise.set_value();
+                }).detach();
+            }
+
+            void restart() {
+                try {
+                    submit();
+                } catch (...) {
+                    fail(std::current_exception());
+                }
+            }
+
+            void fail(const std::string& message) { fail(std::make_exception_ptr(std::runtime_error(message))); }
+
+            void fail(std::exception_ptr error) {
+                if (_out.is_open()) _out.close();
+                if (_created) {
+                    std::error_code ignored;
+                    std::filesystem::remove(_target, ignored);
+                }
+                _promise.set_exception(error);
+            }
+
+            std::weak_ptr<GCloud::Authentication::OAuthAgent> _client;
+            GFile _file;
+            std::filesystem::path _target;
+            GFileDownloadOptions _options;
+            std::optional<Checksum> _checksum;
+            std::promise<void> _promise;
+            // State of the current attempt
+            GCloud::Http::ResponseHeaders _headers;
+            std::string _errorBody;
+            std::ofstream _out;
+            std::optional<utils::data::Digest> _digest;
+            bool _writeFailed = false;
+            // The target was written by this download, and is removed again when it fails
+            bool _created = false;
+            uint32_t _restarts = 0;
+            uint32_t _mismatches = 0;
+        };
+
+        constexpr uint64_t UPLOAD_GRANULARITY = 256 * 1024;
+        const cpr::Parameters UPLOAD_PARAMETERS{{"uploadType", "resumable"}, {"supportsAllDrives", "true"}};
+
+        std::string readUploadChunk(const utils::io::RandomAccessFile& file, uint64_t offset, uint64_t length) {
+            std::string chunk(length, '\0');
+            chunk.resize(file.readAt(offset, chunk.data(), chunk.size()));
+            if (chunk.size() != length) {
+                throw std::runtime_error("File upload failed: Local file changed size during upload");
+            }
+            return chunk;
+        }
+
+        // Number of bytes the server has persisted, taken from the Range header of a 308 response
+        uint64_t confirmedUploadBytes(const cpr::Response& response) {
+            auto it = response.header.find("Range");
+            if (it == response.header.end()) return 0;
+            auto dash = it->second.find('-');
+            if (dash == std::string::npos) return 0;
+            return std::stoull(it->second.substr(dash + 1)) + 1;
+        }
+
+        std::string startUploadSession(GCloud::Authentication::OAuthAgent& agent, const GFile& file,
+                                       const std::filesystem::path& localPath, uint64_t totalSize) {
+            cpr::Header header{{"Authorization", "Bearer " + agent.getAccessToken()},
+                               {"Content-Type", "application/json; charset=UTF-8"},
+                               {"X-Upload-Content-Length", std::to_string(totalSize)}};
+            if (file.mimeType.has_value()) header["X-Upload-Content-Type"] = file.mimeType.value();
+
+            nlohmann::json metadata = nlohmann::json::object();
+            if (file.name.has_value() || !file.id.has_value()) {
+                metadata["name"] = file.name.value_or(localPath.filename().string());
+            }
+            if (file.mimeType.has_value()) metadata["mimeType"] = file.mimeType.value();
+            if (file.description.has_value()) metadata["description"] = file.description.value();
+            if (!file.id.has_value() && file.parents.has_value()) metadata["parents"] = file.parents.value();
+
+            // Starting a session twice would leave an orphaned one behind, so it is paced but never retried
+            auto response = agent.getRequestScheduler()->execute(
+                [&] {
+                    auto session = agent.getSessionPool()->makeSession();
+                    session->SetHeader(header);
+                    session->SetBody(cpr::Body{metadata.dump()});
+                    session->SetParameters(UPLOAD_PARAMETERS);
+                    if (file.id.has_value()) {
+                        session->SetUrl(
+                            cpr::Url{"https://www.googleapis.com/upload/drive/v3/files/" + file.id.value()});
+                        return session->Patch();
+                    }
+                    session->SetUrl(cpr::Url{"https://www.googleapis.com/upload/drive/v3/files"});
+                    return session->Post();
+                },
+                false);
+            if (response.status_code != 200) {
+                throw std::runtime_error(std::format("File upload failed: {} - {}\n{}", response.status_code,
+                                                     response.reason, response.text));
+            }
+            auto location = response.header.find("Location");
+            if (location == response.header.end()) {
+                throw std::runtime_error("File upload failed: Missing upload session URI");
+            }
+            return location->second;
+        }
+
+        cpr::Response putUploadRange(GCloud::Authentication::OAuthAgent& agent, const std::string& sessionUri,
+                                     const std::string& contentRange, std::string&& body) {
+            // GFile::upload resumes interrupted chunks itself, from what the server confirmed
+            return agent.getRequestScheduler()->execute(
+                [&] {
+                    auto session = agent.getSessionPool()->makeSession();
+                    session->SetUrl(cpr::Url{sessionUri});
+                    session->SetHeader(cpr::Header{{"Authorization", "Bearer " + agent.getAccessToken()},
+                                                   {"Content-Range", contentRange}});
+                    session->SetBody(cpr::Body{std::move(body)});
+                    return session->Put();
+                },
+                false);
+        }
+    }  // namespace
+
+    std::optional<GFileList> GFileList::QueryDirectory(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                                                       std::shared_ptr<const GFile> root,
+                                                       const std::string& searchPath,
+                                                       const GDirectoryQueryOptions& options) {
+        DirectoryWalk walk;
+        if (!walk.start(client, root, searchPath, options)) return std::nullopt;
+
+        std::optional<GFileList> nextDir;
+        for (; walk.index < walk.steps.size(); ++walk.index) {
+            nextDir = walk.listFromIndex(client);
+            if (!nextDir) {
+                auto request = makeDirectoryStepRequest(walk.root.get(), walk.steps[walk.index], walk.fields);
+                if (!request) return std::nullopt;
+                nextDir.emplace(client, *request);
+                walk.storeListing(*nextDir);
+            }
+            if (!walk.completeStep(*nextDir)) {
+                if (walk.dropStaleCache()) return QueryDirectory(client, root, searchPath, options);
+                return std::nullopt;
+            }
+        }
+        return nextDir;
+    }
+
+    std::future<std::optional<GFileList>> GFileList::QueryDirectoryAsync(
+        std::weak_ptr<GCloud::Authentication::OAuthAgent> client, std::shared_ptr<const GFile> root,
+        const std::string& searchPath, const GDirectoryQueryOptions& options) {
+        // Each completed step submits the next one from the event loop thread, so the whole walk
+        // occupies no thread while its requests are in flight.
+        struct AsyncDirectoryWalk {
+            std::weak_ptr<GCloud::Authentication::OAuthAgent> client;
+            std::shared_ptr<const GFile> root;
+            std::string searchPath;
+            GDirectoryQueryOptions options;
+            DirectoryWalk walk;
+            std::promise<std::optional<GFileList>> promise;
+
+            static void advance(std::shared_ptr<AsyncDirectoryWalk> state) {
+                // Steps the index can answer complete right here, without a round trip through the loop
+                while (auto local = state->walk.listFromIndex(state->client)) {
+                    if (!completeStep(state, std::move(*local))) return;
+                }
+                const DirectoryWalk& walk = state->walk;
+                auto request = makeDirectoryStepRequest(walk.root.get(), walk.steps[walk.index], walk.fields);
+                if (!request) {
+                    state->promise.set_value(std::nullopt);
+                    return;
+                }
+                QueryWithCallback(
+                    state->client, *request,
+                    [state](GFileList&& list) {
+                        state->walk.storeListing(list);
+                        if (completeStep(state, std::move(list))) advance(state);
+                    },
+                    [state](std::exception_ptr error) { state->promise.set_exception(error); });
+            }
+
+            // Returns true when the walk continues with the next step
+            static bool completeStep(const std::shared_ptr<AsyncDirectoryWalk>& state, GFileList&& list) {
+                if (!state->walk.completeStep(list)) {
+                    if (state->walk.dropStaleCache()) {
+                        state->walk = DirectoryWalk{};
+                        state->walk.start(state->client, state->root, state->searchPath, state->options);
+                        advance(state);
+                        return false;
+                    }
+                    state->promise.set_value(std::nullopt);
+                    return false;
                 }
-                root = nextDir->files[0];
-                currentPath /= *it;
+                if (++state->walk.index == state->walk.steps.size()) {
+                    state->promise.set_value(std::move(list));
+                    return false;
+                }
+                return true;
             }
+        };
+
+        auto state = std::make_shared<AsyncDirectoryWalk>();
+        auto future = state->promise.get_future();
+        state->client = client;
+        state->root = std::move(root);
+        state->searchPath = searchPath;
+        state->options = options;
+        try {
+            if (!state->walk.start(client, state->root, searchPath, options)) {
+                state->promise.set_value(std::nullopt);
+                return future;
+            }
+            AsyncDirectoryWalk::advance(state);
+        } catch (...) {
+            state->promise.set_exception(std::current_exception());
         }
-        return *nextDir.get();
+        return future;
     }
 
+    GFileList::GFileList(std::weak_ptr<GCloud::Authentication::OAuthAgent> client) : _client(client) {}
+
+    GFileList::GFileList(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                         std::vector<std::shared_ptr<GFile>> files)
+        : _client(client), files(std::move(files)) {}
+
     GFileList::GFileList(std::weak_ptr<GCloud::Authentication::OAuthAgent> client, const GFileListRequest& request)
         : _client(client) {
-        auto params = cpr::Parameters{};
-        if (!request.q.empty()) params.Add({"q", request.q});
-        params.Add({"pageSize", std::to_string(request.pageSize)});
-        if (!request.pageToken.empty()) params.Add({"pageToken", request.pageToken});
-        if (!request.orderBy.empty()) params.Add({"orderBy", request.orderBy});
-        if (!request.spaces.empty()) params.Add({"spaces", request.spaces});
-        params.Add({"includeItemsFromAllDrives", request.includeItemsFromAllDrives ? "true" : "false"});
-        params.Add({"supportsAllDrives", request.supportsAllDrives ? "true" : "false"});
-        if (!request.includePermissionsForView.empty())
-            params.Add({"includePermissionsForView", request.includePermissionsForView});
-        if (!request.includeLabels.empty()) params.Add({"includeLabels", request.includeLabels});
-        if (!request.corpora.empty()) params.Add({"corpora", request.corpora});
-        if (!request.driveId.empty()) params.Add({"driveId", request.driveId});
-        if (!request.fields.empty()) params.Add({"fields", request.fields});
-
-        auto response =
-            cpr::Get(cpr::Url{"https://www.googleapis.com/drive/v3/files"}, params,
-                     cpr::Header{{"Authorization", "Bearer " + _client.lock()->getAccessToken()}}, cpr::VerifySsl(0));
-
+        auto agent = _client.lock();
+        if (!agent) {
+            throw std::runtime_error("Failed to fetch file list: Client is no longer valid");
+        }
+        // Files are constructed on a parser thread while the page is still being received
+        GFileSink sink(_client, [this](std::shared_ptr<GFile> file) { files.push_back(std::move(file)); });
+        FileListSaxHandler handler(sink, request.fieldMask);
+        // Only a successful body reaches the handler, so a failed attempt can be retried with the same one
+        auto response = agent->getRequestScheduler()->execute(
+            [&] { return streamFileList(*makeListSession(*agent, request), handler); });
         if (response.status_code != 200) {
             throw std::runtime_error(std::format("Failed to fetch file list: {} - {}\n{}", response.status_code,
                                                  response.reason, response.text));
         }
-        auto jsonResponse = nlohmann::json::parse(response.text);
-        if (!jsonResponse.contains("files")) {
-            throw std::runtime_error("Failed to fetch file list: Invalid JSON Response, missing files");
+        _nextPageToken = std::move(handler.getNextPageToken());
+    }
+
+    std::future<GFileList> GFileList::QueryAsync(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                                                 const GFileListRequest& request) {
+        auto promise = std::make_shared<std::promise<GFileList>>();
+        auto future = promise->get_future();
+        QueryWithCallback(
+            client, request, [promise](GFileList&& list) { promise->set_value(std::move(list)); },
+            [promise](std::exception_ptr error) { promise->set_exception(error); });
+        return future;
+    }
+
+    std::future<GFileList> GFileList::QueryBatched(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                                                   const GFileListRequest& request) {
+        auto agent = client.lock();
+        if (!agent) {
+            throw std::runtime_error("Failed to fetch file list: Client is no longer valid");
         }
-        if (jsonResponse.contains("nextPageToken")) {
-            _nextPageToken = jsonResponse["nextPageToken"].get<std::string>();
-        } else {
-            _nextPageToken = "";
+        auto promise = std::make_shared<std::promise<GFileList>>();
+        auto future = promise->get_future();
+        agent->getBatchScheduler()->submit(
+            GCloud::Http::BatchRequest{.path = makeBatchPath("/drive/v3/files", makeListQuery(request))},
+            agent->getAccessToken(),
+            [client, promise, fields = request.fieldMask](GCloud::Http::BatchResponse response) {
+                if (response.status_code != 200) {
+                    throw std::runtime_error(
+                        std::format("Failed to fetch file list: {}\n{}", response.status_code, response.text));
+                }
+                GFileList list(client);
+                list.parseFiles(response.text, fields);
+                promise->set_value(std::move(list));
+            },
+            [promise](std::exception_ptr error) { promise->set_exception(error); });
+        return future;
+    }
+
+    GFileListPages GFileList::Pages(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                                    const GFileListRequest& request) {
+        return GFileListPages(client, request);
+    }
+
+    GFileListPages::GFileListPages(std::weak_ptr<GCloud::Authentication::OAuthAgent> client, GFileListRequest request)
+        : _client(client), _request(std::move(request)) {}
+
+    GFileListPages::Iterator GFileListPages::begin() {
+        if (!_started) {
+            _started = true;
+            _next = GFileList::QueryAsync(_client, _request);
+            advance();
         }
-        for (const nlohmann::json& file : jsonResponse["files"]) {
-            std::shared_ptr<GFile> f = std::make_shared<GFile>(_client);
-            for (auto& it : file.items()) {
+        return Iterator(this);
+    }
+
+    bool GFileListPages::advance() {
+        if (!_next.valid()) {
+            _current.reset();
+            return false;
+        }
+        _current.emplace(_next.get());
+        if (!_current->getNextPageToken().empty()) {
+            _request.pageToken = _current->getNextPageToken();
+            _next = GFileList::QueryAsync(_client, _request);
+        }
+        return true;
+    }
+
+    GFileListPages::Iterator& GFileListPages::Iterator::operator++() {
+        _pages->advance();
+        return *this;
+    }
+
+    void GFileList::QueryWithCallback(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                                      const GFileListRequest& request, std::function<void(GFileList&&)> onComplete,
+                                      std::function<void(std::exception_ptr)> onFailure) {
+        auto agent = client.lock();
+        if (!agent) {
+            throw std::runtime_error("Failed to fetch file list: Client is no longer valid");
+        }
+        auto makeSession = [client, request] {
+            auto agent = client.lock();
+            if (!agent) {
+                throw std::runtime_error("Failed to fetch file list: Client is no longer valid");
+            }
+            return makeListSession(*agent, request);
+        };
+        agent->getRequestScheduler()->submit(
+            agent->getEventLoop(),
+            GCloud::Http::RequestScheduler::AsyncRequest{.makeSession = std::move(makeSession),
+                                                         .mayBlock = waitsForToken(client)},
+            [client, onComplete, onFailure, fields = request.fieldMask](cpr::Response response) {
+                if (response.status_code != 200) {
+                    onFailure(std::make_exception_ptr(
+                        std::runtime_error(std::format("Failed to fetch file list: {} - {}\n{}", response.status_code,
+                                                       response.reason, response.text))));
+                    return;
+                }
+                GFileList list(client);
                 try {
-                    if (it.value().is_string()) {
-                        f->setStringField(it.key(), it.value().get<std::string>());
-                    } else if (it.value().is_boolean()) {
-                        f->setBoolField(it.key(), it.value().get<bool>());
-                    }
-                } catch (const std::exception& e) {
-                    spdlog::error("Error setting field '{}': {}", it.key(), e.what());
+                    list.parseFiles(response.text, fields);
+                } catch (...) {
+                    onFailure(std::current_exception());
+                    return;
                 }
-            }
-            files.push_back(f);
-        }
+                onComplete(std::move(list));
+            },
+            onFailure);
+    }
+
+    void GFileList::parseFiles(const std::string_view& body, const GFileFieldMask& fields) {
+        GFileSink sink(_client, [this](std::shared_ptr<GFile> file) { files.push_back(std::move(file)); });
+        FileListSaxHandler handler(sink, fields);
+        parseFileList(body, handler);
+        _nextPageToken = std::move(handler.getNextPageToken());
     }
 
     /*GFile::GFile(std::weak_ptr<GCloud::OAuthAgent> client, const nlohmann::json item) : _client(client) {
@@ -134,17 +1078,72 @@ namespace GDrive {
         }
     }*/
 
+    GFileFieldMask::GFileFieldMask(std::initializer_list<GFileField> fields) {
+        for (GFileField field : fields) set(field);
+    }
+
+    GFileFieldMask GFileFieldMask::All() {
+        GFileFieldMask mask;
+        mask._bits.set();
+        return mask;
+    }
+
+    GFileFieldMask& GFileFieldMask::set(GFileField field) {
+        _bits.set(static_cast<size_t>(field));
+        return *this;
+    }
+
+    GFileFieldMask& GFileFieldMask::reset(GFileField field) {
+        _bits.reset(static_cast<size_t>(field));
+        return *this;
+    }
+
+    GFileFieldMask GFileFieldMask::operator|(const GFileFieldMask& other) const {
+        GFileFieldMask mask;
+        mask._bits = _bits | other._bits;
+        return mask;
+    }
+
+    GFileFieldMask GFileFieldMask::operator&(const GFileFieldMask& other) const {
+        GFileFieldMask mask;
+        mask._bits = _bits & other._bits;
+        return mask;
+    }
+
+    std::string GFileFieldMask::toString() const {
+        std::string result;
+        for (const auto& field : Fields::FIELDS) {
+            if (!test(field.field)) continue;
+            if (!result.empty()) result += ',';
+            result += field.name;
+        }
+        return result;
+    }
+
+    std::string GFileFieldMask::toListFields() const { return std::format("nextPageToken,files({})", toString()); }
+
     GFile::GFile(std::weak_ptr<GCloud::Authentication::OAuthAgent> client) : _client(client) {}
 
     void GDrive::GFile::print(std::ostream& os) {
-        for (const auto& [key, value] : _stringFieldsGetterMap) {
-            if (value(*this)) {
-                os << TAB_SPACE << key << ": " << value(*this).value() << "\n";
-            }
-        }
-        for (const auto& [key, value] : _boolFieldsGetterMap) {
-            if (value(*this)) {
-                os << TAB_SPACE << key << ": " << (value(*this).value() ? "True" : "False") << "\n";
+        for (const auto& field : Fields::FIELDS) {
+            switch (field.kind) {
+                case Fields::Kind::String:
+                    if (const auto& value = this->*field.stringMember) {
+                        os << TAB_SPACE << field.name << ": " << *value << "\n";
+                    }
+                    break;
+                case Fields::Kind::Bool:
+                    if (const auto& value = this->*field.boolMember) {
+                        os << TAB_SPACE << field.name << ": " << (*value ? "True" : "False") << "\n";
+                    }
+                    break;
+                case Fields::Kind::StringList:
+                    if (const auto& value = this->*field.listMember) {
+                        os << TAB_SPACE << field.name << ":";
+                        for (const auto& item : *value) os << " " << item;
+                        os << "\n";
+                    }
+                    break;
             }
         }
     }
@@ -158,55 +1157,223 @@ namespace GDrive {
         }
     }
 
-    void GFile::download(const std::string& path) {
-        if (auto client = _client.lock()) {
-            if (!id.has_value()) {
-                throw std::runtime_error("File download failed: Missing file Id");
+    void GFile::download(const std::string& path) { download(path, GFileDownloadOptions{}); }
+
+    void GFile::download(const GFileContentSink& sink, const GFileDownloadOptions& options) {
+        auto client = _client.lock();
+        if (!client) {
+            throw std::runtime_error("File download failed: Client is no longer valid");
+        }
+        if (!id.has_value()) {
+            throw std::runtime_error("File download failed: Missing file Id");
+        }
+        auto checksum = options.verifyChecksum ? expectedChecksum(*this) : std::nullopt;
+        if (!checksum) {
+            streamDownload(*client, id.value(), sink, options.maxChunkRetries);
+            return;
+        }
+        utils::data::Digest digest(checksum->algorithm);
+        bool complete = streamDownload(
+            *client, id.value(),
+            [&](std::string_view data) {
+                digest.update(data);
+                return sink(data);
+            },
+            options.maxChunkRetries);
+        if (!complete) return;
+        // The content is with the caller already, there is nothing to try again
+        if (auto actual = digest.finish(); actual != checksum->value) {
+            throw std::runtime_error(std::format("File download failed: {} mismatch for file {}, expected {}, got {}",
+                                                 checksum->name, id.value(), checksum->value, actual));
+        }
+    }
+
+    void GFile::download(const std::string& path, const GFileDownloadOptions& options) {
+        auto client = _client.lock();
+        if (!client) {
+            throw std::runtime_error("File download failed: Client is no longer valid");
+        }
+        if (!id.has_value()) {
+            throw std::runtime_error("File download failed: Missing file Id");
+        }
+        uint64_t totalSize = 0;
+        if (options.parallel && size.has_value()) {
+            try {
+                totalSize = std::stoull(size.value());
+            } catch (const std::exception&) {
+                spdlog::warn("Invalid size '{}' for file {}, downloading as a single stream", size.value(), id.value());
             }
-            std::filesystem::path finalPath = std::filesystem::path(path);
+        }
+        auto target = resolveDownloadPath(*this, path);
+        if (options.cache && options.cache->fetch(*this, target)) return;
+        auto checksum = options.verifyChecksum ? expectedChecksum(*this) : std::nullopt;
+        for (uint32_t attempt = 0;; ++attempt) {
+            std::string actual = totalSize > options.chunkSize
+                                     ? downloadInChunks(*client, id.value(), target, totalSize, options, checksum)
+                                     : downloadToFile(*client, id.value(), target, options, checksum);
+            if (!checksum || actual == checksum->value) break;
+            if (attempt >= options.maxChecksumRetries) {
+                throw std::runtime_error(
+                    std::format("File download failed: {} mismatch for file {}, expected {}, got {}", checksum->name,
+                                id.value(), checksum->value, actual));
+            }
+            spdlog::warn("{} mismatch for file {}, downloading it again", checksum->name, id.value());
+        }
+        if (!options.cache) return;
+        try {
+            options.cache->store(*this, target);
+        } catch (const std::exception& e) {
+            spdlog::warn("Failed to add file {} to the blob cache: {}", id.value(), e.what());
+        }
+    }
 
-            if (!finalPath.has_filename()) {
-                if (name.has_value()) {
-                    finalPath /= name.value();
-                } else {
-                    finalPath /= id.value();
+    std::future<std::shared_ptr<GFile>> GFile::GetAsync(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                                                        const std::string& fileId, const std::string& fields) {
+        auto agent = client.lock();
+        if (!agent) {
+            throw std::runtime_error("Failed to fetch file: Client is no longer valid");
+        }
+        std::vector<std::pair<std::string, std::string>> query{{"supportsAllDrives", "true"}};
+        if (!fields.empty()) query.emplace_back("fields", fields);
+
+        auto promise = std::make_shared<std::promise<std::shared_ptr<GFile>>>();
+        auto future = promise->get_future();
+        agent->getBatchScheduler()->submit(
+            GCloud::Http::BatchRequest{.path = makeBatchPath("/drive/v3/files/" + GCloud::Http::percentEncode(fileId),
+                                                             query)},
+            agent->getAccessToken(),
+            [client, promise](GCloud::Http::BatchResponse response) {
+                if (response.status_code != 200) {
+                    throw std::runtime_error(
+                        std::format("Failed to fetch file: {}\n{}", response.status_code, response.text));
                 }
+                auto file = std::make_shared<GFile>(client);
+                applyJsonFields(*file, nlohmann::json::parse(response.text));
+                promise->set_value(std::move(file));
+            },
+            [promise](std::exception_ptr error) { promise->set_exception(error); });
+        return future;
+    }
+
+    void GFile::upload(const std::string& path) { upload(path, GFileUploadOptions{}); }
+
+    void GFile::upload(const std::string& path, const GFileUploadOptions& options) {
+        auto client = _client.lock();
+        if (!client) {
+            throw std::runtime_error("File upload failed: Client is no longer valid");
+        }
+        utils::io::RandomAccessFile file(path, utils::io::RandomAccessFile::Mode::Read);
+        const uint64_t totalSize = file.size();
+        const uint64_t chunkSize =
+            std::max<uint64_t>(1, (options.chunkSize + UPLOAD_GRANULARITY - 1) / UPLOAD_GRANULARITY) *
+            UPLOAD_GRANULARITY;
+        const std::string sessionUri = startUploadSession(*client, *this, path, totalSize);
+
+        auto readAhead = [&file, totalSize, chunkSize](uint64_t offset) {
+            return std::async(std::launch::async, readUploadChunk, std::cref(file), offset,
+                              std::min(chunkSize, totalSize - offset));
+        };
+
+        uint64_t offset = 0;
+        uint32_t failures = 0;
+        auto backOff = [&](const std::string& reason) {
+            if (++failures > options.maxRetries) {
+                throw std::runtime_error(std::format("File upload failed after {} attempts: {}", failures, reason));
             }
-            std::ofstream outFile(finalPath, std::ios::binary);
-            auto response = cpr::Download(
-                outFile, cpr::Url{"https://www.googleapis.com/drive/v3/files/" + id.value() + "?alt=media"},
-                cpr::Bearer{client->getAccessToken()}, cpr::VerifySsl(0));
-            if (response.status_code != 200) {
-                throw std::runtime_error(std::format("File download failed: {} - {}\n{}", response.status_code,
+            spdlog::warn("Upload of {} interrupted at byte {} ({}), resuming", path, offset, reason);
+            std::this_thread::sleep_for(std::chrono::seconds(1ull << std::min<uint32_t>(failures - 1, 5)));
+        };
+        std::future<std::string> nextChunk = readAhead(0);
+        while (true) {
+            std::string chunk = nextChunk.get();
+            const uint64_t chunkEnd = offset + chunk.size();
+            // The next chunk is read from disk while this one is in flight
+            if (chunkEnd < totalSize) nextChunk = readAhead(chunkEnd);
+
+            std::string contentRange = chunk.empty() ? std::format("bytes */{}", totalSize)
+                                                     : std::format("bytes {}-{}/{}", offset, chunkEnd - 1, totalSize);
+            auto response = putUploadRange(*client, sessionUri, contentRange, std::move(chunk));
+
+            if (response.status_code == 200 || response.status_code == 201) {
+                applyJsonFields(*this, nlohmann::json::parse(response.text));
+                return;
+            }
+            if (response.status_code == 404 || response.status_code == 410) {
+                throw std::runtime_error("File upload failed: Upload session expired, the upload must be restarted");
+            }
+
+            uint64_t confirmed = offset;
+            if (response.status_code == 308) {
+                confirmed = confirmedUploadBytes(response);
+                // Only progress resets the failures; sending the same chunk again right away could go on forever
+                if (confirmed > offset) {
+                    failures = 0;
+                } else {
+                    backOff("308 - Server persisted none of the chunk");
+                }
+            } else if (isRetryableStatus(response.status_code)) {
+                backOff(std::format("{} - {}", response.status_code, response.error.message));
+                // Ask the server how much it actually persisted before the connection dropped
+                auto status = putUploadRange(*client, sessionUri, std::format("bytes */{}", totalSize), {});
+                if (status.status_code == 200 || status.status_code == 201) {
+                    applyJsonFields(*this, nlohmann::json::parse(status.text));
+                    return;
+                }
+                if (status.status_code == 308) confirmed = confirmedUploadBytes(status);
+            } else {
+                throw std::runtime_error(std::format("File upload failed: {} - {}\n{}", response.status_code,
                                                      response.reason, response.text));
             }
-        } else {
+
+            if (confirmed != chunkEnd) {
+                // The read-ahead chunk does not start where the server wants to continue
+                if (nextChunk.valid()) nextChunk.wait();
+                nextChunk = readAhead(confirmed);
+            } else if (!nextChunk.valid()) {
+                throw std::runtime_error("File upload failed: Server did not finalize the upload");
+            }
+            offset = confirmed;
+        }
+    }
+
+    std::future<void> GFile::downloadAsync(const std::string& path) {
+        return downloadAsync(path, GFileDownloadOptions{});
+    }
+
+    std::future<void> GFile::downloadAsync(const std::string& path, const GFileDownloadOptions& options) {
+        auto client = _client.lock();
+        if (!client) {
             throw std::runtime_error("File download failed: Client is no longer valid");
         }
+        if (!id.has_value()) {
+            throw std::runtime_error("File download failed: Missing file Id");
+        }
+        auto target = resolveDownloadPath(*this, path);
+        if (options.cache && options.cache->fetch(*this, target)) {
+            std::promise<void> served;
+            served.set_value();
+            return served.get_future();
+        }
+        auto download = std::make_shared<AsyncDownload>(client, *this, std::move(target), options);
+        auto future = download->getFuture();
+        download->submit();
+        return future;
     }
 
     void GFile::setStringField(const std::string_view& field, const std::string_view& value) {
-        std::string f;
-        f.resize(field.size());
-        std::transform(field.begin(), field.end(), f.begin(), ::tolower);
-        auto it = _stringFieldsSetterMap.find(f);
-        if (it != _stringFieldsSetterMap.end()) {
-            it->second(*this, value);
-        } else {
+        const Fields::FieldInfo* info = Fields::findField(field);
+        if (!info || info->kind != Fields::Kind::String) {
             throw std::runtime_error("Invalid string field: " + std::string(field));
         }
+        (this->*info->stringMember).emplace(value);
     }
 
     void GFile::setBoolField(const std::string_view& field, bool value) {
-        std::string f;
-        f.resize(field.size());
-        std::transform(field.begin(), field.end(), f.begin(), ::tolower);
-        auto it = _boolFieldsSetterMap.find(f);
-        if (it != _boolFieldsSetterMap.end()) {
-            it->second(*this, value);
-        } else {
+        const Fields::FieldInfo* info = Fields::findField(field);
+        if (!info || info->kind != Fields::Kind::Bool) {
             throw std::runtime_error("Invalid boolean field: " + std::string(field));
         }
+        this->*info->boolMember = value;
     }
 
     std::unordered_map<std::string, GFileCapabilities::Type> GFileCapabilities::_capabilitiesMap = {
@@ -254,101 +1421,4 @@ namespace GDrive {
         {"candisableinheritedpermissions", GFileCapabilities::Type::canDisableInheritedPermissions},
         {"canenableinheritedpermissions", GFileCapabilities::Type::canEnableInheritedPermissions}};
 
-    std::unordered_map<std::string, std::function<void(GFile&, const std::string_view&)>>
-        GFile::_stringFieldsSetterMap = {
-            {"kind", [](GFile& f, const std::string_view& v) { f.kind = std::string(v); }},
-            {"driveid", [](GFile& f, const std::string_view& v) { f.driveId = std::string(v); }},
-            {"fileextension", [](GFile& f, const std::string_view& v) { f.fileExtension = std::string(v); }},
-            {"md5checksum", [](GFile& f, const std::string_view& v) { f.md5Checksum = std::string(v); }},
-            {"mimetype", [](GFile& f, const std::string_view& v) { f.mimeType = std::string(v); }},
-            {"thumbnaillink", [](GFile& f, const std::string_view& v) { f.thumbnailLink = std::string(v); }},
-            {"iconlink", [](GFile& f, const std::string_view& v) { f.iconLink = std::string(v); }},
-            {"headrevisionid", [](GFile& f, const std::string_view& v) { f.headRevisionId = std::string(v); }},
-            {"webviewlink", [](GFile& f, const std::string_view& v) { f.webViewLink = std::string(v); }},
-            {"webcontentlink", [](GFile& f, const std::string_view& v) { f.webContentLink = std::string(v); }},
-            {"size", [](GFile& f, const std::string_view& v) { f.size = std::string(v); }},
-            {"foldercolorrgb", [](GFile& f, const std::string_view& v) { f.folderColorRgb = std::string(v); }},
-            {"id", [](GFile& f, const std::string_view& v) { f.id = std::string(v); }},
-            {"name", [](GFile& f, const std::string_view& v) { f.name = std::string(v); }},
-            {"description", [](GFile& f, const std::string_view& v) { f.description = std::string(v); }},
-            {"createdtime", [](GFile& f, const std::string_view& v) { f.createdTime = std::string(v); }},
-            {"modifiedtime", [](GFile& f, const std::string_view& v) { f.modifiedTime = std::string(v); }},
-            {"modifiedbymetime", [](GFile& f, const std::string_view& v) { f.modifiedByMeTime = std::string(v); }},
-            {"viewedbymetime", [](GFile& f, const std::string_view& v) { f.viewedByMeTime = std::string(v); }},
-            {"sharedwithmetime", [](GFile& f, const std::string_view& v) { f.sharedWithMeTime = std::string(v); }},
-            {"quotabytesused", [](GFile& f, const std::string_view& v) { f.quotaBytesUsed = std::string(v); }},
-            {"version", [](GFile& f, const std::string_view& v) { f.version = std::string(v); }},
-            {"originalfilename", [](GFile& f, const std::string_view& v) { f.originalFilename = std::string(v); }},
-            {"fullfileextension", [](GFile& f, const std::string_view& v) { f.fullFileExtension = std::string(v); }},
-            {"teamdriveid", [](GFile& f, const std::string_view& v) { f.teamDriveId = std::string(v); }},
-            {"thumbnailversion", [](GFile& f, const std::string_view& v) { f.thumbnailVersion = std::string(v); }},
-            {"trashedtime", [](GFile& f, const std::string_view& v) { f.trashedTime = std::string(v); }},
-            {"resourcekey", [](GFile& f, const std::string_view& v) { f.resourceKey = std::string(v); }},
-            {"sha1checksum", [](GFile& f, const std::string_view& v) { f.sha1Checksum = std::string(v); }},
-            {"sha256checksum", [](GFile& f, const std::string_view& v) { f.sha256Checksum = std::string(v); }}};
-
-    std::unordered_map<std::string, std::function<void(GFile&, bool)>> GFile::_boolFieldsSetterMap = {
-        {"copyrequireswriterpermission", [](GFile& f, bool v) { f.copyRequiresWriterPermission = v; }},
-        {"writerscanshare", [](GFile& f, bool v) { f.writersCanShare = v; }},
-        {"viewedbyme", [](GFile& f, bool v) { f.viewedByMe = v; }},
-        {"shared", [](GFile& f, bool v) { f.shared = v; }},
-        {"viewerscancopycontent", [](GFile& f, bool v) { f.viewersCanCopyContent = v; }},
-        {"hasthumbnail", [](GFile& f, bool v) { f.hasThumbnail = v; }},
-        {"starred", [](GFile& f, bool v) { f.starred = v; }},
-        {"trashed", [](GFile& f, bool v) { f.trashed = v; }},
-        {"explicitlytrashed", [](GFile& f, bool v) { f.explicitlyTrashed = v; }},
-        {"ownedbyme", [](GFile& f, bool v) { f.ownedByMe = v; }},
-        {"isappauthorized", [](GFile& f, bool v) { f.isAppAuthorized = v; }},
-        {"hasaugmentedpermissions", [](GFile& f, bool v) { f.hasAugmentedPermissions = v; }},
-        {"modifiedbyme", [](GFile& f, bool v) { f.modifiedByMe = v; }},
-        {"inheritedpermissionsdisabled", [](GFile& f, bool v) { f.inheritedPermissionsDisabled = v; }}};
-
-    std::unordered_map<std::string, std::function<std::optional<std::string>(GFile&)>> GFile::_stringFieldsGetterMap = {
-        {"kind", [](GFile& f) { return f.kind; }},
-        {"driveid", [](GFile& f) { return f.driveId; }},
-        {"fileextension", [](GFile& f) { return f.fileExtension; }},
-        {"md5checksum", [](GFile& f) { return f.md5Checksum; }},
-        {"mimetype", [](GFile& f) { return f.mimeType; }},
-        {"thumbnaillink", [](GFile& f) { return f.thumbnailLink; }},
-        {"iconlink", [](GFile& f) { return f.iconLink; }},
-        {"headrevisionid", [](GFile& f) { return f.headRevisionId; }},
-        {"webviewlink", [](GFile& f) { return f.webViewLink; }},
-        {"webcontentlink", [](GFile& f) { return f.webContentLink; }},
-        {"size", [](GFile& f) { return f.size; }},
-        {"foldercolorrgb", [](GFile& f) { return f.folderColorRgb; }},
-        {"id", [](GFile& f) { return f.id; }},
-        {"name", [](GFile& f) { return f.name; }},
-        {"description", [](GFile& f) { return f.description; }},
-        {"createdtime", [](GFile& f) { return f.createdTime; }},
-        {"modifiedtime", [](GFile& f) { return f.modifiedTime; }},
-        {"modifiedbymetime", [](GFile& f) { return f.modifiedByMeTime; }},
-        {"viewedbymetime", [](GFile& f) { return f.viewedByMeTime; }},
-        {"sharedwithmetime", [](GFile& f) { return f.sharedWithMeTime; }},
-        {"quotabytesused", [](GFile& f) { return f.quotaBytesUsed; }},
-        {"version", [](GFile& f) { return f.version; }},
-        {"originalfilename", [](GFile& f) { return f.originalFilename; }},
-        {"fullfileextension", [](GFile& f) { return f.fullFileExtension; }},
-        {"teamdriveid", [](GFile& f) { return f.teamDriveId; }},
-        {"thumbnailversion", [](GFile& f) { return f.thumbnailVersion; }},
-        {"trashedtime", [](GFile& f) { return f.trashedTime; }},
-        {"resourcekey", [](GFile& f) { return f.resourceKey; }},
-        {"sha1checksum", [](GFile& f) { return f.sha1Checksum; }},
-        {"sha256checksum", [](GFile& f) { return f.sha256Checksum; }}};
-
-    std::unordered_map<std::string, std::function<std::optional<bool>(GFile&)>> GFile::_boolFieldsGetterMap = {
-        {"copyrequireswriterpermission", [](GFile& f) { return f.copyRequiresWriterPermission; }},
-        {"writerscanshare", [](GFile& f) { return f.writersCanShare; }},
-        {"viewedbyme", [](GFile& f) { return f.viewedByMe; }},
-        {"shared", [](GFile& f) { return f.shared; }},
-        {"viewerscancopycontent", [](GFile& f) { return f.viewersCanCopyContent; }},
-        {"hasthumbnail", [](GFile& f) { return f.hasThumbnail; }},
-        {"starred", [](GFile& f) { return f.starred; }},
-        {"trashed", [](GFile& f) { return f.trashed; }},
-        {"explicitlytrashed", [](GFile& f) { return f.explicitlyTrashed; }},
-        {"ownedbyme", [](GFile& f) { return f.ownedByMe; }},
-        {"isappauthorized", [](GFile& f) { return f.isAppAuthorized; }},
-        {"hasaugmentedpermissions", [](GFile& f) { return f.hasAugmentedPermissions; }},
-        {"modifiedbyme", [](GFile& f) { return f.modifiedByMe; }},
-        {"inheritedpermissionsdisabled", [](GFile& f) { return f.inheritedPermissionsDisabled; }}};
-
 }  // namespace GDrive
\ No newline at end of file
@@ -0,0 +1,325 @@
+#include "fileListParser.hpp"
+
+#include <exception>
+#include <format>
+#include <istream>
+#include <stdexcept>
+#include <thread>
+
+#include "sessionPool.hpp"
+
+namespace GDrive {
+    namespace {
+        cpr::Parameters makeListParameters(const GFileListRequest& request) {
+            auto params = cpr::Parameters{};
+            for (const auto& [key, value] : makeListQuery(request)) params.Add({key, value});
+            return params;
+        }
+    }  // namespace
+
+    std::vector<std::pair<std::string, std::string>> makeListQuery(const GFileListRequest& request) {
+        std::vector<std::pair<std::string, std::string>> query;
+        if (!request.q.empty()) query.emplace_back("q", request.q);
+        query.emplace_back("pageSize", std::to_string(request.pageSize));
+        if (!request.pageToken.empty()) query.emplace_back("pageToken", request.pageToken);
+        if (!request.orderBy.empty()) query.emplace_back("orderBy", request.orderBy);
+        if (!request.spaces.empty()) query.emplace_back("spaces", request.spaces);
+        query.emplace_back("includeItemsFromAllDrives", request.includeItemsFromAllDrives ? "true" : "false");
+        query.emplace_back("supportsAllDrives", request.supportsAllDrives ? "true" : "false");
+        if (!request.includePermissionsForView.empty())
+            query.emplace_back("includePermissionsForView", request.includePermissionsForView);
+        if (!request.includeLabels.empty()) query.emplace_back("includeLabels", request.includeLabels);
+        if (!request.corpora.empty()) query.emplace_back("corpora", request.corpora);
+        if (!request.driveId.empty()) query.emplace_back("driveId", request.driveId);
+        if (!request.fields.empty()) {
+            query.emplace_back("fields", request.fields);
+        } else if (!request.fieldMask.empty()) {
+            query.emplace_back("fields", request.fieldMask.toListFields());
+        }
+        return query;
+    }
+
+    std::shared_ptr<cpr::Session> makeListSession(GCloud::Authentication::OAuthAgent& agent,
+                                                  const GFileListRequest& request) {
+        auto session = agent.getSessionPool()->makeSession();
+        session->SetUrl(cpr::Url{"https://www.googleapis.com/drive/v3/files"});
+        session->SetParameters(makeListParameters(request));
+        session->SetHeader(cpr::Header{{"Authorization", "Bearer " + agent.getAccessToken()}});
+        return session;
+    }
+
+    // Single pass over the members of one file resource; values are stored through the compile-time
+    // field table without any intermediate copies.
+    void applyJsonFields(GFile& file, const nlohmann::json& item) {
+        for (auto it = item.begin(); it != item.end(); ++it) {
+            const Fields::FieldInfo* field = Fields::findField(it.key());
+            if (!field) continue;  // Nested resources not modelled by GFile
+            const nlohmann::json& value = it.value();
+            switch (field->kind) {
+                case Fields::Kind::String:
+                    if (value.is_string()) (file.*field->stringMember).emplace(value.get_ref<const std::string&>());
+                    break;
+                case Fields::Kind::Bool:
+                    if (value.is_boolean()) file.*field->boolMember = value.get<bool>();
+                    break;
+                case Fields::Kind::StringList:
+                    if (value.is_array()) {
+                        auto& list = (file.*field->listMember).emplace();
+                        list.reserve(value.size());
+                        for (const auto& element : value) {
+                            if (element.is_string()) list.push_back(element.get_ref<const std::string&>());
+                        }
+                    }
+                    break;
+            }
+        }
+    }
+
+    GFileSink::GFileSink(std::weak_ptr<GCloud::Authentication::OAuthAgent> client, FileCallback onFile)
+        : _client(client), _onFile(std::move(onFile)) {}
+
+    void GFileSink::beginFile() { _file = std::make_shared<GFile>(_client); }
+
+    void GFileSink::setString(const Fields::FieldInfo& field, std::string& value) {
+        ((*_file).*field.stringMember).emplace(std::move(value));
+    }
+
+    void GFileSink::setBool(const Fields::FieldInfo& field, bool value) { (*_file).*field.boolMember = value; }
+
+    void GFileSink::beginList(const Fields::FieldInfo& field) { _list = &((*_file).*field.listMember).emplace(); }
+
+    void GFileSink::addListItem(std::string& value) { _list->push_back(std::move(value)); }
+
+    void GFileSink::endFile() {
+        _list = nullptr;
+        _onFile(std::move(_file));
+    }
+
+    FileListSaxHandler::FileListSaxHandler(FileListSink& sink, const GFileFieldMask& fields)
+        : _sink(sink), _fields(fields) {}
+
+    bool FileListSaxHandler::skipValue() {
+        if (_skipDepth > 0) return true;
+        // A scalar that is not modelled ends the pending member
+        if (_depth == Depth::File) _field = nullptr;
+        return false;
+    }
+
+    bool FileListSaxHandler::null() {
+        skipValue();
+        return true;
+    }
+
+    bool FileListSaxHandler::boolean(bool value) {
+        if (_skipDepth == 0 && _depth == Depth::File && _field && _field->kind == Fields::Kind::Bool) {
+            _sink.setBool(*_field, value);
+        }
+        skipValue();
+        return true;
+    }
+
+    bool FileListSaxHandler::number_integer(nlohmann::json::number_integer_t) {
+        skipValue();
+        return true;
+    }
+
+    bool FileListSaxHandler::number_unsigned(nlohmann::json::number_unsigned_t) {
+        skipValue();
+        return true;
+    }
+
+    bool FileListSaxHandler::number_float(nlohmann::json::number_float_t, const std::string&) {
+        skipValue();
+        return true;
+    }
+
+    bool FileListSaxHandler::binary(nlohmann::json::binary_t&) {
+        skipValue();
+        return true;
+    }
+
+    bool FileListSaxHandler::string(std::string& value) {
+        if (_skipDepth > 0) return true;
+        // Sinks may move from the parser's token buffer; it is cleared before the next token anyway
+        if (_depth == Depth::Response && _responseKey == "nextPageToken") {
+            _nextPageToken = std::move(value);
+        } else if (_depth == Depth::File && _field && _field->kind == Fields::Kind::String) {
+            _sink.setString(*_field, value);
+        } else if (_depth == Depth::FileList) {
+            _sink.addListItem(value);
+        }
+        if (_depth == Depth::File) _field = nullptr;
+        return true;
+    }
+
+    bool FileListSaxHandler::key(std::string& name) {
+        if (_skipDepth > 0) return true;
+        if (_depth == Depth::Response) {
+            _responseKey = std::move(name);
+        } else if (_depth == Depth::File) {
+            _field = Fields::findField(name);
+            if (_field && !_fields.empty() && !_fields.test(_field->field)) _field = nullptr;
+        }
+        return true;
+    }
+
+    bool FileListSaxHandler::start_object(std::size_t) {
+        if (_skipDepth > 0) {
+            ++_skipDepth;
+        } else if (_depth == 0) {
+            _depth = Depth::Response;
+        } else if (_depth == Depth::FilesArray) {
+            _depth = Depth::File;
+            _sink.beginFile();
+        } else {
+            // Nested resources such as capabilities or owners are not modelled by GFile
+            _skipDepth = 1;
+        }
+        return true;
+    }
+
+    bool FileListSaxHandler::end_object() {
+        if (_skipDepth > 0) {
+            if (--_skipDepth == 0 && _depth == Depth::File) _field = nullptr;
+        } else if (_depth == Depth::File) {
+            _depth = Depth::FilesArray;
+            _field = nullptr;
+            _sink.endFile();
+        } else if (_depth == Depth::Response) {
+            _depth = 0;
+        }
+        return true;
+    }
+
+    bool FileListSaxHandler::start_array(std::size_t) {
+        if (_skipDepth > 0) {
+            ++_skipDepth;
+        } else if (_depth == Depth::Response && _responseKey == "files") {
+            _depth = Depth::FilesArray;
+            _sawFiles = true;
+        } else if (_depth == Depth::File && _field && _field->kind == Fields::Kind::StringList) {
+            _depth = Depth::FileList;
+            _sink.beginList(*_field);
+        } else {
+            _skipDepth = 1;
+        }
+        return true;
+    }
+
+    bool FileListSaxHandler::end_array() {
+        if (_skipDepth > 0) {
+            if (--_skipDepth == 0 && _depth == Depth::File) _field = nullptr;
+        } else if (_depth == Depth::FileList) {
+            _depth = Depth::File;
+            _field = nullptr;
+        } else if (_depth == Depth::FilesArray) {
+            _depth = Depth::Response;
+        }
+        return true;
+    }
+
+    bool FileListSaxHandler::parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& error) {
+        _error = error.what();
+        return false;
+    }
+
+    void FileListSaxHandler::validate(bool parsed) const {
+        if (!parsed) {
+            throw std::runtime_error(std::format("Failed to fetch file list: Invalid JSON Response, {}", _error));
+        }
+        if (!_sawFiles) {
+            throw std::runtime_error("Failed to fetch file list: Invalid JSON Response, missing files");
+        }
+    }
+
+    ChunkStreamBuffer::ChunkStreamBuffer(size_t maxBufferedBytes) : _maxBufferedBytes(maxBufferedBytes) {}
+
+    bool ChunkStreamBuffer::push(std::string_view data) {
+        std::unique_lock lock(_mutex);
+        _writable.wait(lock, [this] { return _readerStopped || _bufferedBytes < _maxBufferedBytes; });
+        if (_readerStopped) return false;
+        _chunks.emplace_back(data);
+        _bufferedBytes += data.size();
+        _readable.notify_one();
+        return true;
+    }
+
+    void ChunkStreamBuffer::close() {
+        std::lock_guard lock(_mutex);
+        _closed = true;
+        _readable.notify_one();
+    }
+
+    void ChunkStreamBuffer::stopReading() {
+        std::lock_guard lock(_mutex);
+        _readerStopped = true;
+        _chunks.clear();
+        _bufferedBytes = 0;
+        _writable.notify_one();
+    }
+
+    ChunkStreamBuffer::int_type ChunkStreamBuffer::underflow() {
+        if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+        std::unique_lock lock(_mutex);
+        _readable.wait(lock, [this] { return _closed || !_chunks.empty(); });
+        if (_chunks.empty()) return traits_type::eof();
+        _current = std::move(_chunks.front());
+        _chunks.pop_front();
+        _bufferedBytes -= _current.size();
+        _writable.notify_one();
+        setg(_current.data(), _current.data(), _current.data() + _current.size());
+        return traits_type::to_int_type(*gptr());
+    }
+
+    cpr::Response streamFileList(cpr::Session& session, FileListSaxHandler& handler) {
+        ChunkStreamBuffer buffer;
+        bool parsed = false;
+        std::exception_ptr parseFailure;
+        std::jthread parser([&] {
+            std::istream input(&buffer);
+            try {
+                parsed = nlohmann::json::sax_parse(input, &handler);
+            } catch (...) {
+                parseFailure = std::current_exception();
+            }
+            buffer.stopReading();
+        });
+
+        // The status line arrives before the body, so only a successful body is routed to the parser
+        GCloud::Http::ResponseHeaders headers;
+        bool parserStopped = false;
+        std::string errorBody;
+        session.SetHeaderCallback(cpr::HeaderCallback{[&headers](const std::string_view& header, intptr_t) {
+            headers.add(header);
+            return true;
+        }});
+        auto response =
+            session.Download(cpr::WriteCallback{[&](const std::string_view& data, intptr_t) {
+                if (headers.getStatusCode() == 200) {
+                    parserStopped = !buffer.push(data);
+                    return !parserStopped;
+                }
+                errorBody.append(data);
+                return true;
+            }});
+        buffer.close();
+        parser.join();
+        headers.applyTo(response);
+
+        if (response.status_code != 200) {
+            response.text = std::move(errorBody);
+            return response;
+        }
+        if (parseFailure) std::rethrow_exception(parseFailure);
+        if (!parsed && !parserStopped && response.error) {
+            // The body was cut short by the transfer rather than being malformed
+            throw std::runtime_error(std::format("Failed to fetch file list: {}", response.error.message));
+        }
+        handler.validate(parsed);
+        return response;
+    }
+
+    void parseFileList(std::string_view body, FileListSaxHandler& handler) {
+        handler.validate(nlohmann::json::sax_parse(body.begin(), body.end(), &handler));
+    }
+}  // namespace GDrive
@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include <utility>
+
+#include "GDriveCpp/gDrive.h"
+#include "GDriveCpp/gFileTable.h"
+#include "fileTableBuilder.hpp"
+#include "requestScheduler.hpp"
+
+namespace GDrive {
+    namespace {
+        static_assert(static_cast<size_t>(GFileField::Count) <= 64, "Record masks hold one bit per field");
+
+        constexpr uint64_t bit(GFileField field) { return uint64_t{1} << static_cast<size_t>(field); }
+
+        constexpr uint64_t bit(const Fields::FieldInfo& field) { return bit(field.field); }
+
+        // Fields stored in a slot, i.e. everything except booleans
+        constexpr uint64_t slotFields() {
+            uint64_t mask = 0;
+            for (const auto& field : Fields::FIELDS) {
+                if (field.kind != Fields::Kind::Bool) mask |= bit(field);
+            }
+            return mask;
+        }
+
+        constexpr uint64_t SLOT_FIELDS = slotFields();
+
+        // Values shared by many files of a listing
+        constexpr uint64_t INTERNED_FIELDS =
+            bit(GFileField::kind) | bit(GFileField::mimeType) | bit(GFileField::fileExtension) |
+            bit(GFileField::fullFileExtension) | bit(GFileField::folderColorRgb) | bit(GFileField::driveId) |
+            bit(GFileField::teamDriveId) | bit(GFileField::parents) | bit(GFileField::spaces) |
+            bit(GFileField::permissionIds);
+
+        void requireKind(GFileField field, Fields::Kind kind) {
+            const auto& info = Fields::fieldInfo(field);
+            if (info.kind != kind) {
+                throw std::invalid_argument(std::format("Field '{}' has a different type", info.name));
+            }
+        }
+    }  // namespace
+
+    GFileTableBuilder::GFileTableBuilder(GFileTable& table) : _table(table) {}
+
+    void GFileTableBuilder::beginFile() {
+        _record = GFileTable::Record{};
+        _items.clear();
+    }
+
+    void GFileTableBuilder::setString(const Fields::FieldInfo& field, std::string& value) {
+        setString(field.field, value);
+    }
+
+    void GFileTableBuilder::setString(GFileField field, std::string_view value) {
+        auto stored = _table.store(value, INTERNED_FIELDS & bit(field));
+        _record.present |= bit(field);
+        _pending[static_cast<size_t>(field)] =
+            GFileTable::Slot{.data = stored.data(), .size = static_cast<uint32_t>(stored.size())};
+    }
+
+    void GFileTableBuilder::setBool(const Fields::FieldInfo& field, bool value) {
+        _record.present |= bit(field);
+        if (value) {
+            _record.values |= bit(field);
+        } else {
+            _record.values &= ~bit(field);
+        }
+    }
+
+    void GFileTableBuilder::beginList(const Fields::FieldInfo& field) { beginList(field.field); }
+
+    void GFileTableBuilder::beginList(GFileField field) {
+        // Items of one list arrive without interruption, so they form a contiguous run in _items
+        _list = static_cast<size_t>(field);
+        _internList = INTERNED_FIELDS & bit(field);
+        _record.present |= bit(field);
+        _pending[_list] = GFileTable::Slot{.data = nullptr, .size = 0};
+        _listStart[_list] = _items.size();
+    }
+
+    void GFileTableBuilder::addListItem(std::string& value) { addListItem(std::string_view(value)); }
+
+    void GFileTableBuilder::addListItem(std::string_view value) {
+        _items.push_back(_table.store(value, _internList));
+        ++_pending[_list].size;
+    }
+
+    void GFileTableBuilder::endFile() {
+        ListingArena& arena = *_table._storage->arena;
+        uint64_t present = _record.present & SLOT_FIELDS;
+        auto* slots = static_cast<GFileTable::Slot*>(
+            arena.allocate(std::popcount(present) * sizeof(GFileTable::Slot), alignof(GFileTable::Slot)));
+        size_t count = 0;
+        for (; present; present &= present - 1) {
+            size_t field = std::countr_zero(present);
+            GFileTable::Slot slot = _pending[field];
+            if (Fields::FIELDS[field].kind == Fields::Kind::StringList) {
+                auto* items = static_cast<std::string_view*>(
+                    arena.allocate(slot.size * sizeof(std::string_view), alignof(std::string_view)));
+                std::copy_n(_items.begin() + _listStart[field], slot.size, items);
+                slot.data = items;
+            }
+            slots[count++] = slot;
+        }
+        _record.slots = slots;
+        _table.push(_record);
+    }
+
+    GFileTable::Storage::Storage(std::shared_ptr<ListingArena> arena)
+        : arena(std::move(arena)), recordChunks(this->arena->resource()), interned(this->arena->resource()) {}
+
+    GFileTable::GFileTable() : GFileTable(std::make_shared<ListingArena>()) {}
+
+    GFileTable::GFileTable(std::shared_ptr<ListingArena> arena)
+        : _storage(std::make_unique<Storage>(std::move(arena))) {}
+
+    GFileTable::~GFileTable() = default;
+
+    GFileTable::GFileTable(GFileTable&& other)
+        : _storage(std::exchange(other._storage, std::make_unique<Storage>(std::make_shared<ListingArena>()))) {}
+
+    GFileTable& GFileTable::operator=(GFileTable&& other) {
+        if (this == &other) return *this;
+        auto empty = std::make_unique<Storage>(std::make_shared<ListingArena>());
+        _storage = std::exchange(other._storage, std::move(empty));
+        return *this;
+    }
+
+    std::string_view GFileTable::store(std::string_view value, bool intern) {
+        if (intern) {
+            auto it = _storage->interned.find(value);
+            if (it != _storage->interned.end()) return *it;
+        }
+        char* data = static_cast<char*>(_storage->arena->allocate(value.size(), 1));
+        if (!value.empty()) std::memcpy(data, value.data(), value.size());
+        std::string_view stored(data, value.size());
+        if (intern) _storage->interned.insert(stored);
+        return stored;
+    }
+
+    void GFileTable::push(const Record& record) {
+        size_t offset = _storage->recordCount & (RECORD_CHUNK_SIZE - 1);
+        if (offset == 0 && (_storage->recordCount >> RECORD_CHUNK_BITS) == _storage->recordChunks.size()) {
+            _storage->recordChunks.push_back(
+                static_cast<Record*>(_storage->arena->allocate(RECORD_CHUNK_SIZE * sizeof(Record), alignof(Record))));
+        }
+        _storage->recordChunks[_storage->recordCount >> RECORD_CHUNK_BITS][offset] = record;
+        ++_storage->recordCount;
+    }
+
+    const GFileTable::Slot* GFileTable::findSlot(size_t index, GFileField field) const {
+        const Record& entry = record(index);
+        if (!(entry.present & bit(field))) return nullptr;
+        // Slots are ordered by field, so the rank of the field among the present ones is its position
+        return &entry.slots[std::popcount(entry.present & SLOT_FIELDS & (bit(field) - 1))];
+    }
+
+    std::string GFileTable::appendPage(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                                       const GFileListRequest& request) {
+        auto agent = client.lock();
+        if (!agent) {
+            throw std::runtime_error("Failed to fetch file list: Client is no longer valid");
+        }
+        // A body cut off mid-stream has added records already; a failed page must not leave part of itself
+        const size_t before = _storage->recordCount;
+        try {
+            GFileTableBuilder builder(*this);
+            FileListSaxHandler handler(builder, request.fieldMask);
+            auto response = agent->getRequestScheduler()->execute(
+                [&] { return streamFileList(*makeListSession(*agent, request), handler); });
+            if (response.status_code != 200) {
+                throw std::runtime_error(std::format("Failed to fetch file list: {} - {}\n{}", response.status_code,
+                                                     response.reason, response.text));
+            }
+            return std::move(handler.getNextPageToken());
+        } catch (...) {
+            // Records are only pushed whole, their chunks are reused by the next ones
+            _storage->recordCount = before;
+            throw;
+        }
+    }
+
+    GFileTable GFileTable::QueryAll(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                                    GFileListRequest request) {
+        GFileTable table;
+        do {
+            request.pageToken = table.appendPage(client, request);
+        } while (!request.pageToken.empty());
+        return table;
+    }
+
+    void GFileTable::append(const GFile& file) {
+        GFileTableBuilder builder(*this);
+        builder.beginFile();
+        for (const auto& field : Fields::FIELDS) {
+            switch (field.kind) {
+                case Fields::Kind::String:
+                    if (const auto& value = file.*field.stringMember) builder.setString(field.field, *value);
+                    break;
+                case Fields::Kind::Bool:
+                    if (const auto& value = file.*field.boolMember) builder.setBool(field, *value);
+                    break;
+                case Fields::Kind::StringList:
+                    if (const auto& value = file.*field.listMember) {
+                        builder.beginList(field.field);
+                        for (const auto& item : *value) builder.addListItem(std::string_view(item));
+                    }
+                    break;
+            }
+        }
+        builder.endFile();
+    }
+
+    void GFileTable::reserve(size_t files) {
+        // Record chunks are allocated on demand; only the chunk index is sized up front
+        _storage->recordChunks.reserve((files + RECORD_CHUNK_SIZE - 1) >> RECORD_CHUNK_BITS);
+    }
+
+    void GFileTable::clear() {
+        auto arena = std::move(_storage->arena);
+        _storage.reset();
+        if (arena.use_count() == 1) arena->release();
+        _storage = std::make_unique<Storage>(std::move(arena));
+    }
+
+    size_t GFileTable::memoryUsage() const { return _storage->arena->bytesReserved(); }
+
+    bool GFileView::has(GFileField field) const { return _table->record(_index).present & bit(field); }
+
+    std::optional<std::string_view> GFileView::getString(GFileField field) const {
+        requireKind(field, Fields::Kind::String);
+        const GFileTable::Slot* slot = _table->findSlot(_index, field);
+        if (!slot) return std::nullopt;
+        return std::string_view(static_cast<const char*>(slot->data), slot->size);
+    }
+
+    std::optional<bool> GFileView::getBool(GFileField field) const {
+        requireKind(field, Fields::Kind::Bool);
+        const GFileTable::Record& record = _table->record(_index);
+        if (!(record.present & bit(field))) return std::nullopt;
+        return (record.values & bit(field)) != 0;
+    }
+
+    std::span<const std::string_view> GFileView::getList(GFileField field) const {
+        requireKind(field, Fields::Kind::StringList);
+        const GFileTable::Slot* slot = _table->findSlot(_index, field);
+        if (!slot) return {};
+        return std::span<const std::string_view>(static_cast<const std::string_view*>(slot->data), slot->size);
+    }
+
+    std::shared_ptr<GFile> GFileView::toFile(std::weak_ptr<GCloud::Authentication::OAuthAgent> client) const {
+        auto file = std::make_shared<GFile>(client);
+        for (const auto& field : Fields::FIELDS) {
+            if (!has(field.field)) continue;
+            switch (field.kind) {
+                case Fields::Kind::String:
+                    (*file).*field.stringMember = std::string(*getString(field.field));
+                    break;
+                case Fields::Kind::Bool:
+                    (*file).*field.boolMember = getBool(field.field);
+                    break;
+                case Fields::Kind::StringList: {
+                    auto items = getList(field.field);
+                    (*file).*field.listMember = std::vector<std::string>(items.begin(), items.end());
+                    break;
+                }
+            }
+        }
+        return file;
+    }
+}  // namespace GDrive
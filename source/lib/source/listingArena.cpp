@@ -0,0 +1,18 @@
+#include "GDriveCpp/listingArena.h"
+
+namespace GDrive {
+    ListingArena::ListingArena(size_t initialSize) : _resource(initialSize, &_upstream) {}
+
+    void ListingArena::release() { _resource.release(); }
+
+    void* ListingArena::CountingResource::do_allocate(size_t bytes, size_t alignment) {
+        void* pointer = std::pmr::new_delete_resource()->allocate(bytes, alignment);
+        _bytes += bytes;
+        return pointer;
+    }
+
+    void ListingArena::CountingResource::do_deallocate(void* pointer, size_t bytes, size_t alignment) {
+        std::pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+        _bytes -= bytes;
+    }
+}  // namespace GDrive
@@ -0,0 +1,930 @@
+#include "GDriveCpp/metadataIndex.h"
+
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "cache.hpp"
+#include "fileFields.hpp"
+#include "io.hpp"
+#include "logging.hpp"
+#include "queryEvaluator.hpp"
+
+namespace GDrive {
+    namespace {
+        // Snapshot file layout, all offsets are absolute and the index arrays are 8 byte aligned:
+        //   SnapshotHeader | records | id index | parent index | name index | listed folders | listed folder IDs
+        // A record is a u32 body size followed by the body: id, presence bits, name, parents, bool values and
+        // the remaining members in FIELDS order. The journal stores the same records.
+        constexpr char SNAPSHOT_MAGIC[8] = {'G', 'D', 'M', 'I', 'D', 'X', '\r', '\n'};
+        constexpr uint32_t FORMAT_VERSION = 2;
+        // Compaction waits for at least this many journal entries, and for the journal to outgrow the snapshot
+        constexpr size_t MIN_COMPACT_ENTRIES = 4096;
+        constexpr size_t WRITE_CHUNK_SIZE = 4 * 1024 * 1024;
+
+        static_assert(static_cast<size_t>(GFileField::Count) <= 64, "Record presence bits must fit into 64 bits");
+
+        // Another process writes to the index directory
+        struct IndexInUse : std::runtime_error {
+            using std::runtime_error::runtime_error;
+        };
+
+        constexpr size_t ID_BIT = static_cast<size_t>(GFileField::id);
+        constexpr size_t NAME_BIT = static_cast<size_t>(GFileField::name);
+        constexpr size_t PARENTS_BIT = static_cast<size_t>(GFileField::parents);
+
+        struct SnapshotHeader {
+            char magic[8];
+            uint32_t version;
+            // GFileField::Count when written, records of another field layout cannot be decoded
+            uint32_t fieldCount;
+            uint64_t fileSize;
+            uint64_t recordCount;
+            uint64_t parentEntryCount;
+            uint64_t nameEntryCount;
+            uint64_t listedCount;
+            uint64_t idIndexOffset;
+            uint64_t parentIndexOffset;
+            uint64_t nameIndexOffset;
+            uint64_t listedOffset;
+        };
+
+        // One parent of a record; the parent index is sorted by parent ID, then by name
+        struct ParentEntry {
+            uint64_t record;
+            uint64_t ordinal;
+        };
+
+        struct ListedEntry {
+            uint64_t folderId;
+            uint64_t fields;
+            // 1 when the listing included trashed children
+            uint64_t trashed;
+        };
+
+        // Members the children of a folder were listed with, and whether trashed children were among them
+        struct Listing {
+            uint64_t fields;
+            bool trashed;
+        };
+
+        enum class JournalOp : uint8_t { Put = 1, Remove = 2, Listed = 3 };
+
+        // op, payload size and payload checksum
+        constexpr size_t JOURNAL_HEADER_SIZE = 9;
+
+        struct StringHash {
+            using is_transparent = void;
+
+            size_t operator()(std::string_view value) const { return std::hash<std::string_view>{}(value); }
+        };
+
+        template <typename T>
+        using StringMap = std::unordered_map<std::string, T, StringHash, std::equal_to<>>;
+
+        uint32_t checksum(std::string_view data) {
+            uint32_t hash = 2166136261u;
+            for (char c : data) {
+                hash ^= static_cast<uint8_t>(c);
+                hash *= 16777619u;
+            }
+            return hash;
+        }
+
+        class Writer {
+          public:
+            explicit Writer(std::string& out) : _out(out) {}
+
+            template <typename T>
+            void put(T value) {
+                _out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+            }
+
+            void putString(std::string_view value) {
+                put(static_cast<uint32_t>(value.size()));
+                _out.append(value);
+            }
+
+          private:
+            std::string& _out;
+        };
+
+        class Reader {
+          public:
+            Reader(const char* data, size_t size) : _data(data), _size(size) {}
+
+            template <typename T>
+            T get() {
+                need(sizeof(T));
+                T value;
+                std::memcpy(&value, _data + _position, sizeof(T));
+                _position += sizeof(T);
+                return value;
+            }
+
+            std::string_view getString() {
+                auto size = get<uint32_t>();
+                need(size);
+                std::string_view value(_data + _position, size);
+                _position += size;
+                return value;
+            }
+
+          private:
+            void need(size_t size) const {
+                if (_size - _position < size) throw std::runtime_error("Metadata index record is truncated");
+            }
+
+            const char* _data;
+            size_t _size;
+            size_t _position = 0;
+        };
+
+        uint64_t toBits(const GFileFieldMask& fields) {
+            uint64_t bits = 0;
+            for (size_t i = 0; i < static_cast<size_t>(GFileField::Count); ++i) {
+                if (fields.test(static_cast<GFileField>(i))) bits |= uint64_t{1} << i;
+            }
+            return bits;
+        }
+
+        GFileFieldMask fromBits(uint64_t bits) {
+            GFileFieldMask fields;
+            for (size_t i = 0; i < static_cast<size_t>(GFileField::Count); ++i) {
+                if (bits >> i & 1) fields.set(static_cast<GFileField>(i));
+            }
+            return fields;
+        }
+
+        std::string encodeRecord(const GFile& file) {
+            uint64_t present = 0;
+            uint64_t values = 0;
+            for (size_t i = 0; i < Fields::FIELDS.size(); ++i) {
+                const auto& info = Fields::FIELDS[i];
+                bool has = false;
+                switch (info.kind) {
+                    case Fields::Kind::String:
+                        has = (file.*info.stringMember).has_value();
+                        break;
+                    case Fields::Kind::Bool:
+                        has = (file.*info.boolMember).has_value();
+                        if (has && *(file.*info.boolMember)) values |= uint64_t{1} << i;
+                        break;
+                    case Fields::Kind::StringList:
+                        has = (file.*info.listMember).has_value();
+                        break;
+                }
+                if (has) present |= uint64_t{1} << i;
+            }
+
+            std::string record(sizeof(uint32_t), '\0');
+            Writer writer(record);
+            writer.putString(*file.id);
+            writer.put(present);
+            writer.putString(file.name.value_or(""));
+            const auto& parents = file.parents;
+            writer.put(static_cast<uint32_t>(parents ? parents->size() : 0));
+            if (parents) {
+                for (const auto& parent : *parents) writer.putString(parent);
+            }
+            writer.put(values);
+            for (size_t i = 0; i < Fields::FIELDS.size(); ++i) {
+                if (i == ID_BIT || i == NAME_BIT || i == PARENTS_BIT || !(present >> i & 1)) continue;
+                const auto& info = Fields::FIELDS[i];
+                if (info.kind == Fields::Kind::String) {
+                    writer.putString(*(file.*info.stringMember));
+                } else if (info.kind == Fields::Kind::StringList) {
+                    const auto& list = *(file.*info.listMember);
+                    writer.put(static_cast<uint32_t>(list.size()));
+                    for (const auto& item : list) writer.putString(item);
+                }
+            }
+            auto bodySize = static_cast<uint32_t>(record.size() - sizeof(uint32_t));
+            std::memcpy(record.data(), &bodySize, sizeof(bodySize));
+            return record;
+        }
+
+        // Size of a record including its size prefix
+        size_t recordSize(const char* record) {
+            uint32_t bodySize;
+            std::memcpy(&bodySize, record, sizeof(bodySize));
+            return sizeof(uint32_t) + bodySize;
+        }
+
+        Reader recordReader(const char* record) {
+            return Reader(record + sizeof(uint32_t), recordSize(record) - sizeof(uint32_t));
+        }
+
+        std::string_view recordId(const char* record) { return recordReader(record).getString(); }
+
+        std::string_view recordName(const char* record) {
+            auto reader = recordReader(record);
+            reader.getString();
+            reader.get<uint64_t>();
+            return reader.getString();
+        }
+
+        uint32_t recordParentCount(const char* record) {
+            auto reader = recordReader(record);
+            reader.getString();
+            reader.get<uint64_t>();
+            reader.getString();
+            return reader.get<uint32_t>();
+        }
+
+        std::string_view recordParent(const char* record, uint64_t ordinal) {
+            auto reader = recordReader(record);
+            reader.getString();
+            reader.get<uint64_t>();
+            reader.getString();
+            auto count = reader.get<uint32_t>();
+            if (ordinal >= count) throw std::runtime_error("Metadata index parent entry is out of range");
+            for (uint64_t i = 0; i < ordinal; ++i) reader.getString();
+            return reader.getString();
+        }
+
+        std::shared_ptr<const GFile> decodeRecord(const char* record,
+                                                  const std::weak_ptr<GCloud::Authentication::OAuthAgent>& client) {
+            auto file = std::make_shared<GFile>(client);
+            auto reader = recordReader(record);
+            file->id = std::string(reader.getString());
+            auto present = reader.get<uint64_t>();
+            auto name = reader.getString();
+            if (present >> NAME_BIT & 1) file->name = std::string(name);
+            auto parentCount = reader.get<uint32_t>();
+            if (present >> PARENTS_BIT & 1) {
+                file->parents.emplace();
+                file->parents->reserve(parentCount);
+                for (uint32_t i = 0; i < parentCount; ++i) file->parents->emplace_back(reader.getString());
+            }
+            auto values = reader.get<uint64_t>();
+            for (size_t i = 0; i < Fields::FIELDS.size(); ++i) {
+                if (i == ID_BIT || i == NAME_BIT || i == PARENTS_BIT || !(present >> i & 1)) continue;
+                const auto& info = Fields::FIELDS[i];
+                switch (info.kind) {
+                    case Fields::Kind::String:
+                        (*file).*info.stringMember = std::string(reader.getString());
+                        break;
+                    case Fields::Kind::Bool:
+                        (*file).*info.boolMember = (values >> i & 1) != 0;
+                        break;
+                    case Fields::Kind::StringList: {
+                        auto count = reader.get<uint32_t>();
+                        auto& list = ((*file).*info.listMember).emplace();
+                        list.reserve(count);
+                        for (uint32_t item = 0; item < count; ++item) list.emplace_back(reader.getString());
+                        break;
+                    }
+                }
+            }
+            return file;
+        }
+
+        // Memory mapped snapshot, searched in place through its sorted index arrays
+        class Snapshot {
+          public:
+            explicit Snapshot(const std::filesystem::path& path) : _file(path) {
+                if (_file.size() < sizeof(SnapshotHeader)) throw std::runtime_error("File is too small");
+                std::memcpy(&_header, _file.data(), sizeof(_header));
+                if (std::memcmp(_header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+                    throw std::runtime_error("Not a metadata index snapshot");
+                }
+                if (_header.version != FORMAT_VERSION ||
+                    _header.fieldCount != static_cast<uint32_t>(GFileField::Count)) {
+                    throw std::runtime_error(
+                        std::format("Unsupported format {} with {} fields", _header.version, _header.fieldCount));
+                }
+                if (_header.fileSize != _file.size()) throw std::runtime_error("File is truncated");
+                _ids = section<uint64_t>(_header.idIndexOffset, _header.recordCount);
+                _parents = section<ParentEntry>(_header.parentIndexOffset, _header.parentEntryCount);
+                _names = section<uint64_t>(_header.nameIndexOffset, _header.nameEntryCount);
+                _listed = section<ListedEntry>(_header.listedOffset, _header.listedCount);
+            }
+
+            size_t size() const { return _ids.size(); }
+
+            const char* record(uint64_t offset) const { return _file.data() + offset; }
+
+            std::span<const uint64_t> records() const { return _ids; }
+
+            std::optional<uint64_t> find(std::string_view id) const {
+                auto it = std::ranges::lower_bound(_ids, id, {}, [this](uint64_t offset) {
+                    return recordId(record(offset));
+                });
+                if (it == _ids.end() || recordId(record(*it)) != id) return std::nullopt;
+                return *it;
+            }
+
+            std::span<const ParentEntry> children(std::string_view parentId) const {
+                auto range = std::ranges::equal_range(_parents, parentId, {}, [this](const ParentEntry& entry) {
+                    return recordParent(record(entry.record), entry.ordinal);
+                });
+                return {range.begin(), range.end()};
+            }
+
+            std::span<const ParentEntry> children(std::string_view parentId, std::string_view name) const {
+                auto key = std::make_pair(parentId, name);
+                auto range = std::ranges::equal_range(_parents, key, {}, [this](const ParentEntry& entry) {
+                    const char* data = record(entry.record);
+                    return std::make_pair(recordParent(data, entry.ordinal), recordName(data));
+                });
+                return {range.begin(), range.end()};
+            }
+
+            std::span<const uint64_t> named(std::string_view name) const {
+                auto range = std::ranges::equal_range(_names, name, {}, [this](uint64_t offset) {
+                    return recordName(record(offset));
+                });
+                return {range.begin(), range.end()};
+            }
+
+            std::span<const ListedEntry> listed() const { return _listed; }
+
+            std::optional<Listing> listing(std::string_view folderId) const {
+                auto it = std::ranges::lower_bound(_listed, folderId, {}, [this](const ListedEntry& entry) {
+                    return listedId(entry);
+                });
+                if (it == _listed.end() || listedId(*it) != folderId) return std::nullopt;
+                return Listing{it->fields, it->trashed != 0};
+            }
+
+            std::string_view listedId(const ListedEntry& entry) const {
+                return Reader(record(entry.folderId), _file.size() - entry.folderId).getString();
+            }
+
+          private:
+            template <typename T>
+            std::span<const T> section(uint64_t offset, uint64_t count) const {
+                if (offset % alignof(T) != 0 || offset > _file.size() || count > (_file.size() - offset) / sizeof(T)) {
+                    throw std::runtime_error("Index section is out of bounds");
+                }
+                return {reinterpret_cast<const T*>(_file.data() + offset), static_cast<size_t>(count)};
+            }
+
+            utils::io::MappedFile _file;
+            SnapshotHeader _header{};
+            std::span<const uint64_t> _ids;
+            std::span<const ParentEntry> _parents;
+            std::span<const uint64_t> _names;
+            std::span<const ListedEntry> _listed;
+        };
+
+        // Buffered sequential writer for a new snapshot
+        class SnapshotWriter {
+          public:
+            explicit SnapshotWriter(const std::filesystem::path& path)
+                : _file(path, utils::io::RandomAccessFile::Mode::Overwrite) {
+                _buffer.reserve(WRITE_CHUNK_SIZE);
+            }
+
+            uint64_t position() const { return _written + _buffer.size(); }
+
+            void write(std::string_view data) {
+                _buffer.append(data);
+                if (_buffer.size() >= WRITE_CHUNK_SIZE) flushBuffer();
+            }
+
+            template <typename T>
+            void write(const T& value) {
+                write(std::string_view(reinterpret_cast<const char*>(&value), sizeof(T)));
+            }
+
+            void align() {
+                static constexpr char PADDING[8] = {};
+                write(std::string_view(PADDING, (8 - position() % 8) % 8));
+            }
+
+            void finish(const SnapshotHeader& header) {
+                flushBuffer();
+                _file.writeAt(0, &header, sizeof(header));
+                _file.flush();
+            }
+
+          private:
+            void flushBuffer() {
+                _file.writeAt(_written, _buffer.data(), _buffer.size());
+                _written += _buffer.size();
+                _buffer.clear();
+            }
+
+            utils::io::RandomAccessFile _file;
+            std::string _buffer;
+            uint64_t _written = 0;
+        };
+    }  // namespace
+
+    struct MetadataIndex::Storage {
+        std::weak_ptr<GCloud::Authentication::OAuthAgent> client;
+        // Empty for an index kept in memory only
+        std::filesystem::path directory;
+        // Held while the index is open, journal appends and compaction assume a single writer
+        std::unique_ptr<utils::io::LockFile> owner;
+        std::unique_ptr<Snapshot> snapshot;
+        std::unique_ptr<utils::io::RandomAccessFile> journal;
+        uint64_t journalSize = 0;
+        size_t journalEntries = 0;
+
+        // Changes since the snapshot was written. A null file hides a removed snapshot record and an empty mask
+        // a folder that is no longer listed.
+        StringMap<std::shared_ptr<const GFile>> files;
+        StringMap<std::optional<Listing>> listed;
+        // Secondary indexes over files: parent ID and name to file IDs
+        StringMap<std::unordered_set<std::string>> children;
+        StringMap<std::unordered_set<std::string>> names;
+        size_t count = 0;
+
+        std::filesystem::path snapshotPath() const { return directory / "snapshot.bin"; }
+
+        std::filesystem::path journalPath() const { return directory / "journal.log"; }
+
+        void open() {
+            std::filesystem::create_directories(directory);
+            owner = std::make_unique<utils::io::LockFile>(directory / "lock");
+            if (!owner->try_lock()) {
+                throw IndexInUse(std::format("Metadata index {} is open in another process", directory.string()));
+            }
+            if (std::filesystem::exists(snapshotPath())) {
+                try {
+                    snapshot = std::make_unique<Snapshot>(snapshotPath());
+                    count = snapshot->size();
+                } catch (const std::runtime_error& e) {
+                    // The index only caches server state, an unreadable snapshot is rebuilt over time
+                    spdlog::warn("Discarding metadata index snapshot {}: {}", snapshotPath().string(), e.what());
+                    snapshot.reset();
+                    std::filesystem::remove(snapshotPath());
+                }
+            }
+            journal = std::make_unique<utils::io::RandomAccessFile>(journalPath(),
+                                                                    utils::io::RandomAccessFile::Mode::Update);
+            replay();
+        }
+
+        void replay() {
+            std::string data(journal->size(), '\0');
+            data.resize(journal->readAt(0, data.data(), data.size()));
+            size_t position = 0;
+            while (data.size() - position >= JOURNAL_HEADER_SIZE) {
+                Reader header(data.data() + position, JOURNAL_HEADER_SIZE);
+                auto op = static_cast<JournalOp>(header.get<uint8_t>());
+                auto size = header.get<uint32_t>();
+                auto sum = header.get<uint32_t>();
+                if (data.size() - position - JOURNAL_HEADER_SIZE < size) break;
+                std::string_view payload(data.data() + position + JOURNAL_HEADER_SIZE, size);
+                if (checksum(payload) != sum) break;
+                try {
+                    apply(op, payload);
+                } catch (const std::runtime_error& e) {
+                    spdlog::warn("Skipping unreadable metadata index journal entry: {}", e.what());
+                }
+                position += JOURNAL_HEADER_SIZE + size;
+                ++journalEntries;
+            }
+            if (position != data.size()) {
+                // A write torn by a crash, everything before it is intact
+                spdlog::warn("Metadata index journal {} ends in a partial entry, dropping {} bytes",
+                             journalPath().string(), data.size() - position);
+                journal->resize(position);
+            }
+            journalSize = position;
+        }
+
+        void apply(JournalOp op, std::string_view payload) {
+            switch (op) {
+                case JournalOp::Put: {
+                    if (payload.size() < sizeof(uint32_t) || recordSize(payload.data()) != payload.size()) {
+                        throw std::runtime_error("Record size does not match the entry");
+                    }
+                    putFile(decodeRecord(payload.data(), client));
+                    break;
+                }
+                case JournalOp::Remove:
+                    removeFile(std::string(Reader(payload.data(), payload.size()).getString()));
+                    break;
+                case JournalOp::Listed: {
+                    Reader reader(payload.data(), payload.size());
+                    std::string folderId(reader.getString());
+                    auto fields = reader.get<uint64_t>();
+                    setListed(folderId, Listing{fields, reader.get<uint8_t>() != 0});
+                    break;
+                }
+                default:
+                    throw std::runtime_error(std::format("Unknown operation {}", static_cast<int>(op)));
+            }
+        }
+
+        void log(JournalOp op, std::string_view payload) {
+            if (!journal) return;
+            std::string entry;
+            entry.reserve(JOURNAL_HEADER_SIZE + payload.size());
+            Writer writer(entry);
+            writer.put(static_cast<uint8_t>(op));
+            writer.put(static_cast<uint32_t>(payload.size()));
+            writer.put(checksum(payload));
+            entry.append(payload);
+            journal->writeAt(journalSize, entry.data(), entry.size());
+            journalSize += entry.size();
+            ++journalEntries;
+        }
+
+        bool needsCompaction() const {
+            return journalEntries >= MIN_COMPACT_ENTRIES && journalEntries > (snapshot ? snapshot->size() : 0);
+        }
+
+        bool inSnapshot(std::string_view id) const { return snapshot && snapshot->find(id).has_value(); }
+
+        // True when the snapshot record of id was replaced or removed since the snapshot was written
+        bool shadowed(std::string_view id) const { return files.contains(id); }
+
+        void link(const GFile& file) {
+            const std::string& id = *file.id;
+            if (file.parents) {
+                for (const auto& parent : *file.parents) children[parent].insert(id);
+            }
+            if (file.name) names[*file.name].insert(id);
+        }
+
+        void unlink(const GFile& file) {
+            auto drop = [&file](StringMap<std::unordered_set<std::string>>& index, const std::string& key) {
+                auto it = index.find(key);
+                if (it == index.end()) return;
+                it->second.erase(*file.id);
+                if (it->second.empty()) index.erase(it);
+            };
+            if (file.parents) {
+                for (const auto& parent : *file.parents) drop(children, parent);
+            }
+            if (file.name) drop(names, *file.name);
+        }
+
+        void putFile(std::shared_ptr<const GFile> file) {
+            bool existed;
+            auto it = files.find(*file->id);
+            if (it != files.end()) {
+                existed = it->second != nullptr;
+                if (it->second) unlink(*it->second);
+                it->second = file;
+            } else {
+                existed = inSnapshot(*file->id);
+                files.emplace(*file->id, file);
+            }
+            link(*file);
+            if (!existed) ++count;
+        }
+
+        bool removeFile(const std::string& id) {
+            bool snapshotted = inSnapshot(id);
+            bool existed = snapshotted;
+            auto it = files.find(id);
+            if (it != files.end()) {
+                existed = it->second != nullptr;
+                if (it->second) unlink(*it->second);
+                if (snapshotted) {
+                    it->second = nullptr;
+                } else {
+                    files.erase(it);
+                }
+            } else if (snapshotted) {
+                files.emplace(id, nullptr);
+            }
+            if (existed) --count;
+            if (snapshot && snapshot->listing(id)) {
+                listed.insert_or_assign(id, std::nullopt);
+            } else {
+                listed.erase(id);
+            }
+            return existed;
+        }
+
+        void setListed(const std::string& folderId, const Listing& listing) {
+            listed.insert_or_assign(folderId, listing);
+        }
+
+        std::optional<Listing> listing(std::string_view folderId) const {
+            auto it = listed.find(folderId);
+            if (it != listed.end()) return it->second;
+            return snapshot ? snapshot->listing(folderId) : std::nullopt;
+        }
+
+        std::shared_ptr<const GFile> get(std::string_view id) const {
+            auto it = files.find(id);
+            if (it != files.end()) return it->second;
+            if (!snapshot) return nullptr;
+            auto offset = snapshot->find(id);
+            return offset ? decodeRecord(snapshot->record(*offset), client) : nullptr;
+        }
+
+        // Appends the files of overlay IDs and of snapshot records that were not replaced since
+        template <typename Match>
+        void collect(const StringMap<std::unordered_set<std::string>>& index, std::string_view key,
+                     std::span<const uint64_t> records, Match&& match,
+                     std::vector<std::shared_ptr<const GFile>>& result) const {
+            auto ids = index.find(key);
+            if (ids != index.end()) {
+                for (const auto& id : ids->second) {
+                    const auto& file = files.find(id)->second;
+                    if (match(*file)) result.push_back(file);
+                }
+            }
+            for (uint64_t offset : records) {
+                const char* record = snapshot->record(offset);
+                if (!shadowed(recordId(record))) result.push_back(decodeRecord(record, client));
+            }
+        }
+
+        template <typename Callback>
+        void forEach(Callback&& callback) const {
+            for (const auto& [id, file] : files) {
+                if (file) callback(file);
+            }
+            if (!snapshot) return;
+            for (uint64_t offset : snapshot->records()) {
+                const char* record = snapshot->record(offset);
+                if (!shadowed(recordId(record))) callback(decodeRecord(record, client));
+            }
+        }
+
+        std::vector<uint64_t> recordsOf(std::span<const ParentEntry> entries) const {
+            std::vector<uint64_t> records;
+            records.reserve(entries.size());
+            for (const auto& entry : entries) records.push_back(entry.record);
+            return records;
+        }
+
+        void clearOverlay() {
+            files.clear();
+            listed.clear();
+            children.clear();
+            names.clear();
+        }
+
+        void compact() {
+            if (!journal) return;
+            // Live records, copied verbatim from the old snapshot or encoded from the journal
+            std::string records;
+            std::vector<uint64_t> offsets;
+            if (snapshot) {
+                for (uint64_t offset : snapshot->records()) {
+                    const char* record = snapshot->record(offset);
+                    if (shadowed(recordId(record))) continue;
+                    offsets.push_back(records.size());
+                    records.append(record, recordSize(record));
+                }
+            }
+            for (const auto& [id, file] : files) {
+                if (!file) continue;
+                offsets.push_back(records.size());
+                records += encodeRecord(*file);
+            }
+            std::vector<std::pair<std::string, Listing>> folders;
+            if (snapshot) {
+                for (const auto& entry : snapshot->listed()) {
+                    auto folderId = snapshot->listedId(entry);
+                    if (!listed.contains(folderId)) {
+                        folders.emplace_back(folderId, Listing{entry.fields, entry.trashed != 0});
+                    }
+                }
+            }
+            for (const auto& [folderId, listing] : listed) {
+                if (listing) folders.emplace_back(folderId, *listing);
+            }
+            std::ranges::sort(folders, {}, [](const auto& folder) -> const std::string& { return folder.first; });
+
+            // Index arrays hold offsets into records until the final layout is known
+            const char* base = records.data();
+            std::vector<uint64_t> ids = offsets;
+            std::ranges::sort(ids, {}, [base](uint64_t offset) { return recordId(base + offset); });
+            std::vector<ParentEntry> parents;
+            std::vector<uint64_t> named;
+            for (uint64_t offset : offsets) {
+                uint32_t parentCount = recordParentCount(base + offset);
+                for (uint32_t i = 0; i < parentCount; ++i) parents.push_back(ParentEntry{offset, i});
+                if (!recordName(base + offset).empty()) named.push_back(offset);
+            }
+            std::ranges::sort(parents, {}, [base](const ParentEntry& entry) {
+                const char* record = base + entry.record;
+                return std::make_pair(recordParent(record, entry.ordinal), recordName(record));
+            });
+            std::ranges::sort(named, {}, [base](uint64_t offset) { return recordName(base + offset); });
+
+            SnapshotHeader header{};
+            std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+            header.version = FORMAT_VERSION;
+            header.fieldCount = static_cast<uint32_t>(GFileField::Count);
+            header.recordCount = ids.size();
+            header.parentEntryCount = parents.size();
+            header.nameEntryCount = named.size();
+            header.listedCount = folders.size();
+
+            auto temporary = directory / "snapshot.tmp";
+            {
+                SnapshotWriter writer(temporary);
+                writer.write(header);
+                const uint64_t recordsOffset = writer.position();
+                writer.write(std::string_view(records));
+                writer.align();
+                header.idIndexOffset = writer.position();
+                for (uint64_t offset : ids) writer.write(recordsOffset + offset);
+                header.parentIndexOffset = writer.position();
+                for (const auto& entry : parents) {
+                    writer.write(ParentEntry{recordsOffset + entry.record, entry.ordinal});
+                }
+                header.nameIndexOffset = writer.position();
+                for (uint64_t offset : named) writer.write(recordsOffset + offset);
+                header.listedOffset = writer.position();
+                uint64_t folderIdOffset = header.listedOffset + folders.size() * sizeof(ListedEntry);
+                for (const auto& [folderId, listing] : folders) {
+                    writer.write(ListedEntry{folderIdOffset, listing.fields, listing.trashed ? 1u : 0u});
+                    folderIdOffset += sizeof(uint32_t) + folderId.size();
+                }
+                for (const auto& [folderId, listing] : folders) {
+                    writer.write(static_cast<uint32_t>(folderId.size()));
+                    writer.write(std::string_view(folderId));
+                }
+                header.fileSize = writer.position();
+                writer.finish(header);
+            }
+
+            // The old mapping has to go first, a mapped file cannot be replaced on Windows. Replaying a journal
+            // that survived a crash right after the rename is harmless, all of its entries are idempotent.
+            snapshot.reset();
+            std::filesystem::rename(temporary, snapshotPath());
+            snapshot = std::make_unique<Snapshot>(snapshotPath());
+            journal->resize(0);
+            journalSize = 0;
+            journalEntries = 0;
+            clearOverlay();
+            count = snapshot->size();
+            spdlog::debug("Compacted metadata index {} to {} files", directory.string(), count);
+        }
+
+        void compactIfNeeded() {
+            if (!needsCompaction()) return;
+            try {
+                compact();
+            } catch (const std::exception& e) {
+                // The journal still holds everything, compaction is retried with the next change
+                spdlog::warn("Failed to compact metadata index {}: {}", directory.string(), e.what());
+                if (!snapshot && std::filesystem::exists(snapshotPath())) {
+                    snapshot = std::make_unique<Snapshot>(snapshotPath());
+                }
+            }
+        }
+    };
+
+    MetadataIndex::MetadataIndex() : _storage(std::make_unique<Storage>()) {}
+
+    MetadataIndex::MetadataIndex(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                                 const std::filesystem::path& directory)
+        : _storage(std::make_unique<Storage>()) {
+        _storage->client = std::move(client);
+        _storage->directory = directory;
+        _storage->open();
+        _storage->compactIfNeeded();
+    }
+
+    MetadataIndex::~MetadataIndex() = default;
+
+    std::shared_ptr<MetadataIndex> MetadataIndex::Open(std::weak_ptr<GCloud::Authentication::OAuthAgent> client) {
+        auto agent = client.lock();
+        if (!agent) {
+            throw std::runtime_error("Failed to open metadata index: Client is no longer valid");
+        }
+        auto directory = GCloud::Cache::getMetadataIndexDirectory(agent->getClientId());
+        try {
+            return std::make_shared<MetadataIndex>(client, directory);
+        } catch (const IndexInUse& e) {
+            spdlog::warn("{}, keeping the index of this process in memory", e.what());
+            return std::make_shared<MetadataIndex>();
+        }
+    }
+
+    void MetadataIndex::put(std::shared_ptr<const GFile> file) {
+        if (!file || !file->id.has_value()) return;
+        std::unique_lock lock(_mutex);
+        if (_storage->journal) _storage->log(JournalOp::Put, encodeRecord(*file));
+        _storage->putFile(std::move(file));
+        _storage->compactIfNeeded();
+    }
+
+    bool MetadataIndex::remove(const std::string_view& id) {
+        std::unique_lock lock(_mutex);
+        if (_storage->journal) {
+            std::string payload;
+            Writer(payload).putString(id);
+            _storage->log(JournalOp::Remove, payload);
+        }
+        bool existed = _storage->removeFile(std::string(id));
+        _storage->compactIfNeeded();
+        return existed;
+    }
+
+    std::shared_ptr<const GFile> MetadataIndex::get(const std::string_view& id) const {
+        std::shared_lock lock(_mutex);
+        return _storage->get(id);
+    }
+
+    std::vector<std::shared_ptr<const GFile>> MetadataIndex::children(const std::string_view& parentId) const {
+        std::shared_lock lock(_mutex);
+        std::vector<std::shared_ptr<const GFile>> result;
+        std::vector<uint64_t> records;
+        if (_storage->snapshot) records = _storage->recordsOf(_storage->snapshot->children(parentId));
+        _storage->collect(_storage->children, parentId, records, [](const GFile&) { return true; }, result);
+        return result;
+    }
+
+    std::vector<std::shared_ptr<const GFile>> MetadataIndex::findByName(const std::string_view& name) const {
+        std::shared_lock lock(_mutex);
+        std::vector<std::shared_ptr<const GFile>> result;
+        std::span<const uint64_t> records;
+        if (_storage->snapshot) records = _storage->snapshot->named(name);
+        _storage->collect(_storage->names, name, records, [](const GFile&) { return true; }, result);
+        return result;
+    }
+
+    std::vector<std::shared_ptr<const GFile>> MetadataIndex::findChild(const std::string_view& parentId,
+                                                                       const std::string_view& name) const {
+        std::shared_lock lock(_mutex);
+        std::vector<std::shared_ptr<const GFile>> result;
+        std::vector<uint64_t> records;
+        if (_storage->snapshot) records = _storage->recordsOf(_storage->snapshot->children(parentId, name));
+        _storage->collect(
+            _storage->children, parentId, records, [&name](const GFile& file) { return file.name == name; }, result);
+        return result;
+    }
+
+    std::vector<std::shared_ptr<const GFile>> MetadataIndex::query(const QueryBuilder& query) const {
+        auto evaluator = QueryEvaluator::Of(query);
+        const auto& parent = evaluator->requiredParent();
+        const auto& name = evaluator->requiredName();
+        std::vector<std::shared_ptr<const GFile>> result;
+        if (parent || name) {
+            if (parent && name) {
+                result = findChild(*parent, *name);
+            } else {
+                result = parent ? children(*parent) : findByName(*name);
+            }
+            std::erase_if(result, [&evaluator](const auto& file) { return !evaluator->matches(*file); });
+            return result;
+        }
+        std::shared_lock lock(_mutex);
+        _storage->forEach([&](std::shared_ptr<const GFile> file) {
+            if (evaluator->matches(*file)) result.push_back(std::move(file));
+        });
+        return result;
+    }
+
+    size_t MetadataIndex::size() const {
+        std::shared_lock lock(_mutex);
+        return _storage->count;
+    }
+
+    void MetadataIndex::clear() {
+        std::unique_lock lock(_mutex);
+        _storage->clearOverlay();
+        _storage->count = 0;
+        if (!_storage->journal) return;
+        _storage->snapshot.reset();
+        std::filesystem::remove(_storage->snapshotPath());
+        _storage->journal->resize(0);
+        _storage->journalSize = 0;
+        _storage->journalEntries = 0;
+    }
+
+    void MetadataIndex::markListed(const std::string_view& folderId, const GFileFieldMask& fields, bool trashed) {
+        std::unique_lock lock(_mutex);
+        if (_storage->journal) {
+            std::string payload;
+            Writer writer(payload);
+            writer.putString(folderId);
+            writer.put(toBits(fields));
+            writer.put(static_cast<uint8_t>(trashed));
+            _storage->log(JournalOp::Listed, payload);
+        }
+        _storage->setListed(std::string(folderId), Listing{toBits(fields), trashed});
+        _storage->compactIfNeeded();
+    }
+
+    std::optional<GFileFieldMask> MetadataIndex::listedFields(const std::string_view& folderId, bool trashed) const {
+        std::shared_lock lock(_mutex);
+        auto listing = _storage->listing(folderId);
+        if (!listing || listing->trashed != trashed) return std::nullopt;
+        return fromBits(listing->fields);
+    }
+
+    bool MetadataIndex::isPersistent() const { return _storage->journal != nullptr; }
+
+    void MetadataIndex::flush() {
+        std::unique_lock lock(_mutex);
+        if (_storage->journal) _storage->journal->flush();
+    }
+
+    void MetadataIndex::compact() {
+        std::unique_lock lock(_mutex);
+        _storage->compact();
+    }
+}  // namespace GDrive
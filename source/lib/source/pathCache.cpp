@@ -0,0 +1,141 @@
+#include "GDriveCpp/pathCache.h"
+
+#include <filesystem>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <vector>
+
+#include "cache.hpp"
+#include "logging.hpp"
+
+namespace GDrive {
+    PathCache::PathCache(std::chrono::seconds ttl) : _ttl(ttl) {}
+
+    std::string PathCache::makeKey(const std::string_view& rootId, const std::string_view& path) {
+        std::string key;
+        key.reserve(rootId.size() + path.size() + 1);
+        key.append(rootId).append(":").append(path);
+        while (key.size() > rootId.size() + 1 && key.back() == '/') key.pop_back();
+        return key;
+    }
+
+    std::optional<std::string> PathCache::lookup(const std::string_view& rootId, const std::string_view& path) {
+        std::lock_guard lock(_mutex);
+        auto it = _entries.find(makeKey(rootId, path));
+        if (it == _entries.end()) return std::nullopt;
+        if (std::chrono::system_clock::now() >= it->second.expiresAt) {
+            _entries.erase(it);
+            return std::nullopt;
+        }
+        return it->second.folderId;
+    }
+
+    void PathCache::store(const std::string_view& rootId, const std::string_view& path,
+                          const std::string_view& folderId) {
+        std::lock_guard lock(_mutex);
+        _entries.insert_or_assign(makeKey(rootId, path),
+                                  Entry{.folderId = std::string(folderId),
+                                        .expiresAt = std::chrono::system_clock::now() + _ttl});
+    }
+
+    void PathCache::eraseSubtree(const std::string& key) {
+        // Dropping a folder also drops the paths that were resolved relative to any folder below it
+        std::vector<std::string> keys{key};
+        std::vector<std::string> scopes;
+        while (!keys.empty() || !scopes.empty()) {
+            std::vector<std::string> removedIds;
+            auto remove = [&](const auto& predicate) {
+                std::erase_if(_entries, [&](const auto& entry) {
+                    if (!predicate(entry.first)) return false;
+                    removedIds.push_back(entry.second.folderId);
+                    return true;
+                });
+            };
+            for (const auto& k : keys) {
+                const std::string prefix = k + "/";
+                remove([&](const std::string& candidate) { return candidate == k || candidate.starts_with(prefix); });
+            }
+            for (const auto& scope : scopes) {
+                remove([&](const std::string& candidate) { return candidate.starts_with(scope); });
+            }
+            keys.clear();
+            scopes.clear();
+            for (const auto& id : removedIds) scopes.push_back(id + ":");
+        }
+    }
+
+    void PathCache::invalidate(const std::string_view& rootId, const std::string_view& path) {
+        std::lock_guard lock(_mutex);
+        eraseSubtree(makeKey(rootId, path));
+    }
+
+    void PathCache::invalidateFolder(const std::string_view& folderId) {
+        std::lock_guard lock(_mutex);
+        std::vector<std::string> keys;
+        for (const auto& [key, entry] : _entries) {
+            if (entry.folderId == folderId) keys.push_back(key);
+        }
+        for (const auto& key : keys) eraseSubtree(key);
+        // Paths resolved relative to the folder itself
+        const std::string scope = std::string(folderId) + ":";
+        std::vector<std::string> scoped;
+        for (const auto& [key, entry] : _entries) {
+            if (key.starts_with(scope)) scoped.push_back(key);
+        }
+        for (const auto& key : scoped) eraseSubtree(key);
+    }
+
+    void PathCache::clear() {
+        std::lock_guard lock(_mutex);
+        _entries.clear();
+    }
+
+    size_t PathCache::size() const {
+        std::lock_guard lock(_mutex);
+        return _entries.size();
+    }
+
+    void PathCache::load(const std::string_view& clientId) {
+        auto cacheFile = GCloud::Cache::getPathCacheFilePath(clientId);
+        if (!std::filesystem::exists(cacheFile)) return;
+        std::ifstream file(cacheFile);
+        nlohmann::json jsonData;
+        try {
+            jsonData = nlohmann::json::parse(file);
+        } catch (const nlohmann::json::parse_error& e) {
+            spdlog::warn("Ignoring corrupt path cache {}: {}", cacheFile.string(), e.what());
+            return;
+        }
+
+        auto now = std::chrono::system_clock::now();
+        std::lock_guard lock(_mutex);
+        for (const auto& item : jsonData.value("entries", nlohmann::json::array())) {
+            auto expiresAt = std::chrono::system_clock::from_time_t(item.value("expires_at", int64_t{0}));
+            if (expiresAt <= now) continue;
+            _entries.insert_or_assign(item.value("key", ""),
+                                      Entry{.folderId = item.value("id", ""), .expiresAt = expiresAt});
+        }
+    }
+
+    void PathCache::save(const std::string_view& clientId) const {
+        auto cacheFile = GCloud::Cache::getPathCacheFilePath(clientId);
+        std::filesystem::create_directories(cacheFile.parent_path());
+
+        nlohmann::json entries = nlohmann::json::array();
+        {
+            auto now = std::chrono::system_clock::now();
+            std::lock_guard lock(_mutex);
+            for (const auto& [key, entry] : _entries) {
+                if (entry.expiresAt <= now) continue;
+                entries.push_back({{"key", key},
+                                   {"id", entry.folderId},
+                                   {"expires_at", std::chrono::system_clock::to_time_t(entry.expiresAt)}});
+            }
+        }
+        std::ofstream file(cacheFile, std::ios::trunc);
+        if (!file.is_open()) {
+            throw std::runtime_error("Failed to open path cache for writing: " + cacheFile.string());
+        }
+        file << nlohmann::json{{"entries", entries}}.dump();
+    }
+}  // namespace GDrive
@@ -1,9 +1,15 @@
 #include "GDriveCpp/queryBuilder.h"
 
+#include <bit>
+#include <format>
 #include <memory>
+#include <mutex>
 #include <stack>
 
+#include "GDriveCpp/gFile.h"
+#include "GDriveCpp/gFileTable.h"
 #include "logging.hpp"
+#include "queryEvaluator.hpp"
 #include "queryLogic.hpp"
 
 namespace GDrive {
@@ -16,36 +22,60 @@ namespace GDrive {
     QueryBuilder& QueryBuilder::operator=(QueryBuilder&& other) noexcept = default;
 
     struct QueryBuilderImpl {
-        std::stack<std::shared_ptr<LogicBlock>> logicStack;
+        QueryTree tree;
+        // Open blocks, the root block at the bottom
+        std::stack<uint32_t> logicStack;
+        // Condition nodes in the order they were added, as numbered by SetConditionValue
+        std::vector<uint32_t> conditions;
 
-        QueryBuilderImpl() : root(new LogicBlock(LogicBlock::Type::And)) { logicStack.push(root); };
+        QueryBuilderImpl() { logicStack.push(0); };
 
-        std::shared_ptr<LogicBlock> root;
+        // Compiled on the first local evaluation and dropped whenever the conditions change
+        std::mutex evaluatorMutex;
+        std::shared_ptr<const QueryEvaluator> evaluator;
 
-        void AddCondition(std::shared_ptr<Condition> condition) {
+        void InvalidateEvaluator() {
+            std::lock_guard lock(evaluatorMutex);
+            evaluator.reset();
+        }
+
+        void AddCondition(const std::string& field, QueryBuilder::ComparisonOperator op,
+                          std::span<const std::string> values, bool list, bool parameter = false) {
             if (logicStack.empty()) {
                 throw std::runtime_error("Logic stack is empty, cannot add condition.");
             }
-            logicStack.top()->AddCondition(condition);
+            conditions.push_back(tree.addCondition(logicStack.top(), field, op, values, list, parameter));
+            InvalidateEvaluator();
         }
 
-        void AddLogicBlock(std::shared_ptr<LogicBlock> block) {
+        void AddLogicBlock(QueryNode::Type type) {
             if (logicStack.empty()) {
                 throw std::runtime_error("Logic stack is empty, cannot add logic block.");
             }
+            logicStack.push(tree.addBlock(logicStack.top(), type));
+            InvalidateEvaluator();
+        }
 
-            logicStack.top()->AddLogicBlock(block);
-            logicStack.push(block);
+        uint32_t Condition(size_t index) const {
+            if (index >= conditions.size()) {
+                throw std::out_of_range(
+                    std::format("Condition {} does not exist, the query has {}", index, conditions.size()));
+            }
+            if (tree.node(conditions[index]).parameter) {
+                throw std::invalid_argument(
+                    std::format("Condition {} is a parameter, bind it on the compiled QueryTemplate", index));
+            }
+            return conditions[index];
         }
     };
 
     QueryBuilder& QueryBuilder::And() {
-        impl->AddLogicBlock(std::make_shared<LogicBlock>(LogicBlock::Type::And));
+        impl->AddLogicBlock(QueryNode::Type::And);
         return *this;
     }
 
     QueryBuilder& QueryBuilder::Or() {
-        impl->AddLogicBlock(std::make_shared<LogicBlock>(LogicBlock::Type::Or));
+        impl->AddLogicBlock(QueryNode::Type::Or);
         return *this;
     }
 
@@ -54,8 +84,7 @@ namespace GDrive {
         if (!enabled) {
             return *this;
         }
-        auto condition = std::make_shared<Condition>(field, op, value);
-        impl->AddCondition(condition);
+        impl->AddCondition(field, op, std::span<const std::string>(&value, 1), false);
         return *this;
     }
 
@@ -64,13 +93,30 @@ namespace GDrive {
         if (!enabled) {
             return *this;
         }
-        auto condition = std::make_shared<Condition>(field, op, values);
-        impl->AddCondition(condition);
+        if (op != ComparisonOperator::In) {
+            throw std::invalid_argument("Invalid operator for multiple values");
+        }
+        if (values.empty()) {
+            throw std::invalid_argument(std::format("Condition on '{}' needs at least one value", field));
+        }
+        impl->AddCondition(field, op, values, true);
+        return *this;
+    }
+
+    QueryBuilder& QueryBuilder::AddParameter(const std::string& field, ComparisonOperator op,
+                                             const std::string& parameter, bool enabled) {
+        if (!enabled) {
+            return *this;
+        }
+        if (parameter.empty()) {
+            throw std::invalid_argument(std::format("Parameter of the condition on '{}' needs a name", field));
+        }
+        impl->AddCondition(field, op, std::span<const std::string>(&parameter, 1), false, true);
         return *this;
     }
 
     QueryBuilder& QueryBuilder::EndBlock() {
-        if (impl->logicStack.top().get() == impl->root.get()) {
+        if (impl->logicStack.top() == 0) {
             throw std::runtime_error(
                 "Logic Block Imbalance! Query contains more End Blocks than the blocks themselves.");
         }
@@ -78,10 +124,78 @@ namespace GDrive {
         return *this;
     }
 
+    QueryBuilder& QueryBuilder::SetConditionValue(size_t condition, const std::string& value) {
+        uint32_t node = impl->Condition(condition);
+        if (impl->tree.node(node).operandCount != 1 || impl->tree.node(node).list) {
+            throw std::invalid_argument(std::format("Condition {} holds a list of values", condition));
+        }
+        impl->tree.setOperand(node, 0, value);
+        impl->InvalidateEvaluator();
+        return *this;
+    }
+
+    QueryBuilder& QueryBuilder::SetConditionValues(size_t condition, const std::vector<std::string>& values) {
+        uint32_t node = impl->Condition(condition);
+        if (impl->tree.node(node).operandCount != values.size()) {
+            throw std::invalid_argument(std::format("Condition {} holds {} values, {} given", condition,
+                                                    impl->tree.node(node).operandCount, values.size()));
+        }
+        for (size_t i = 0; i < values.size(); ++i) impl->tree.setOperand(node, static_cast<uint32_t>(i), values[i]);
+        impl->InvalidateEvaluator();
+        return *this;
+    }
+
+    size_t QueryBuilder::ConditionCount() const { return impl->conditions.size(); }
+
     std::string QueryBuilder::Build() const {
+        std::string query;
+        BuildInto(query);
+        return query;
+    }
+
+    void QueryBuilder::BuildInto(std::string& out) const {
+        if (impl->logicStack.size() != 1) {
+            spdlog::warn("Logic Block Imbalance! Some Logic Blocks might not have closed");
+        }
+        impl->tree.serialize(out);
+    }
+
+    QueryTemplate QueryBuilder::Compile() const {
         if (impl->logicStack.size() != 1) {
             spdlog::warn("Logic Block Imbalance! Some Logic Blocks might not have closed");
         }
-        return impl->root->toString();
+        QueryTemplate compiled;
+        std::vector<QueryPlaceholder> placeholders;
+        impl->tree.serialize(compiled._text, &placeholders);
+        for (const auto& placeholder : placeholders) compiled.addSlot(placeholder.offset, placeholder.name);
+        return compiled;
+    }
+
+    bool QueryBuilder::IsLocallyEvaluable() const {
+        try {
+            QueryEvaluator::Of(*this);
+            return true;
+        } catch (const std::invalid_argument&) {
+            return false;
+        }
+    }
+
+    bool QueryBuilder::Matches(const GFile& file) const { return QueryEvaluator::Of(*this)->matches(file); }
+
+    std::vector<size_t> QueryBuilder::Filter(const GFileTable& table) const {
+        auto bitmap = QueryEvaluator::Of(*this)->filter(table);
+        std::vector<size_t> matches;
+        for (size_t word = 0; word < bitmap.size(); ++word) {
+            for (uint64_t bits = bitmap[word]; bits; bits &= bits - 1) {
+                matches.push_back(word * 64 + std::countr_zero(bits));
+            }
+        }
+        return matches;
+    }
+
+    std::shared_ptr<const QueryEvaluator> QueryEvaluator::Of(const QueryBuilder& query) {
+        std::lock_guard lock(query.impl->evaluatorMutex);
+        if (!query.impl->evaluator) query.impl->evaluator = std::make_shared<const QueryEvaluator>(query.impl->tree);
+        return query.impl->evaluator;
     }
 }  // namespace GDrive
@@ -0,0 +1,312 @@
+#include "queryEvaluator.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <format>
+#include <stdexcept>
+
+namespace GDrive {
+    namespace {
+        using Operator = QueryBuilder::ComparisonOperator;
+
+        constexpr bool isNumericField(GFileField field) {
+            return field == GFileField::size || field == GFileField::quotaBytesUsed || field == GFileField::version ||
+                   field == GFileField::thumbnailVersion;
+        }
+
+        std::optional<int64_t> parseNumber(std::string_view value) {
+            int64_t number = 0;
+            auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), number);
+            if (error != std::errc{} || end != value.data() + value.size()) return std::nullopt;
+            return number;
+        }
+
+        bool containsIgnoreCase(std::string_view haystack, std::string_view needle) {
+            if (needle.empty()) return true;
+            return !std::ranges::search(haystack, needle, [](char a, char b) {
+                        return Fields::toLower(a) == Fields::toLower(b);
+                    }).empty();
+        }
+
+        // Drive matches name contains against the start of the name or of one of its words only: 'Hello' finds
+        // "HelloWorld" and "Say hello", 'World' finds neither. Bytes beyond ASCII count as word characters, so a
+        // word never starts inside a UTF-8 sequence.
+        bool startsWordIgnoreCase(std::string_view haystack, std::string_view needle) {
+            if (needle.empty()) return true;
+            auto wordChar = [](char c) {
+                return static_cast<unsigned char>(c) >= 0x80 || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                       (c >= '0' && c <= '9');
+            };
+            for (size_t start = 0; start + needle.size() <= haystack.size(); ++start) {
+                if (start > 0 && wordChar(haystack[start - 1])) continue;
+                if (std::ranges::equal(haystack.substr(start, needle.size()), needle,
+                                       [](char a, char b) { return Fields::toLower(a) == Fields::toLower(b); })) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        template <typename T>
+        bool compare(Operator op, const T& value, const T& operand) {
+            switch (op) {
+                case Operator::Equal:
+                case Operator::In:
+                    return value == operand;
+                case Operator::NotEqual:
+                    return value != operand;
+                case Operator::GreaterThan:
+                    return value > operand;
+                case Operator::LessThan:
+                    return value < operand;
+                case Operator::GreaterThanOrEqual:
+                    return value >= operand;
+                case Operator::LessThanOrEqual:
+                    return value <= operand;
+                default:
+                    return false;
+            }
+        }
+
+        size_t wordCount(size_t bits) { return (bits + 63) / 64; }
+    }  // namespace
+
+    QueryEvaluator::QueryEvaluator(const QueryTree& tree) : _root(compileBlock(tree, 0)) {
+        if (_root.kind != Node::Kind::And) return;
+        for (const auto& child : _root.children) {
+            if (child.kind != Node::Kind::Predicate) continue;
+            const Predicate& predicate = child.predicate;
+            if (predicate.values.size() != 1) continue;
+            if (predicate.field->field == GFileField::parents && predicate.op == Operator::In) {
+                _requiredParent = predicate.values[0];
+            } else if (predicate.field->field == GFileField::name && predicate.op == Operator::Equal) {
+                _requiredName = predicate.values[0];
+            }
+        }
+    }
+
+    QueryEvaluator::Node QueryEvaluator::compileBlock(const QueryTree& tree, uint32_t index) {
+        const QueryNode& block = tree.node(index);
+        Node node{.kind = block.type == QueryNode::Type::And ? Node::Kind::And : Node::Kind::Or};
+        for (uint32_t child = block.firstChild; child != QueryNode::NONE; child = tree.node(child).nextSibling) {
+            const QueryNode& item = tree.node(child);
+            if (item.type == QueryNode::Type::Condition) {
+                node.children.push_back(Node{.kind = Node::Kind::Predicate, .predicate = compileCondition(tree, item)});
+                continue;
+            }
+            // Empty blocks are left out of the query string, so they must not take part here either
+            if (!item.liveChildren) continue;
+            node.children.push_back(compileBlock(tree, child));
+        }
+        return node;
+    }
+
+    QueryEvaluator::Predicate QueryEvaluator::compileCondition(const QueryTree& tree, const QueryNode& condition) {
+        std::string_view name = tree.field(condition);
+        const Fields::FieldInfo* field = Fields::findField(name);
+        if (!field) {
+            throw std::invalid_argument(
+                std::format("Condition on '{}' cannot be evaluated locally, it is not a member of GFile", name));
+        }
+        if (condition.parameter) {
+            throw std::invalid_argument(std::format("Condition on '{}' holds the unbound parameter '{}'", name,
+                                                    tree.operand(condition, 0)));
+        }
+        Predicate predicate{.field = field, .op = condition.op};
+        for (uint32_t i = 0; i < condition.operandCount; ++i) predicate.values.emplace_back(tree.operand(condition, i));
+        switch (field->kind) {
+            case Fields::Kind::Bool:
+                if (condition.op != Operator::Equal && condition.op != Operator::NotEqual) {
+                    throw std::invalid_argument(
+                        std::format("Operator '{}' does not apply to boolean field '{}'",
+                                    ComparisonOperatorToString(condition.op), field->name));
+                }
+                if (predicate.values.size() != 1 || (predicate.values[0] != "true" && predicate.values[0] != "false")) {
+                    throw std::invalid_argument(std::format("Field '{}' can only be compared to true or false",
+                                                            field->name));
+                }
+                predicate.boolean = predicate.values[0] == "true";
+                break;
+            case Fields::Kind::String:
+                predicate.numeric = isNumericField(field->field) && condition.op != Operator::Contains &&
+                                    condition.op != Operator::StartsWith && condition.op != Operator::EndsWith;
+                if (!predicate.numeric) break;
+                for (const auto& value : predicate.values) {
+                    auto number = parseNumber(value);
+                    if (!number) {
+                        throw std::invalid_argument(
+                            std::format("Field '{}' compares numbers, '{}' is not one", field->name, value));
+                    }
+                    predicate.numbers.push_back(*number);
+                }
+                break;
+            case Fields::Kind::StringList:
+                break;
+        }
+        return predicate;
+    }
+
+    bool QueryEvaluator::testString(const Predicate& predicate, Operator op, std::optional<std::string_view> value) {
+        if (!value) return op == Operator::NotEqual;
+        if (predicate.numeric) {
+            // A member that does not hold a number only differs from every operand
+            auto number = parseNumber(*value);
+            if (!number) return op == Operator::NotEqual;
+            return std::ranges::any_of(predicate.numbers,
+                                       [&](int64_t operand) { return compare(op, *number, operand); });
+        }
+        return std::ranges::any_of(predicate.values, [&](std::string_view operand) {
+            switch (op) {
+                case Operator::Contains:
+                    return predicate.field->field == GFileField::name ? startsWordIgnoreCase(*value, operand)
+                                                                      : containsIgnoreCase(*value, operand);
+                case Operator::StartsWith:
+                    return value->starts_with(operand);
+                case Operator::EndsWith:
+                    return value->ends_with(operand);
+                default:
+                    return compare(op, *value, operand);
+            }
+        });
+    }
+
+    bool QueryEvaluator::testBool(const Predicate& predicate, std::optional<bool> value) {
+        if (!value) return predicate.op == Operator::NotEqual;
+        return (*value == predicate.boolean) == (predicate.op == Operator::Equal);
+    }
+
+    template <typename Items>
+    bool QueryEvaluator::testList(const Predicate& predicate, bool present, const Items& items) {
+        if (!present) return predicate.op == Operator::NotEqual;
+        // A list equals a value when it holds it, and differs from it when it does not
+        bool negate = predicate.op == Operator::NotEqual;
+        Operator op = negate ? Operator::Equal : predicate.op;
+        bool found = std::ranges::any_of(items, [&](std::string_view item) { return testString(predicate, op, item); });
+        return found != negate;
+    }
+
+    template <typename Source>
+    bool QueryEvaluator::evaluate(const Node& node, const Source& source) {
+        switch (node.kind) {
+            case Node::Kind::And:
+                return std::ranges::all_of(node.children, [&](const Node& child) { return evaluate(child, source); });
+            case Node::Kind::Or:
+                return node.children.empty() || std::ranges::any_of(node.children, [&](const Node& child) {
+                           return evaluate(child, source);
+                       });
+            case Node::Kind::Predicate:
+                return testPredicate(node.predicate, source);
+        }
+        return false;
+    }
+
+    bool QueryEvaluator::testPredicate(const Predicate& predicate, const GFile& file) {
+        const Fields::FieldInfo& field = *predicate.field;
+        switch (field.kind) {
+            case Fields::Kind::String: {
+                const auto& value = file.*field.stringMember;
+                return testString(predicate, predicate.op,
+                                  value ? std::optional<std::string_view>(*value) : std::nullopt);
+            }
+            case Fields::Kind::Bool:
+                return testBool(predicate, file.*field.boolMember);
+            case Fields::Kind::StringList: {
+                const auto& list = file.*field.listMember;
+                static const std::vector<std::string> EMPTY;
+                return testList(predicate, list.has_value(), list ? *list : EMPTY);
+            }
+        }
+        return false;
+    }
+
+    bool QueryEvaluator::testPredicate(const Predicate& predicate, const GFileView& file) {
+        const Fields::FieldInfo& field = *predicate.field;
+        switch (field.kind) {
+            case Fields::Kind::String:
+                return testString(predicate, predicate.op, file.getString(field.field));
+            case Fields::Kind::Bool:
+                return testBool(predicate, file.getBool(field.field));
+            case Fields::Kind::StringList:
+                return testList(predicate, file.has(field.field), file.getList(field.field));
+        }
+        return false;
+    }
+
+    bool QueryEvaluator::matches(const GFile& file) const { return evaluate(_root, file); }
+
+    bool QueryEvaluator::matches(const GFileView& file) const { return evaluate(_root, file); }
+
+    std::vector<uint64_t> QueryEvaluator::filter(const GFileTable& table) const {
+        Bitmap all(wordCount(table.size()), ~uint64_t{0});
+        if (table.size() % 64) all.back() = (uint64_t{1} << (table.size() % 64)) - 1;
+        return evaluate(_root, table, all);
+    }
+
+    QueryEvaluator::Bitmap QueryEvaluator::evaluate(const Node& node, const GFileTable& table,
+                                                    const Bitmap& candidates) {
+        switch (node.kind) {
+            case Node::Kind::And: {
+                // Every condition only looks at the entries the previous ones left
+                Bitmap result = candidates;
+                for (const auto& child : node.children) {
+                    if (std::ranges::all_of(result, [](uint64_t word) { return word == 0; })) break;
+                    result = evaluate(child, table, result);
+                }
+                return result;
+            }
+            case Node::Kind::Or: {
+                if (node.children.empty()) return candidates;
+                // Entries one condition matched need not be tested by the next
+                Bitmap result(candidates.size(), 0);
+                Bitmap open = candidates;
+                for (const auto& child : node.children) {
+                    Bitmap matched = evaluate(child, table, open);
+                    for (size_t word = 0; word < result.size(); ++word) {
+                        result[word] |= matched[word];
+                        open[word] &= ~matched[word];
+                    }
+                }
+                return result;
+            }
+            case Node::Kind::Predicate:
+                return evaluate(node.predicate, table, candidates);
+        }
+        return Bitmap(candidates.size(), 0);
+    }
+
+    QueryEvaluator::Bitmap QueryEvaluator::evaluate(const Predicate& predicate, const GFileTable& table,
+                                                    const Bitmap& candidates) {
+        Bitmap result(candidates.size(), 0);
+        const Fields::FieldInfo& field = *predicate.field;
+        const uint64_t fieldBit = uint64_t{1} << static_cast<size_t>(field.field);
+        if (field.kind == Fields::Kind::Bool) {
+            // present, value and the expected value combine without a branch per entry
+            const uint64_t expected = predicate.boolean ? fieldBit : 0;
+            const bool equal = predicate.op == Operator::Equal;
+            for (size_t word = 0; word < candidates.size(); ++word) {
+                if (!candidates[word]) continue;
+                uint64_t bits = 0;
+                size_t base = word * 64;
+                size_t count = std::min<size_t>(64, table.size() - base);
+                for (size_t offset = 0; offset < count; ++offset) {
+                    const GFileTable::Record& record = table.record(base + offset);
+                    bool present = record.present & fieldBit;
+                    bool same = (record.values & fieldBit) == expected;
+                    bits |= uint64_t{present ? same == equal : !equal} << offset;
+                }
+                result[word] = bits & candidates[word];
+            }
+            return result;
+        }
+        for (size_t word = 0; word < candidates.size(); ++word) {
+            uint64_t remaining = candidates[word];
+            while (remaining) {
+                size_t offset = std::countr_zero(remaining);
+                remaining &= remaining - 1;
+                if (testPredicate(predicate, table[word * 64 + offset])) result[word] |= uint64_t{1} << offset;
+            }
+        }
+        return result;
+    }
+}  // namespace GDrive
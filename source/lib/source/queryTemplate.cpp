@@ -0,0 +1,128 @@
+#include "GDriveCpp/queryTemplate.h"
+
+#include <algorithm>
+#include <format>
+#include <stdexcept>
+
+#include "queryLogic.hpp"
+
+namespace GDrive {
+    QueryTemplate::QueryTemplate(std::string_view pattern) {
+        _text.reserve(pattern.size());
+        for (size_t i = 0; i < pattern.size(); ++i) {
+            char c = pattern[i];
+            if ((c == '{' || c == '}') && i + 1 < pattern.size() && pattern[i + 1] == c) {
+                _text += c;
+                ++i;
+                continue;
+            }
+            if (c == '}') {
+                throw std::invalid_argument(std::format("Unmatched '}}' at {} in query pattern '{}'", i, pattern));
+            }
+            if (c != '{') {
+                _text += c;
+                continue;
+            }
+            size_t end = pattern.find('}', i + 1);
+            if (end == std::string_view::npos) {
+                throw std::invalid_argument(
+                    std::format("Unterminated parameter at {} in query pattern '{}'", i, pattern));
+            }
+            if (end == i + 1) {
+                throw std::invalid_argument(std::format("Unnamed parameter at {} in query pattern '{}'", i, pattern));
+            }
+            addSlot(_text.size(), pattern.substr(i + 1, end - i - 1));
+            i = end;
+        }
+    }
+
+    void QueryTemplate::addSlot(size_t offset, std::string_view name) {
+        auto it = std::ranges::find(_names, name);
+        auto parameter = static_cast<size_t>(it - _names.begin());
+        if (it == _names.end()) {
+            _names.emplace_back(name);
+            _values.emplace_back();
+            _bound.push_back(false);
+        }
+        _slots.push_back(Slot{.offset = offset, .parameter = parameter});
+    }
+
+    size_t QueryTemplate::ParameterCount() const { return _names.size(); }
+
+    const std::string& QueryTemplate::ParameterName(size_t parameter) const {
+        if (parameter >= _names.size()) {
+            throw std::out_of_range(
+                std::format("Parameter {} does not exist, the template has {}", parameter, _names.size()));
+        }
+        return _names[parameter];
+    }
+
+    size_t QueryTemplate::ParameterIndex(std::string_view name) const {
+        auto it = std::ranges::find(_names, name);
+        if (it == _names.end()) throw std::out_of_range(std::format("Query template has no parameter '{}'", name));
+        return static_cast<size_t>(it - _names.begin());
+    }
+
+    QueryTemplate& QueryTemplate::Bind(std::string_view name, std::string_view value) {
+        return Bind(ParameterIndex(name), value);
+    }
+
+    QueryTemplate& QueryTemplate::Bind(size_t parameter, std::string_view value) {
+        if (parameter >= _names.size()) {
+            throw std::out_of_range(
+                std::format("Parameter {} does not exist, the template has {}", parameter, _names.size()));
+        }
+        // Keeps the capacity of the previous value, rebinding the same parameter rarely allocates
+        std::string& escaped = _values[parameter];
+        escaped.clear();
+        appendEscaped(escaped, value);
+        _bound[parameter] = true;
+        return *this;
+    }
+
+    std::string QueryTemplate::Build() const {
+        std::string query;
+        BuildInto(query);
+        return query;
+    }
+
+    void QueryTemplate::BuildInto(std::string& out) const {
+        size_t size = _text.size();
+        for (size_t i = 0; i < _names.size(); ++i) {
+            if (!_bound[i]) throw std::logic_error(std::format("Query parameter '{}' is not bound", _names[i]));
+        }
+        for (const auto& slot : _slots) size += _values[slot.parameter].size();
+        out.reserve(out.size() + size);
+        size_t copied = 0;
+        for (const auto& slot : _slots) {
+            out.append(_text, copied, slot.offset - copied);
+            out.append(_values[slot.parameter]);
+            copied = slot.offset;
+        }
+        out.append(_text, copied);
+    }
+
+    std::string QueryTemplate::Build(std::initializer_list<std::string_view> values) const {
+        std::string query;
+        BuildInto(query, values);
+        return query;
+    }
+
+    void QueryTemplate::BuildInto(std::string& out, std::initializer_list<std::string_view> values) const {
+        if (values.size() != _names.size()) {
+            throw std::invalid_argument(
+                std::format("Query template takes {} values, {} given", _names.size(), values.size()));
+        }
+        const std::string_view* value = values.begin();
+        size_t size = _text.size();
+        for (const auto& slot : _slots) size += escapedSize(value[slot.parameter]);
+        out.reserve(out.size() + size);
+        size_t copied = 0;
+        for (const auto& slot : _slots) {
+            out.append(_text, copied, slot.offset - copied);
+            appendEscaped(out, value[slot.parameter]);
+            copied = slot.offset;
+        }
+        out.append(_text, copied);
+    }
+}  // namespace GDrive
@@ -0,0 +1,332 @@
+#include "requestScheduler.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "logging.hpp"
+
+namespace GCloud::Http {
+    namespace {
+        // Drive reports exhausted quotas as 403 with one of these reasons
+        bool isRateLimitError(const cpr::Response& response) {
+            return response.status_code == 403 && (response.text.find("rateLimitExceeded") != std::string::npos ||
+                                                   response.text.find("RateLimitExceeded") != std::string::npos);
+        }
+
+        // Half the exponential ceiling plus a random share of the other half, so clients throttled together
+        // do not come back together
+        RequestScheduler::Clock::duration backoff(const RateLimitOptions& options, uint32_t attempt) {
+            thread_local std::mt19937_64 engine{std::random_device{}()};
+            auto ceiling = std::min<std::chrono::milliseconds>(
+                options.maxBackoff, options.initialBackoff * (int64_t{1} << std::min(attempt, 20u)));
+            std::uniform_int_distribution<int64_t> jitter(0, ceiling.count() / 2);
+            return ceiling - std::chrono::milliseconds(jitter(engine));
+        }
+    }  // namespace
+
+    FairShareBudget::FairShareBudget(double requestsPerSecond, uint32_t maxConcurrency)
+        : _requestsPerSecond(std::max(requestsPerSecond, 0.0)), _maxConcurrency(maxConcurrency) {}
+
+    std::shared_ptr<FairShareBudget::Member> FairShareBudget::join(double weight) {
+        if (!(weight > 0)) throw std::invalid_argument("Fair share weight must be positive");
+        auto member = std::make_shared<Member>(Member{.weight = weight});
+        std::lock_guard lock(_mutex);
+        std::erase_if(_members, [](const std::weak_ptr<Member>& other) { return other.expired(); });
+        _members.push_back(member);
+        return member;
+    }
+
+    double FairShareBudget::share(Member& member) {
+        // Recounting walks every member, it is done at most every tenth of the activity window
+        static constexpr Clock::duration RECOUNT_INTERVAL = ACTIVE_WINDOW / 10;
+        std::lock_guard lock(_mutex);
+        auto now = Clock::now();
+        if (now - _recounted >= RECOUNT_INTERVAL) {
+            _activeWeight = 0;
+            std::erase_if(_members, [&](const std::weak_ptr<Member>& weak) {
+                auto other = weak.lock();
+                if (!other) return true;
+                other->counted = now - other->lastActive < ACTIVE_WINDOW;
+                if (other->counted) _activeWeight += other->weight;
+                return false;
+            });
+            _recounted = now;
+        }
+        member.lastActive = now;
+        if (!member.counted) {
+            // Counted right away, a member waking up does not get the whole budget until the next recount
+            member.counted = true;
+            _activeWeight += member.weight;
+        }
+        return member.weight / _activeWeight;
+    }
+
+    double FairShareBudget::requestsPerSecond(Member& member) {
+        if (_requestsPerSecond == 0) return 0;
+        return _requestsPerSecond * share(member);
+    }
+
+    uint32_t FairShareBudget::concurrency(Member& member) {
+        if (_maxConcurrency == 0) return 0;
+        // Never starves a member, at the cost of the total when members outnumber the slots
+        return std::max<uint32_t>(1, static_cast<uint32_t>(_maxConcurrency * share(member)));
+    }
+
+    struct RequestScheduler::AsyncState {
+        std::weak_ptr<EventLoop> loop;
+        AsyncRequest request;
+        EventLoop::CompletionCallback onComplete;
+        EventLoop::FailureCallback onFailure;
+        uint32_t attempt = 0;
+        Clock::time_point started;
+        // The current attempt's slot has not been given back yet
+        bool holdsSlot = false;
+    };
+
+    RequestScheduler::RequestScheduler(const RateLimitOptions& options) : _options(options) {
+        _options.minConcurrency = std::max<uint32_t>(_options.minConcurrency, 1);
+        _options.maxConcurrency = std::max(_options.maxConcurrency, _options.minConcurrency);
+        _options.burst = std::max<uint32_t>(_options.burst, 1);
+        _limit = std::clamp(_options.initialConcurrency, _options.minConcurrency, _options.maxConcurrency);
+        _tokens = _options.burst;
+        _refilled = Clock::now();
+    }
+
+    RequestScheduler::RequestScheduler(const RateLimitOptions& options, std::shared_ptr<FairShareBudget> budget,
+                                       double weight)
+        : RequestScheduler(options) {
+        if (budget) {
+            _member = budget->join(weight);
+            _budget = std::move(budget);
+        }
+    }
+
+    uint32_t RequestScheduler::getConcurrencyLimit() const {
+        std::lock_guard lock(_mutex);
+        return limit();
+    }
+
+    uint32_t RequestScheduler::limit() const {
+        auto own = static_cast<uint32_t>(_limit);
+        if (!_budget) return own;
+        uint32_t share = _budget->concurrency(*_member);
+        return share == 0 ? own : std::min(own, share);
+    }
+
+    RequestScheduler::Clock::duration RequestScheduler::reserveToken() {
+        std::lock_guard lock(_mutex);
+        auto now = Clock::now();
+        Clock::duration wait{0};
+        double rate = _options.requestsPerSecond;
+        if (_budget) {
+            double share = _budget->requestsPerSecond(*_member);
+            if (share > 0) rate = rate > 0 ? std::min(rate, share) : share;
+        }
+        if (rate > 0) {
+            // A share smaller than the burst would let every client of the budget burst at once
+            double burst = _budget ? std::clamp<double>(rate, 1, _options.burst) : _options.burst;
+            double elapsed = std::chrono::duration<double>(now - _refilled).count();
+            _tokens = std::min(burst, _tokens + elapsed * rate);
+            _refilled = now;
+            // The balance may go negative, later callers then queue up behind the tokens already promised
+            _tokens -= 1;
+            if (_tokens < 0) {
+                wait = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(-_tokens / rate));
+            }
+        }
+        if (_pausedUntil > now) wait = std::max(wait, _pausedUntil - now);
+        return wait;
+    }
+
+    void RequestScheduler::acquireSlot() {
+        std::unique_lock lock(_mutex);
+        _slotFreed.wait(lock, [this] { return _inFlight < limit(); });
+        ++_inFlight;
+    }
+
+    void RequestScheduler::releaseSlot() {
+        std::vector<std::shared_ptr<AsyncState>> ready;
+        bool free = false;
+        {
+            std::lock_guard lock(_mutex);
+            --_inFlight;
+            while (!_waiting.empty() && _inFlight < limit()) {
+                ++_inFlight;
+                ready.push_back(std::move(_waiting.front()));
+                _waiting.pop_front();
+            }
+            // A raised limit may leave slots for blocked callers after the waiting requests took theirs
+            free = _inFlight < limit();
+        }
+        if (free) _slotFreed.notify_all();
+        for (auto& state : ready) start(std::move(state));
+    }
+
+    std::optional<RequestScheduler::Clock::duration> RequestScheduler::finish(const cpr::Response& response,
+                                                                              Clock::time_point started,
+                                                                              uint32_t attempt, bool idempotent) {
+        const long status = response.status_code;
+        // 0 means the transfer itself failed (connection reset, timeout, ...)
+        const bool throttled = status == 429 || isRateLimitError(response);
+        const bool failed = status == 0 || status >= 500;
+        std::optional<std::chrono::seconds> retryAfter;
+        if (auto it = response.header.find("Retry-After"); it != response.header.end()) {
+            retryAfter = parseRetryAfter(it->second, std::chrono::system_clock::now());
+        }
+        {
+            std::lock_guard lock(_mutex);
+            auto now = Clock::now();
+            if (throttled || failed) {
+                // One cut per round: the other requests in flight saw the same overload
+                if (started >= _lastDecrease) {
+                    _limit = std::max<double>(_options.minConcurrency, _limit / 2);
+                    _lastDecrease = now;
+                }
+            } else if (status < 400) {
+                _limit = std::min<double>(_options.maxConcurrency, _limit + 1 / _limit);
+            }
+            if (retryAfter) _pausedUntil = std::max(_pausedUntil, now + *retryAfter);
+        }
+        releaseSlot();
+
+        if (!(throttled || failed || status == 408) || !idempotent || attempt >= _options.maxRetries) {
+            return std::nullopt;
+        }
+        Clock::duration delay = backoff(_options, attempt);
+        if (retryAfter) delay = std::max<Clock::duration>(delay, *retryAfter);
+        spdlog::warn("Retrying {} in {} ms ({} - {})", response.url.str(),
+                     std::chrono::duration_cast<std::chrono::milliseconds>(delay).count(), status,
+                     status ? response.reason : response.error.message);
+        return delay;
+    }
+
+    cpr::Response RequestScheduler::execute(const Attempt& attempt, bool idempotent) {
+        for (uint32_t tries = 0;; ++tries) {
+            std::this_thread::sleep_for(reserveToken());
+            acquireSlot();
+            auto started = Clock::now();
+            cpr::Response response;
+            try {
+                response = attempt();
+            } catch (...) {
+                releaseSlot();
+                throw;
+            }
+            auto delay = finish(response, started, tries, idempotent);
+            if (!delay) return response;
+            std::this_thread::sleep_for(*delay);
+        }
+    }
+
+    void RequestScheduler::submit(std::shared_ptr<EventLoop> loop, AsyncRequest request,
+                                  EventLoop::CompletionCallback onComplete, EventLoop::FailureCallback onFailure) {
+        auto state = std::make_shared<AsyncState>();
+        state->loop = loop;
+        state->request = std::move(request);
+        state->onComplete = std::move(onComplete);
+        state->onFailure = std::move(onFailure);
+        schedule(std::move(state), Clock::duration{0});
+    }
+
+    void RequestScheduler::schedule(std::shared_ptr<AsyncState> state, Clock::duration delay) {
+        delay = std::max(delay, reserveToken());
+        if (delay <= Clock::duration{0}) {
+            startWhenFree(std::move(state));
+            return;
+        }
+        auto loop = state->loop.lock();
+        if (!loop) throw std::runtime_error("Request event loop stopped");
+        auto onFailure = state->onFailure;
+        loop->schedule(
+            delay, [self = shared_from_this(), state = std::move(state)] { self->startWhenFree(state); },
+            std::move(onFailure));
+    }
+
+    void RequestScheduler::startWhenFree(std::shared_ptr<AsyncState> state) {
+        {
+            std::lock_guard lock(_mutex);
+            if (!_waiting.empty() || _inFlight >= limit()) {
+                _waiting.push_back(std::move(state));
+                return;
+            }
+            ++_inFlight;
+        }
+        start(std::move(state));
+    }
+
+    void RequestScheduler::start(std::shared_ptr<AsyncState> state) {
+        auto self = shared_from_this();
+        state->holdsSlot = true;
+        auto onFailure = [self, state](std::exception_ptr error) {
+            if (state->holdsSlot) {
+                state->holdsSlot = false;
+                self->releaseSlot();
+            }
+            if (state->onFailure) state->onFailure(error);
+        };
+        try {
+            auto loop = state->loop.lock();
+            if (!loop) throw std::runtime_error("Request event loop stopped");
+            if (loop->isLoopThread() && state->request.mayBlock && state->request.mayBlock()) {
+                std::thread([self, state] { self->start(state); }).detach();
+                return;
+            }
+            auto session = state->request.makeSession();
+            state->started = Clock::now();
+            auto onComplete = [self, state](cpr::Response response) {
+                state->holdsSlot = false;
+                if (state->request.completeDownload) state->request.completeDownload(response);
+                auto delay = self->finish(response, state->started, state->attempt, state->request.idempotent);
+                if (!delay) {
+                    if (state->onComplete) state->onComplete(std::move(response));
+                    return;
+                }
+                ++state->attempt;
+                self->schedule(state, *delay);
+            };
+            if (state->request.method == Method::Download) {
+                auto write = state->request.openDownload(*session);
+                loop->submitDownload(std::move(session), std::move(write), std::move(onComplete), onFailure);
+            } else {
+                loop->submit(std::move(session), state->request.method, std::move(onComplete), onFailure);
+            }
+        } catch (...) {
+            onFailure(std::current_exception());
+        }
+    }
+
+    std::optional<std::chrono::seconds> parseRetryAfter(std::string_view value,
+                                                        std::chrono::system_clock::time_point now) {
+        while (!value.empty() && value.front() == ' ') value.remove_prefix(1);
+        while (!value.empty() && value.back() == ' ') value.remove_suffix(1);
+        auto number = [&value](size_t offset, size_t length) -> std::optional<int> {
+            if (offset + length > value.size()) return std::nullopt;
+            int result = 0;
+            auto [end, error] = std::from_chars(value.data() + offset, value.data() + offset + length, result);
+            if (error != std::errc{} || end != value.data() + offset + length) return std::nullopt;
+            return result;
+        };
+        if (auto seconds = number(0, value.size())) return std::chrono::seconds(std::max(*seconds, 0));
+
+        // IMF-fixdate, the only date format senders may use: "Sun, 06 Nov 1994 08:49:37 GMT"
+        static constexpr std::string_view MONTHS = "JanFebMarAprMayJunJulAugSepOctNovDec";
+        if (value.size() != 29 || !value.ends_with(" GMT")) return std::nullopt;
+        size_t month = MONTHS.find(value.substr(8, 3));
+        auto day = number(5, 2), year = number(12, 4);
+        auto hour = number(17, 2), minute = number(20, 2), second = number(23, 2);
+        if (month == std::string_view::npos || month % 3 || !day || !year || !hour || !minute || !second) {
+            return std::nullopt;
+        }
+        std::chrono::year_month_day date{std::chrono::year{*year},
+                                         std::chrono::month{static_cast<unsigned>(month / 3 + 1)},
+                                         std::chrono::day{static_cast<unsigned>(*day)}};
+        if (!date.ok()) return std::nullopt;
+        auto when = std::chrono::sys_days{date} + std::chrono::hours{*hour} + std::chrono::minutes{*minute} +
+                    std::chrono::seconds{*second};
+        return std::max(std::chrono::ceil<std::chrono::seconds>(when - now), std::chrono::seconds{0});
+    }
+}  // namespace GCloud::Http
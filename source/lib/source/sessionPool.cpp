@@ -0,0 +1,81 @@
+#include "sessionPool.hpp"
+
+#include <charconv>
+#include <stdexcept>
+
+namespace GCloud::Http {
+    SessionPool::SessionPool(const ConnectionPoolOptions& options) : _options(options) {
+        _share = curl_share_init();
+        if (!_share) {
+            throw std::runtime_error("Failed to create shared connection cache");
+        }
+        curl_share_setopt(_share, CURLSHOPT_LOCKFUNC, &SessionPool::lockShare);
+        curl_share_setopt(_share, CURLSHOPT_UNLOCKFUNC, &SessionPool::unlockShare);
+        curl_share_setopt(_share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+        curl_share_setopt(_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+
+    SessionPool::~SessionPool() {
+        if (_share) curl_share_cleanup(_share);
+    }
+
+    std::shared_ptr<cpr::Session> SessionPool::makeSession() {
+        auto session = std::make_shared<cpr::Session>();
+        session->SetVerifySsl(cpr::VerifySsl(0));
+        if (_options.http2) {
+            session->SetHttpVersion(cpr::HttpVersion{cpr::HttpVersionCode::VERSION_2_0_TLS});
+        }
+
+        CURL* handle = session->GetCurlHolder()->handle;
+        curl_easy_setopt(handle, CURLOPT_SHARE, _share);
+        curl_easy_setopt(handle, CURLOPT_MAXAGE_CONN, static_cast<long>(_options.idleTimeout.count()));
+        curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(handle, CURLOPT_TCP_KEEPIDLE, 30L);
+        curl_easy_setopt(handle, CURLOPT_TCP_KEEPINTVL, 15L);
+        // Prefer waiting for an existing HTTP/2 connection over opening a new one
+        curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+        return session;
+    }
+
+    long ResponseHeaders::add(std::string_view line) {
+        while (!line.empty() && (line.back() == '\r' || line.back() == '\n')) line.remove_suffix(1);
+        if (line.starts_with("HTTP/")) {
+            // HTTP/1.1 403 Forbidden, HTTP/2 has no reason
+            size_t space = line.find(' ');
+            long statusCode = 0;
+            if (space == std::string_view::npos || line.size() < space + 4) return 0;
+            if (std::from_chars(line.data() + space + 1, line.data() + space + 4, statusCode).ec != std::errc{}) {
+                return 0;
+            }
+            _statusCode = statusCode;
+            _reason = line.size() > space + 5 ? std::string(line.substr(space + 5)) : std::string();
+            _header.clear();
+            return statusCode;
+        }
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos) return 0;
+        std::string_view value = line.substr(colon + 1);
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+        while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+        _header[std::string(line.substr(0, colon))] = std::string(value);
+        return 0;
+    }
+
+    void ResponseHeaders::applyTo(cpr::Response& response) const {
+        response.reason = _reason;
+        response.header = _header;
+    }
+
+    void SessionPool::lockShare(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr) {
+        (void)handle;
+        (void)access;
+        static_cast<SessionPool*>(userptr)->_shareLocks[data].lock();
+    }
+
+    void SessionPool::unlockShare(CURL* handle, curl_lock_data data, void* userptr) {
+        (void)handle;
+        static_cast<SessionPool*>(userptr)->_shareLocks[data].unlock();
+    }
+}  // namespace GCloud::Http
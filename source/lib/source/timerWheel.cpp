@@ -0,0 +1,92 @@
+#include "timerWheel.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "logging.hpp"
+
+namespace GCloud::Http {
+    TimerWheel::TimerWheel(Clock::duration tick, size_t slots)
+        : _tick(tick), _start(Clock::now()), _slots(std::max<size_t>(slots, 1)) {
+        if (_tick <= Clock::duration{0}) {
+            throw std::invalid_argument("Timer wheel tick must be positive");
+        }
+        _thread = std::jthread([this](std::stop_token stop) { run(stop); });
+    }
+
+    TimerWheel::~TimerWheel() { stop(); }
+
+    void TimerWheel::stop() {
+        if (!_thread.joinable()) return;
+        _thread.request_stop();
+        if (_thread.get_id() == std::this_thread::get_id()) {
+            throw std::logic_error("Timer wheel cannot be stopped from one of its callbacks");
+        }
+        _thread.join();
+    }
+
+    uint64_t TimerWheel::tickOf(Clock::time_point time) const {
+        if (time <= _start) return 0;
+        // Rounded up, a timer never fires before it is due
+        return static_cast<uint64_t>((time - _start + _tick - Clock::duration{1}) / _tick);
+    }
+
+    uint64_t TimerWheel::schedule(Clock::time_point due, Callback callback) {
+        std::lock_guard lock(_mutex);
+        uint64_t tick = std::max(tickOf(due), _current + 1);
+        uint64_t id = _nextId++;
+        size_t slot = tick % _slots.size();
+        _slots[slot].push_back(Entry{.id = id, .tick = tick, .callback = std::move(callback)});
+        _pending.emplace(id, slot);
+        return id;
+    }
+
+    bool TimerWheel::cancel(uint64_t id) {
+        std::lock_guard lock(_mutex);
+        auto it = _pending.find(id);
+        if (it == _pending.end()) return false;
+        auto& slot = _slots[it->second];
+        std::erase_if(slot, [id](const Entry& entry) { return entry.id == id; });
+        _pending.erase(it);
+        return true;
+    }
+
+    size_t TimerWheel::size() const {
+        std::lock_guard lock(_mutex);
+        return _pending.size();
+    }
+
+    void TimerWheel::run(std::stop_token stop) {
+        std::unique_lock lock(_mutex);
+        while (!stop.stop_requested()) {
+            _wake.wait_until(lock, stop, _start + _tick * (_current + 1), [] { return false; });
+            if (stop.stop_requested()) break;
+            uint64_t now = static_cast<uint64_t>((Clock::now() - _start) / _tick);
+            if (now <= _current) continue;
+            // After a long stall one revolution visits every slot, there is no point in going round again
+            uint64_t first = std::max(_current + 1, now >= _slots.size() ? now - _slots.size() + 1 : 0);
+            std::vector<Entry> due;
+            for (uint64_t tick = first; tick <= now; ++tick) {
+                auto& slot = _slots[tick % _slots.size()];
+                auto later = std::partition(slot.begin(), slot.end(), [now](const Entry& entry) {
+                    return entry.tick > now;
+                });
+                for (auto it = later; it != slot.end(); ++it) {
+                    _pending.erase(it->id);
+                    due.push_back(std::move(*it));
+                }
+                slot.erase(later, slot.end());
+            }
+            _current = now;
+            lock.unlock();
+            for (auto& entry : due) {
+                try {
+                    entry.callback();
+                } catch (const std::exception& e) {
+                    spdlog::warn("Timer callback failed: {}", e.what());
+                }
+            }
+            lock.lock();
+        }
+    }
+}  // namespace GCloud::Http
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "GDriveCpp/dllExport.h"
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4251)
+#endif
+
+namespace utils::io {
+    class LockFile;
+}  // namespace utils::io
+
+namespace GDrive {
+    class GFile;
+
+    struct BlobCacheOptions {
+        // Empty for GDriveCpp/blobs in the local cache directory
+        std::filesystem::path directory;
+        // Least recently used blobs are evicted beyond this size
+        uint64_t maxBytes = 4ull * 1024 * 1024 * 1024;
+        // Hits become hard links to the cached blob. Fastest, but writing to a downloaded file in place then
+        // changes the blob too, which is caught and dropped on the next lookup. Otherwise hits are cloned where
+        // the filesystem supports it and copied where it does not.
+        bool hardlinks = false;
+    };
+
+    // Content of downloaded files kept on local disk, addressed by file ID and content version: md5Checksum,
+    // or headRevisionId for files without one. GFile::download serves an unchanged file from here without
+    // touching the network. The index of the blobs is saved next to them. Processes may share a directory:
+    // stores and index updates take a lock file there, and each store first picks up the blobs the other
+    // processes stored or evicted, so maxBytes bounds the directory as a whole.
+    class GDRIVE_API BlobCache {
+      public:
+        explicit BlobCache(const BlobCacheOptions& options = {});
+        ~BlobCache();
+
+        BlobCache(const BlobCache&) = delete;
+        BlobCache& operator=(const BlobCache&) = delete;
+
+        // Places the cached content of file at target, replacing what is there. False on a miss, or for files
+        // whose metadata has neither md5Checksum nor headRevisionId.
+        bool fetch(const GFile& file, const std::filesystem::path& target);
+        // Adds source, the freshly downloaded content of file
+        void store(const GFile& file, const std::filesystem::path& source);
+        bool contains(const GFile& file) const;
+        void clear();
+        // Bytes held
+        uint64_t size() const;
+
+        const std::filesystem::path& getDirectory() const { return _directory; }
+
+      private:
+        struct Entry {
+            uint64_t size;
+            // Write time of the blob when it was stored, a different one means it was changed through a link
+            int64_t modified;
+            std::list<std::string>::iterator recency;
+        };
+
+        static std::optional<std::string> blobName(const GFile& file);
+        // Hard link, clone or copy, in the order the options allow
+        void place(const std::filesystem::path& from, const std::filesystem::path& to) const;
+        std::filesystem::path temporaryPath(const std::string_view& name) const;
+        // The following require _directoryMutex, _directoryLock and _mutex
+        void load();
+        // Adopts the entries other processes added to the saved index and forgets blobs that are gone
+        void sync();
+        void add(const std::string& name, uint64_t size, int64_t modified);
+        void forget(const std::string& name);
+        void drop(const std::string& name);
+        void evict();
+        void save() const;
+
+        BlobCacheOptions _options;
+        std::filesystem::path _directory;
+        // Held across processes by stores and index updates; _directoryMutex keeps the threads of this one apart
+        std::mutex _directoryMutex;
+        std::unique_ptr<utils::io::LockFile> _directoryLock;
+        mutable std::mutex _mutex;
+        std::unordered_map<std::string, Entry> _entries;
+        // Blob names, most recently used first
+        std::list<std::string> _recency;
+        uint64_t _size = 0;
+    };
+}  // namespace GDrive
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "GDriveCpp/gDrive.h"
+#include "GDriveCpp/gFile.h"
+#include "GDriveCpp/metadataIndex.h"
+#include "GDriveCpp/pathCache.h"
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4251)
+#endif
+
+namespace GDrive {
+    struct GFileChange {
+        std::string fileId;
+        std::string time;
+        // The file was deleted or the user lost access to it; file is empty then
+        bool removed = false;
+        std::shared_ptr<GFile> file;
+    };
+
+    struct ChangeTrackerOptions {
+        // Shared drive to follow; empty follows the user's corpus
+        std::string driveId;
+        uint32_t pageSize = 1000;
+        // Members fetched for changed files; id, parents, mimeType and trashed are always added
+        GFileFieldMask fields{GFileField::id,      GFileField::name,         GFileField::mimeType,
+                              GFileField::parents, GFileField::modifiedTime, GFileField::size,
+                              GFileField::trashed, GFileField::md5Checksum};
+        // Keep the page token in the client cache directory so the next run continues where this one stopped
+        bool persistToken = true;
+        // Updated with every change: changed files are stored, removed and trashed ones dropped
+        std::shared_ptr<MetadataIndex> index;
+        // Folders that changed are invalidated, since they may have been renamed, moved or trashed
+        std::shared_ptr<PathCache> pathCache;
+    };
+
+    // Follows the Drive changes feed. Each poll returns only what changed since the previous one, so keeping a
+    // local copy in sync costs O(changed files) instead of a full listing.
+    class GDRIVE_API ChangeTracker {
+      public:
+        using ChangeCallback = std::function<void(const GFileChange&)>;
+
+        explicit ChangeTracker(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                               ChangeTrackerOptions options = {});
+
+        // Restores the persisted page token, or requests a new start token when there is none. Returns true
+        // when a persisted token was found, i.e. the next poll returns the changes made since the last run.
+        bool initialize();
+        // Fetches every page of changes since the last poll, applies them to the index and path cache and
+        // passes them to the callback in feed order. The token is only advanced after all pages were applied.
+        void poll(const ChangeCallback& onChange);
+        std::vector<GFileChange> poll();
+        // Forgets the token, including the persisted one; the next initialize() starts from now
+        void reset();
+
+        const std::string& getPageToken() const { return _pageToken; }
+
+      private:
+        std::string fetchStartPageToken(GCloud::Authentication::OAuthAgent& agent) const;
+        void apply(const GFileChange& change) const;
+
+        std::weak_ptr<GCloud::Authentication::OAuthAgent> _client;
+        ChangeTrackerOptions _options;
+        std::string _pageToken;
+    };
+}  // namespace GDrive
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
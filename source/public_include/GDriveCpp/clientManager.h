@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "GDriveCpp/dllExport.h"
+#include "GDriveCpp/gDrive.h"
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4251)
+#endif
+
+namespace GCloud::Http {
+    class FairShareBudget;
+    class TimerWheel;
+}  // namespace GCloud::Http
+
+namespace GCloud::Authentication {
+    struct ClientManagerOptions {
+        // Options of every client. Their connectionPool configures the one pool all of them share, their
+        // rateLimit bounds each client on its own.
+        OAuthAgentOptions client;
+        // Budget shared by all clients, split between those sending requests in proportion to their weight.
+        // Zero leaves it unlimited. Every client sending requests keeps at least one in flight, so more of them
+        // than totalConcurrency go beyond it by one request each.
+        double totalRequestsPerSecond = 200;
+        uint32_t totalConcurrency = 128;
+        // Resolution and size of the timer wheel refreshing the tokens of every client
+        std::chrono::milliseconds refreshTick{1000};
+        uint32_t refreshSlots = 4096;
+    };
+
+    // Owns the OAuthAgents of many tenants and the resources they have in common: one connection pool, one event
+    // loop and one thread refreshing tokens ahead of their expiration, so that more tenants do not mean more
+    // threads and sockets. Requests of all tenants draw from one fair-share budget.
+    //
+    // Clients handed out stay usable after they are removed or the manager is gone; their tokens are then only
+    // refreshed on demand.
+    class GDRIVE_API ClientManager {
+      public:
+        explicit ClientManager(const ClientManagerOptions& options = {});
+        ~ClientManager();
+
+        ClientManager(const ClientManager&) = delete;
+        ClientManager& operator=(const ClientManager&) = delete;
+
+        // Throws std::invalid_argument when tenant is already registered or weight is not positive
+        std::shared_ptr<OAuthAgent> addClient(const std::string_view& tenant, std::string clientId,
+                                              std::string clientSecret, double weight = 1);
+        // Null for an unknown tenant
+        std::shared_ptr<OAuthAgent> getClient(const std::string_view& tenant) const;
+        bool removeClient(const std::string_view& tenant);
+        size_t getClientCount() const;
+
+        std::shared_ptr<Http::SessionPool> getSessionPool() const { return _sessionPool; }
+
+        std::shared_ptr<Http::EventLoop> getEventLoop() const { return _eventLoop; }
+
+      private:
+        struct Tenant;
+
+        // Puts the next refresh of tenant on the wheel, replacing the one pending
+        static void scheduleRefresh(const std::shared_ptr<Http::TimerWheel>& wheel,
+                                    const std::weak_ptr<Tenant>& tenant,
+                                    const std::shared_ptr<const AccessToken>& token, std::chrono::seconds backoff);
+
+        ClientManagerOptions _options;
+        std::shared_ptr<Http::SessionPool> _sessionPool;
+        std::shared_ptr<Http::EventLoop> _eventLoop;
+        std::shared_ptr<Http::FairShareBudget> _budget;
+        std::shared_ptr<Http::TimerWheel> _refreshWheel;
+        mutable std::mutex _mutex;
+        std::map<std::string, std::shared_ptr<Tenant>, std::less<>> _tenants;
+    };
+}  // namespace GCloud::Authentication
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "GDriveCpp/gDrive.h"
+#include "GDriveCpp/gFile.h"
+#include "GDriveCpp/metadataIndex.h"
+#include "GDriveCpp/queryTemplate.h"
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4251)
+#endif
+
+namespace GDrive {
+    struct CrawlerOptions {
+        // Upper bound of files.list requests in flight, one per worker thread
+        uint32_t maxConcurrentRequests = 8;
+        uint32_t pageSize = 1000;
+        // Members fetched for every entry; id and mimeType are always added since the crawl needs them
+        GFileFieldMask fields{GFileField::id,      GFileField::name, GFileField::mimeType,
+                              GFileField::parents, GFileField::size, GFileField::modifiedTime};
+        bool includeTrashed = false;
+        // Files buffered for next() before the workers wait for the consumer
+        size_t queueCapacity = 10000;
+        // Discovered files are stored here and every folder crawled to its last page is marked as listed
+        std::shared_ptr<MetadataIndex> index;
+    };
+
+    struct CrawlerStats {
+        uint64_t inFlightRequests = 0;
+        uint64_t completedRequests = 0;
+        uint64_t failedRequests = 0;
+        // Folder pages waiting to be requested
+        uint64_t queuedTasks = 0;
+        uint64_t discoveredFiles = 0;
+        uint64_t discoveredFolders = 0;
+        // Tasks taken from another worker's queue
+        uint64_t steals = 0;
+    };
+
+    // Lists the whole tree below a folder. Every worker owns a queue of (folder, page token) tasks, takes the
+    // oldest one so the tree is explored breadth first, and steals the newest task of another worker when it
+    // runs dry; a worker paging through a huge folder thereby hands its subfolders to idle workers.
+    class GDRIVE_API DirectoryCrawler {
+      public:
+        // Called concurrently from the worker threads, folders included. Must not throw.
+        using FileCallback = std::function<void(std::shared_ptr<GFile>)>;
+        using ErrorCallback = std::function<void(const std::string& folderId, std::exception_ptr error)>;
+
+        explicit DirectoryCrawler(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                                  CrawlerOptions options = {});
+        ~DirectoryCrawler();
+
+        DirectoryCrawler(const DirectoryCrawler&) = delete;
+        DirectoryCrawler& operator=(const DirectoryCrawler&) = delete;
+
+        // Streams every entry to onFile. Failed pages are reported to onError and their folder is skipped.
+        void start(const std::string& rootFolderId, FileCallback onFile, ErrorCallback onError = {});
+        // Queue mode: entries are fetched with next()
+        void start(const std::string& rootFolderId);
+
+        // Next entry in queue mode; std::nullopt once the crawl finished and everything was consumed
+        std::optional<std::shared_ptr<GFile>> next();
+        // Blocks until every folder was listed or the crawl was cancelled
+        void wait();
+        void cancel();
+
+        bool isFinished() const;
+        CrawlerStats getStats() const;
+
+      private:
+        struct Task {
+            std::string folderId;
+            std::string pageToken;
+        };
+
+        struct Worker {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        void launch(const std::string& rootFolderId);
+        void run(size_t index);
+        std::optional<Task> take(size_t index);
+        void push(size_t index, Task&& task, bool front);
+        void process(size_t index, const Task& task);
+        void deliver(std::shared_ptr<GFile> file);
+        void finishTask();
+        GFileListRequest makeRequest(const Task& task) const;
+
+        std::weak_ptr<GCloud::Authentication::OAuthAgent> _client;
+        CrawlerOptions _options;
+        // Shared by the workers, which only build it with their folder's ID
+        QueryTemplate _query;
+        FileCallback _onFile;
+        ErrorCallback _onError;
+
+        std::vector<std::unique_ptr<Worker>> _workers;
+        std::vector<std::jthread> _threads;
+        std::mutex _idleMutex;
+        std::condition_variable _idle;
+        // Tasks queued or being processed; the crawl is finished when it drops to zero
+        std::atomic<uint64_t> _pending{0};
+        std::atomic<uint64_t> _queued{0};
+        std::atomic<bool> _cancelled{false};
+
+        std::mutex _queueMutex;
+        std::condition_variable _queueReadable;
+        std::condition_variable _queueWritable;
+        std::deque<std::shared_ptr<GFile>> _queue;
+
+        std::atomic<uint64_t> _inFlight{0};
+        std::atomic<uint64_t> _completed{0};
+        std::atomic<uint64_t> _failed{0};
+        std::atomic<uint64_t> _files{0};
+        std::atomic<uint64_t> _folders{0};
+        std::atomic<uint64_t> _steals{0};
+    };
+}  // namespace GDrive
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
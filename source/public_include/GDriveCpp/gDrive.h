@@ -1,10 +1,16 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
 #include <future>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 
 #include "GDriveCpp/dllExport.h"
 
@@ -13,22 +19,127 @@
 #pragma warning(disable : 4251)
 #endif
 
+namespace GCloud::Http {
+    struct ConnectionPoolOptions {
+        // Upper bound of connections the event loop opens to one host at a time. How many idle connections the
+        // shared cache keeps alive is up to libcurl, idleTimeout retires them.
+        uint32_t maxConnections = 8;
+        // Cached connections idle for longer than this are not reused
+        std::chrono::seconds idleTimeout{60};
+        // Negotiate HTTP/2 over TLS and multiplex requests when possible
+        bool http2 = true;
+    };
+
+    struct BatchOptions {
+        // How long the first queued request waits for others to join its batch
+        std::chrono::milliseconds window{10};
+        // Drive accepts at most 100 calls per batch
+        uint32_t maxBatchSize = 100;
+    };
+
+    struct RateLimitOptions {
+        // Sustained requests per second of one client and the burst allowed on top; 0 disables the limit
+        double requestsPerSecond = 50;
+        uint32_t burst = 50;
+        // Requests in flight start at initialConcurrency. The limit grows by one per round of successful
+        // requests and halves when Drive throttles or fails, staying within [minConcurrency, maxConcurrency].
+        uint32_t initialConcurrency = 8;
+        uint32_t minConcurrency = 1;
+        uint32_t maxConcurrency = 64;
+        // Idempotent requests failing with 429, 5xx or a transport error are tried again after a jittered
+        // exponential backoff, or after the Retry-After the server sent
+        uint32_t maxRetries = 6;
+        std::chrono::milliseconds initialBackoff{250};
+        std::chrono::milliseconds maxBackoff{32000};
+    };
+
+    class SessionPool;
+    class EventLoop;
+    class BatchScheduler;
+    class RequestScheduler;
+}  // namespace GCloud::Http
+
+namespace GCloud::Cache {
+    class SharedTokenSlot;
+}  // namespace GCloud::Cache
+
 namespace GCloud::Authentication {
+    struct OAuthAgentOptions {
+        Http::ConnectionPoolOptions connectionPool;
+        Http::BatchOptions batch;
+        Http::RateLimitOptions rateLimit;
+        // Access tokens are refreshed in the background this long before they expire, so requests never wait
+        // for the token endpoint. Zero refreshes on demand only.
+        std::chrono::seconds tokenRefreshMargin{300};
+    };
+
+    struct AccessToken {
+        std::string value;
+        std::chrono::system_clock::time_point expiration;
+    };
+
+    class ClientManager;
+
+    // Safe to share between threads. The current access token is an immutable snapshot read without locking;
+    // refreshing it is single flight, callers finding it stale wait for the one refresh in progress.
     class GDRIVE_API OAuthAgent {
       private:
         std::string _clientId;
         std::string _clientSecret;
         std::string _code;
-        std::string _accessToken;
+        // Guarded by _refreshMutex, like every write of _token
         std::string _refreshToken;
-        std::chrono::system_clock::time_point _expirationTime;
+        std::atomic<std::shared_ptr<const AccessToken>> _token;
+        std::mutex _refreshMutex;
+        // Token published to the other processes of this client, null when the slot could not be opened
+        std::shared_ptr<Cache::SharedTokenSlot> _sharedToken;
+        OAuthAgentOptions _options;
+        std::shared_ptr<Http::SessionPool> _sessionPool;
+        std::shared_ptr<Http::EventLoop> _eventLoop;
+        std::shared_ptr<Http::BatchScheduler> _batchScheduler;
+        std::shared_ptr<Http::RequestScheduler> _requestScheduler;
+        std::mutex _lazyResourceMutex;
+        // Set by a ClientManager, whose timer wheel then takes over from _refresher. Called with every new token.
+        std::function<void(const std::shared_ptr<const AccessToken>&)> _onRefreshed;
+        std::mutex _refresherMutex;
+        // Notified with every new token, which the refresher waits for when it has no refresh token to use
+        std::condition_variable_any _refresherWake;
+        // Declared last so that it stops before the state it uses goes away
+        std::jthread _refresher;
         void authenticate();
-        bool checkToken();
+        bool isFresh(const AccessToken& token) const;
         void refreshAccessToken();
+        void storeToken(std::string accessToken, int expiresIn);
+        void publishToken();
+        // Replaces seen unless another thread already did; returns the current token. A background refresh only
+        // uses the refresh token and leaves the current token alone without one, authenticating waits for the user.
+        std::shared_ptr<const AccessToken> refresh(const std::shared_ptr<const AccessToken>& seen,
+                                                   bool background = false);
+        // When the background refresh of token is due: tokenRefreshMargin before it expires, or half way through
+        // the time it has left when that is shorter, so a short lived token is never refreshed over and over
+        std::chrono::system_clock::time_point refreshDue(const AccessToken& token) const;
+        void runRefresher(std::stop_token stop);
+        // Shares the connection pool and event loop of a ClientManager
+        OAuthAgent(std::string& clientId, std::string& clientSecret, const OAuthAgentOptions& options,
+                   std::shared_ptr<Http::SessionPool> sessionPool, std::shared_ptr<Http::EventLoop> eventLoop,
+                   std::shared_ptr<Http::RequestScheduler> requestScheduler);
+        friend class ClientManager;
       public:
-        OAuthAgent(std::string& clientId, std::string& clientSecret);
+        OAuthAgent(std::string& clientId, std::string& clientSecret, const OAuthAgentOptions& options = {});
         ~OAuthAgent();
         std::string getAccessToken();
+        // Snapshot of the current token, refreshed first when it is about to expire
+        std::shared_ptr<const AccessToken> getToken();
+        // False when getToken would refresh first, and so block
+        bool hasFreshToken() const;
+        const std::string& getClientId() const { return _clientId; }
+        std::shared_ptr<Http::SessionPool> getSessionPool() const;
+        // Paces and retries every Drive API request of this client
+        std::shared_ptr<Http::RequestScheduler> getRequestScheduler() const;
+        // Created on first use; drives all asynchronous requests of this client
+        std::shared_ptr<Http::EventLoop> getEventLoop();
+        // Created on first use; coalesces small metadata calls into batch requests
+        std::shared_ptr<Http::BatchScheduler> getBatchScheduler();
     };
 }  // namespace GCloud::Authentication
 
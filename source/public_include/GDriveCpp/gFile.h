@@ -1,14 +1,20 @@
 #pragma once
 
 #include <bitset>
+#include <exception>
 #include <functional>
+#include <initializer_list>
+#include <iterator>
 #include <memory>
 #include <optional>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
 #include "GDriveCpp/gDrive.h"
+#include "GDriveCpp/pathCache.h"
 
 #ifdef _MSC_VER
 #pragma warning(push)
@@ -16,6 +22,48 @@
 #endif
 
 namespace GDrive {
+    // Members of GFile that can be selected for a partial response, in declaration order
+    enum class GFileField : uint8_t {
+            kind, driveId, fileExtension, copyRequiresWriterPermission, md5Checksum, writersCanShare, viewedByMe,
+            mimeType, parents, thumbnailLink, iconLink, shared, headRevisionId, webViewLink, webContentLink, size,
+            viewersCanCopyContent, hasThumbnail, spaces, folderColorRgb, id, name, description, starred, trashed,
+            explicitlyTrashed, createdTime, modifiedTime, modifiedByMeTime, viewedByMeTime, sharedWithMeTime,
+            quotaBytesUsed, version, originalFilename, ownedByMe, fullFileExtension, isAppAuthorized, teamDriveId,
+            hasAugmentedPermissions, thumbnailVersion, trashedTime, modifiedByMe, permissionIds, resourceKey,
+            sha1Checksum, sha256Checksum, inheritedPermissionsDisabled, Count
+    };
+
+    // Typed set of GFile members. It generates the fields parameter of a request and tells the parser which
+    // members to read; an empty mask leaves the field selection to the request or the server default.
+    class GDRIVE_API GFileFieldMask {
+      public:
+        GFileFieldMask() = default;
+        GFileFieldMask(std::initializer_list<GFileField> fields);
+
+        static GFileFieldMask All();
+
+        GFileFieldMask& set(GFileField field);
+        GFileFieldMask& reset(GFileField field);
+
+        bool test(GFileField field) const { return _bits.test(static_cast<size_t>(field)); }
+
+        bool empty() const { return _bits.none(); }
+
+        size_t count() const { return _bits.count(); }
+
+        GFileFieldMask operator|(const GFileFieldMask& other) const;
+        GFileFieldMask operator&(const GFileFieldMask& other) const;
+        bool operator==(const GFileFieldMask& other) const = default;
+
+        // Comma separated member names, e.g. "id,name"
+        std::string toString() const;
+        // fields parameter of a files.list request, e.g. "nextPageToken,files(id,name)"
+        std::string toListFields() const;
+
+      private:
+        std::bitset<static_cast<size_t>(GFileField::Count)> _bits;
+    };
+
     struct GDRIVE_API GFileListRequest {
         std::string corpora;
         std::string driveId;
@@ -28,7 +76,53 @@ namespace GDrive {
         bool supportsAllDrives;
         std::string includePermissionsForView;
         std::string includeLabels;
+        // Takes precedence over fieldMask when both are set
         std::string fields;
+        // Members to request and parse; generates the fields parameter when fields is empty
+        GFileFieldMask fieldMask;
+    };
+
+    class MetadataIndex;
+    class BlobCache;
+
+    struct GDirectoryQueryOptions {
+        // Resolved folder prefixes are looked up here first and stored after every walk
+        std::shared_ptr<PathCache> pathCache;
+        // Steps inside folders the index holds a complete listing of are answered locally. Listings fetched
+        // from the server are stored back; the index has to be kept current by a ChangeTracker.
+        std::shared_ptr<MetadataIndex> index;
+        // Members returned for the listed entries. The intermediate folders of the walk only fetch id and name.
+        GFileFieldMask fields{GFileField::name, GFileField::id, GFileField::createdTime};
+    };
+
+    struct GFileDownloadOptions {
+        // Split the content into HTTP Range requests fetched concurrently. Needs the file's size field and
+        // falls back to a single stream when it is missing or the file fits into one chunk.
+        bool parallel = false;
+        uint64_t chunkSize = 16ull * 1024 * 1024;
+        uint32_t concurrency = 4;
+        // Attempts per chunk after the first one; a retry resumes where the failed attempt stopped.
+        uint32_t maxChunkRetries = 3;
+        // Hash the content as it arrives and compare it with the strongest checksum of the metadata (SHA-256,
+        // SHA-1 or MD5). Files whose metadata carries no checksum are not verified.
+        bool verifyChecksum = true;
+        // Downloads to a path start over this many times after a mismatch; a sink fails right away
+        uint32_t maxChecksumRetries = 1;
+        // Downloads to a path are served from here while the file's md5Checksum or headRevisionId is unchanged,
+        // and stored here afterwards
+        std::shared_ptr<BlobCache> cache;
+    };
+
+    // Receives downloaded content in the buffers libcurl reads from the socket; data is only valid during the
+    // call. The transfer waits for the sink, so a slow sink slows the socket down instead of piling up content
+    // in memory. Returning false stops the download.
+    using GFileContentSink = std::function<bool(std::string_view data)>;
+
+    struct GFileUploadOptions {
+        // Bytes sent per request; rounded up to the 256 KiB granularity required by Drive
+        uint64_t chunkSize = 8ull * 1024 * 1024;
+        // Consecutive failed attempts tolerated before giving up; progress resets the count
+        uint32_t maxRetries = 5;
     };
 
     class GDRIVE_API GFileCapabilities {
@@ -91,12 +185,6 @@ namespace GDrive {
     class GDRIVE_API GFile {
       private:
         std::weak_ptr<GCloud::Authentication::OAuthAgent> _client;
-        static std::unordered_map<std::string, std::function<void(GFile&, const std::string_view&)>>
-            _stringFieldsSetterMap;
-        static std::unordered_map<std::string, std::function<void(GFile&, bool)>> _boolFieldsSetterMap;
-        static std::unordered_map<std::string, std::function<std::optional<std::string>(GFile&)>>
-            _stringFieldsGetterMap;
-        static std::unordered_map<std::string, std::function<std::optional<bool>(GFile&)>> _boolFieldsGetterMap;
 
       public:
         // Primitive types wrapped in std::optional
@@ -165,27 +253,122 @@ namespace GDrive {
         std::optional<bool> inheritedPermissionsDisabled;
         GFile(std::weak_ptr<GCloud::Authentication::OAuthAgent> client);
 
+        // Metadata of a single file (files.get). Calls issued within a short window share one batch request.
+        static std::future<std::shared_ptr<GFile>> GetAsync(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                                                            const std::string& fileId, const std::string& fields = "");
+
         void setStringField(const std::string_view& field, const std::string_view& value);
         void setBoolField(const std::string_view& field, bool value);
 
         void print(std::ostream& os);
         void download(const std::string& path = "");
+        void download(const std::string& path, const GFileDownloadOptions& options);
+        // Streams the content into sink, in order and every byte once: an interrupted transfer is resumed from
+        // the last byte delivered, up to options.maxChunkRetries times. options.parallel is ignored.
+        void download(const GFileContentSink& sink, const GFileDownloadOptions& options = {});
+        std::future<void> downloadAsync(const std::string& path = "");
+        // download(path, options) on the client's event loop. The content is hashed as it arrives and served from
+        // or stored in options.cache. A broken transfer starts over up to options.maxChunkRetries times, a
+        // mismatch up to options.maxChecksumRetries times; options.parallel is ignored.
+        std::future<void> downloadAsync(const std::string& path, const GFileDownloadOptions& options);
+        // Uploads the content of a local file through a resumable upload session. Creates a new Drive file
+        // (named after the local file unless name is set) when id is empty, otherwise replaces its content.
         void upload(const std::string& path);
+        void upload(const std::string& path, const GFileUploadOptions& options);
     };
 
+    class GFileListPages;
+
     class GDRIVE_API GFileList {
       private:
         std::string _nextPageToken;
         std::weak_ptr<GCloud::Authentication::OAuthAgent> _client;
 
+        GFileList(std::weak_ptr<GCloud::Authentication::OAuthAgent> client);
+        void parseFiles(const std::string_view& body, const GFileFieldMask& fields);
+        static void QueryWithCallback(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                                      const GFileListRequest& request, std::function<void(GFileList&&)> onComplete,
+                                      std::function<void(std::exception_ptr)> onFailure);
+
       public:
         static std::optional<GFileList> QueryDirectory(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
                                                        std::shared_ptr<const GFile> root,
-                                                       const std::string& searchPath);
+                                                       const std::string& searchPath,
+                                                       const GDirectoryQueryOptions& options = {});
+        // Asynchronous variants are driven by the client's event loop and never block the calling thread
+        // on network I/O.
+        static std::future<std::optional<GFileList>> QueryDirectoryAsync(
+            std::weak_ptr<GCloud::Authentication::OAuthAgent> client, std::shared_ptr<const GFile> root,
+            const std::string& searchPath, const GDirectoryQueryOptions& options = {});
+        static std::future<GFileList> QueryAsync(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                                                 const GFileListRequest& request);
+        // Same as QueryAsync, but sent as part of a batch request together with other small calls.
+        static std::future<GFileList> QueryBatched(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                                                   const GFileListRequest& request);
+        // Every page of the request, fetched lazily one page ahead of the caller.
+        static GFileListPages Pages(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                                    const GFileListRequest& request);
         std::vector<std::shared_ptr<GFile>> files;
         GFileList(std::weak_ptr<GCloud::Authentication::OAuthAgent> client, const GFileListRequest& request);
+        // List of files already at hand, e.g. taken from a MetadataIndex
+        GFileList(std::weak_ptr<GCloud::Authentication::OAuthAgent> client, std::vector<std::shared_ptr<GFile>> files);
+        const std::string& getNextPageToken() const { return _nextPageToken; }
         void print(std::ostream& os);
     };
+
+    // Input range over all pages of a listing. While the caller works on page N the request for page N+1 is
+    // already in flight, and only the current page is kept in memory.
+    class GDRIVE_API GFileListPages {
+      public:
+        class GDRIVE_API Iterator {
+          public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = GFileList;
+            using difference_type = std::ptrdiff_t;
+            using pointer = GFileList*;
+            using reference = GFileList&;
+
+            Iterator() = default;
+
+            reference operator*() const { return *_pages->_current; }
+
+            pointer operator->() const { return &*_pages->_current; }
+
+            Iterator& operator++();
+            void operator++(int) { ++*this; }
+            bool operator==(const Iterator& other) const { return atEnd() == other.atEnd(); }
+
+          private:
+            friend class GFileListPages;
+
+            explicit Iterator(GFileListPages* pages) : _pages(pages) {}
+
+            bool atEnd() const { return !_pages || !_pages->_current; }
+
+            GFileListPages* _pages = nullptr;
+        };
+
+        GFileListPages(std::weak_ptr<GCloud::Authentication::OAuthAgent> client, GFileListRequest request);
+
+        GFileListPages(const GFileListPages&) = delete;
+        GFileListPages& operator=(const GFileListPages&) = delete;
+        GFileListPages(GFileListPages&&) = default;
+        GFileListPages& operator=(GFileListPages&&) = default;
+
+        // Starts the listing on first call; the range can only be traversed once.
+        Iterator begin();
+
+        Iterator end() { return Iterator(); }
+
+      private:
+        bool advance();
+
+        std::weak_ptr<GCloud::Authentication::OAuthAgent> _client;
+        GFileListRequest _request;
+        std::optional<GFileList> _current;
+        std::future<GFileList> _next;
+        bool _started = false;
+    };
 }  // namespace GDrive
 
 #ifdef _MSC_VER
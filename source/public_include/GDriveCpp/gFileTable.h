@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "GDriveCpp/gFile.h"
+#include "GDriveCpp/listingArena.h"
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4251)
+#endif
+
+namespace GDrive {
+    class GFileTable;
+    class GFileTableBuilder;
+    class QueryEvaluator;
+
+    // Read-only view of one entry of a GFileTable. Only valid while the table is alive and not modified.
+    class GDRIVE_API GFileView {
+      public:
+        GFileView(const GFileTable* table, size_t index) : _table(table), _index(index) {}
+
+        bool has(GFileField field) const;
+        // Throw std::invalid_argument when the field is not of the requested kind
+        std::optional<std::string_view> getString(GFileField field) const;
+        std::optional<bool> getBool(GFileField field) const;
+        // Empty when the field is not present
+        std::span<const std::string_view> getList(GFileField field) const;
+
+        std::optional<std::string_view> id() const { return getString(GFileField::id); }
+
+        std::optional<std::string_view> name() const { return getString(GFileField::name); }
+
+        std::optional<std::string_view> mimeType() const { return getString(GFileField::mimeType); }
+
+        // Copies the entry into a standalone GFile, e.g. to download it
+        std::shared_ptr<GFile> toFile(std::weak_ptr<GCloud::Authentication::OAuthAgent> client) const;
+
+      private:
+        const GFileTable* _table;
+        size_t _index;
+    };
+
+    // Contiguous storage for large listings. Each entry is a fixed size record holding a presence bitmask and
+    // the packed booleans; strings are stored once per distinct value for fields that repeat across a listing
+    // (mimeType, parents, kind, ...). Records and strings are allocated from a ListingArena, which can be shared
+    // by the tables of a whole traversal so everything is released in one go.
+    class GDRIVE_API GFileTable {
+      public:
+        class GDRIVE_API Iterator {
+          public:
+            using iterator_category = std::random_access_iterator_tag;
+            using value_type = GFileView;
+            using difference_type = std::ptrdiff_t;
+            using pointer = void;
+            using reference = GFileView;
+
+            Iterator() = default;
+
+            Iterator(const GFileTable* table, size_t index) : _table(table), _index(index) {}
+
+            GFileView operator*() const { return GFileView(_table, _index); }
+
+            GFileView operator[](difference_type offset) const { return GFileView(_table, _index + offset); }
+
+            Iterator& operator++() {
+                ++_index;
+                return *this;
+            }
+
+            Iterator operator++(int) { return Iterator(_table, _index++); }
+
+            Iterator& operator--() {
+                --_index;
+                return *this;
+            }
+
+            Iterator operator--(int) { return Iterator(_table, _index--); }
+
+            Iterator& operator+=(difference_type offset) {
+                _index += offset;
+                return *this;
+            }
+
+            Iterator& operator-=(difference_type offset) {
+                _index -= offset;
+                return *this;
+            }
+
+            Iterator operator+(difference_type offset) const { return Iterator(_table, _index + offset); }
+
+            Iterator operator-(difference_type offset) const { return Iterator(_table, _index - offset); }
+
+            difference_type operator-(const Iterator& other) const {
+                return static_cast<difference_type>(_index) - static_cast<difference_type>(other._index);
+            }
+
+            bool operator==(const Iterator& other) const { return _index == other._index; }
+
+            auto operator<=>(const Iterator& other) const { return _index <=> other._index; }
+
+          private:
+            const GFileTable* _table = nullptr;
+            size_t _index = 0;
+        };
+
+        // Uses an arena of its own
+        GFileTable();
+        explicit GFileTable(std::shared_ptr<ListingArena> arena);
+        ~GFileTable();
+        GFileTable(const GFileTable&) = delete;
+        GFileTable& operator=(const GFileTable&) = delete;
+        // Leave the moved from table empty, with an arena of its own
+        GFileTable(GFileTable&& other);
+        GFileTable& operator=(GFileTable&& other);
+
+        // Fetches one page of the request into the table and returns its next page token. A page that fails adds
+        // nothing.
+        std::string appendPage(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                               const GFileListRequest& request);
+        // Every page of the request, parsed straight into a single table
+        static GFileTable QueryAll(std::weak_ptr<GCloud::Authentication::OAuthAgent> client,
+                                   GFileListRequest request);
+
+        void append(const GFile& file);
+        void reserve(size_t files);
+        // Removes all entries. The arena memory is released as well unless the arena is shared.
+        void clear();
+
+        size_t size() const { return _storage->recordCount; }
+
+        bool empty() const { return _storage->recordCount == 0; }
+
+        GFileView operator[](size_t index) const { return GFileView(this, index); }
+
+        Iterator begin() const { return Iterator(this, 0); }
+
+        Iterator end() const { return Iterator(this, size()); }
+
+        const std::shared_ptr<ListingArena>& getArena() const { return _storage->arena; }
+
+        // Bytes reserved by the arena backing the table, shared with other users of the same arena
+        size_t memoryUsage() const;
+
+      private:
+        friend class GFileView;
+        friend class GFileTableBuilder;
+        friend class QueryEvaluator;
+
+        // Present string and list fields of a record in field order. Strings point at their characters, lists at
+        // an array of `size` views.
+        struct Slot {
+            const void* data = nullptr;
+            uint32_t size = 0;
+        };
+
+        struct Record {
+            uint64_t present = 0;  // bit per GFileField
+            uint64_t values = 0;   // value of every present boolean field
+            const Slot* slots = nullptr;
+        };
+
+        // Records are kept in fixed size chunks and strings and lists in exactly sized arrays, none of which ever
+        // move. The chunk index and the interning set do grow inside the arena, which keeps what they outgrow
+        // until it is released; reserve sizes the chunk index up front.
+        static constexpr size_t RECORD_CHUNK_BITS = 10;
+        static constexpr size_t RECORD_CHUNK_SIZE = size_t{1} << RECORD_CHUNK_BITS;
+
+        // Containers allocating from the arena. The arena is declared first so it outlives them.
+        struct Storage {
+            explicit Storage(std::shared_ptr<ListingArena> arena);
+
+            std::shared_ptr<ListingArena> arena;
+            std::pmr::vector<Record*> recordChunks;
+            size_t recordCount = 0;
+            std::pmr::unordered_set<std::string_view> interned;
+        };
+
+        const Record& record(size_t index) const {
+            return _storage->recordChunks[index >> RECORD_CHUNK_BITS][index & (RECORD_CHUNK_SIZE - 1)];
+        }
+
+        const Slot* findSlot(size_t index, GFileField field) const;
+        std::string_view store(std::string_view value, bool intern);
+        void push(const Record& record);
+
+        std::unique_ptr<Storage> _storage;
+    };
+}  // namespace GDrive
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
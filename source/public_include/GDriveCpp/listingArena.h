@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+
+#include "GDriveCpp/dllExport.h"
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4251)
+#endif
+
+namespace GDrive {
+    // Bump allocator for listing data. Records and strings of one page or a whole traversal are carved out of
+    // a few large buffers and released together; individual deallocations are no-ops. Not thread safe, use
+    // one arena per thread.
+    class GDRIVE_API ListingArena {
+      public:
+        explicit ListingArena(size_t initialSize = 256 * 1024);
+
+        ListingArena(const ListingArena&) = delete;
+        ListingArena& operator=(const ListingArena&) = delete;
+
+        std::pmr::memory_resource* resource() { return &_resource; }
+
+        void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t)) {
+            return _resource.allocate(bytes, alignment);
+        }
+
+        // Frees everything at once. Nothing allocated from the arena may be used afterwards.
+        void release();
+
+        // Bytes obtained from the system, including the unused tail of the current buffer
+        size_t bytesReserved() const { return _upstream.bytesReserved(); }
+
+      private:
+        // Upstream of the monotonic buffer; only counts what it hands out
+        class CountingResource : public std::pmr::memory_resource {
+          public:
+            size_t bytesReserved() const { return _bytes; }
+
+          private:
+            void* do_allocate(size_t bytes, size_t alignment) override;
+            void do_deallocate(void* pointer, size_t bytes, size_t alignment) override;
+            bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+            size_t _bytes = 0;
+        };
+
+        CountingResource _upstream;
+        std::pmr::monotonic_buffer_resource _resource;
+    };
+}  // namespace GDrive
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "GDriveCpp/gFile.h"
+#include "GDriveCpp/queryBuilder.h"
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4251)
+#endif
+
+namespace GDrive {
+    // Local copy of file metadata keyed by file ID, with secondary indexes on parent ID and name. It is kept up
+    // to date by a ChangeTracker and consulted by QueryDirectory and the DirectoryCrawler before the network.
+    //
+    // A persistent index lives in a directory holding a compacted snapshot, which is memory mapped and searched
+    // in place, and an append-only journal of the changes made since. Opening it replays the journal only, so a
+    // warm start costs no parsing of the snapshot; the journal is folded into a new snapshot once it grows.
+    class GDRIVE_API MetadataIndex {
+      public:
+        // In memory only
+        MetadataIndex();
+        // Persistent index in directory, created when missing. Files read back from disk belong to client.
+        // A directory is open in one process at a time; throws std::runtime_error while another one holds it.
+        MetadataIndex(std::weak_ptr<GCloud::Authentication::OAuthAgent> client, const std::filesystem::path& directory);
+        ~MetadataIndex();
+
+        MetadataIndex(const MetadataIndex&) = delete;
+        MetadataIndex& operator=(const MetadataIndex&) = delete;
+
+        // Persistent index of the client, stored in its cache directory. Processes sharing a client ID share the
+        // directory; those opening it after the first one get an index in memory only.
+        static std::shared_ptr<MetadataIndex> Open(std::weak_ptr<GCloud::Authentication::OAuthAgent> client);
+
+        // Inserts or replaces the entry of file.id; files without an ID are ignored
+        void put(std::shared_ptr<const GFile> file);
+        bool remove(const std::string_view& id);
+        std::shared_ptr<const GFile> get(const std::string_view& id) const;
+        // Entries that have parentId among their parents
+        std::vector<std::shared_ptr<const GFile>> children(const std::string_view& parentId) const;
+        std::vector<std::shared_ptr<const GFile>> findByName(const std::string_view& name) const;
+        std::vector<std::shared_ptr<const GFile>> findChild(const std::string_view& parentId,
+                                                            const std::string_view& name) const;
+        // Entries matching the query, evaluated locally. A top level `parents in` or `name =` condition narrows
+        // the scan to the secondary indexes. Throws std::invalid_argument when the query cannot be evaluated locally.
+        std::vector<std::shared_ptr<const GFile>> query(const QueryBuilder& query) const;
+        size_t size() const;
+        void clear();
+
+        // Records that every child of folderId is in the index with at least the given members, so that a
+        // listing of the folder can be answered locally. trashed tells whether the listing included trashed
+        // children. Dropped again when the folder is removed.
+        void markListed(const std::string_view& folderId, const GFileFieldMask& fields, bool trashed);
+        // Members the children of folderId were listed with, or nothing when the folder was never listed with
+        // the same trashed filter
+        std::optional<GFileFieldMask> listedFields(const std::string_view& folderId, bool trashed) const;
+
+        bool isPersistent() const;
+        // Writes the journal through to disk
+        void flush();
+        // Folds the journal into a new snapshot. Happens on its own once the journal outgrows the snapshot.
+        void compact();
+
+      private:
+        struct Storage;
+
+        mutable std::shared_mutex _mutex;
+        std::unique_ptr<Storage> _storage;
+    };
+}  // namespace GDrive
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "GDriveCpp/dllExport.h"
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4251)
+#endif
+
+namespace GDrive {
+    // Maps folder paths, relative to a root folder ID, to the folder IDs they resolved to. Used by
+    // GFileList::QueryDirectory to skip the per-segment lookups of prefixes it has already walked.
+    class GDRIVE_API PathCache {
+      public:
+        explicit PathCache(std::chrono::seconds ttl = std::chrono::minutes(5));
+
+        // rootId is empty for paths whose first segment was searched across the whole drive.
+        std::optional<std::string> lookup(const std::string_view& rootId, const std::string_view& path);
+        void store(const std::string_view& rootId, const std::string_view& path, const std::string_view& folderId);
+
+        // Invalidation hooks: drop a path and everything below it, or every path that goes through a folder
+        // (e.g. after it was renamed, moved or trashed).
+        void invalidate(const std::string_view& rootId, const std::string_view& path);
+        void invalidateFolder(const std::string_view& folderId);
+        void clear();
+        size_t size() const;
+
+        // Persist to / restore from the client's cache directory. Expired entries are not restored.
+        void load(const std::string_view& clientId);
+        void save(const std::string_view& clientId) const;
+
+      private:
+        struct Entry {
+            std::string folderId;
+            std::chrono::system_clock::time_point expiresAt;
+        };
+
+        static std::string makeKey(const std::string_view& rootId, const std::string_view& path);
+        void eraseSubtree(const std::string& key);
+
+        std::chrono::seconds _ttl;
+        mutable std::mutex _mutex;
+        std::unordered_map<std::string, Entry> _entries;
+    };
+}  // namespace GDrive
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
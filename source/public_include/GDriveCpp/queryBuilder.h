@@ -4,10 +4,14 @@
 #include <string>
 #include <vector>
 
+#include "GDriveCpp/queryTemplate.h"
 #include "dllExport.h"
 
 namespace GDrive {
     struct QueryBuilderImpl;
+    class QueryEvaluator;
+    class GFile;
+    class GFileTable;
 
 #pragma warning(push)
 #pragma warning(disable : 4251)  // Disable C4251 for this class (QueryBuilderImpl is meant not to be exported)
@@ -45,11 +49,37 @@ namespace GDrive {
         QueryBuilder& AddCondition(const std::string& field, ComparisonOperator op,
                                                  const std::string& value,
                                    bool enabled = true);
+        // In with a list matches when any of the values does; the list must not be empty
         QueryBuilder& AddCondition(const std::string& field, ComparisonOperator op,
                                    const std::vector<std::string>& values, bool enabled = true);
+        // Condition whose value is left to the named parameter of the compiled QueryTemplate. A query with
+        // parameters can only be compiled, not built or evaluated.
+        QueryBuilder& AddParameter(const std::string& field, ComparisonOperator op, const std::string& parameter,
+                                   bool enabled = true);
         [[nodiscard]] std::string Build() const;
+        // Appends the query to out, which is grown once to the exact size and can be reused across builds
+        void BuildInto(std::string& out) const;
+        // Fixes the query's text once, only the parameters are filled in from then on
+        [[nodiscard]] QueryTemplate Compile() const;
+
+        // Conditions are numbered in the order they were added, disabled ones not counted. Replacing their
+        // values lets a query of the same shape be built again without rebuilding its conditions.
+        QueryBuilder& SetConditionValue(size_t condition, const std::string& value);
+        // For conditions built from a list; the number of values must stay the same
+        QueryBuilder& SetConditionValues(size_t condition, const std::vector<std::string>& values);
+        [[nodiscard]] size_t ConditionCount() const;
+
+        // The conditions evaluated locally against metadata already at hand, with the server's semantics for
+        // the members of GFile. Conditions on anything else (fullText, properties, ...) cannot be evaluated and
+        // make Matches and Filter throw std::invalid_argument.
+        [[nodiscard]] bool IsLocallyEvaluable() const;
+        [[nodiscard]] bool Matches(const GFile& file) const;
+        // Indices of the matching entries, evaluated one condition at a time over the whole table
+        [[nodiscard]] std::vector<size_t> Filter(const GFileTable& table) const;
 
       private:
+        friend class QueryEvaluator;
+
         std::unique_ptr<QueryBuilderImpl> impl;
     };
 
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dllExport.h"
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4251)
+#endif
+
+namespace GDrive {
+    // Query compiled once with named parameters in place of some of its values. The constant text is kept as it
+    // will be sent, so building a query copies it around the escaped values and formats nothing. Templates come
+    // from QueryBuilder::Compile or from a pattern such as "'{parent}' in parents and name = '{name}'".
+    //
+    // Bind and the Build overloads without values keep state in the template and need a copy per thread; the
+    // overloads taking the values directly leave the template untouched and can share it between threads.
+    class GDRIVE_API QueryTemplate {
+      public:
+        // {name} marks a parameter, placed where a quoted value goes; {{ and }} stand for literal braces.
+        // Throws std::invalid_argument for an unterminated or unnamed parameter.
+        explicit QueryTemplate(std::string_view pattern);
+
+        [[nodiscard]] size_t ParameterCount() const;
+        [[nodiscard]] const std::string& ParameterName(size_t parameter) const;
+        // Throws std::out_of_range when the template has no parameter of that name
+        [[nodiscard]] size_t ParameterIndex(std::string_view name) const;
+
+        // Values are escaped once here, quotes and backslashes included
+        QueryTemplate& Bind(std::string_view name, std::string_view value);
+        QueryTemplate& Bind(size_t parameter, std::string_view value);
+
+        // Throw std::logic_error while a parameter is unbound
+        [[nodiscard]] std::string Build() const;
+        // Appends the query to out, which grows once to the exact size and can be reused across builds
+        void BuildInto(std::string& out) const;
+
+        // Values in parameter order, escaped while they are copied
+        [[nodiscard]] std::string Build(std::initializer_list<std::string_view> values) const;
+        void BuildInto(std::string& out, std::initializer_list<std::string_view> values) const;
+
+      private:
+        friend class QueryBuilder;
+
+        struct Slot {
+            // Position in _text the value goes to
+            size_t offset;
+            size_t parameter;
+        };
+
+        QueryTemplate() = default;
+
+        void addSlot(size_t offset, std::string_view name);
+
+        std::string _text;
+        std::vector<Slot> _slots;
+        std::vector<std::string> _names;
+        // Escaped bound values, parallel to _names
+        std::vector<std::string> _values;
+        std::vector<bool> _bound;
+    };
+}  // namespace GDrive
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
@@ -1,12 +1,35 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <string_view>
 #include <vector>
 
+struct evp_md_ctx_st;
+
 namespace utils::data {
     std::string getEnvironmentVariable(const std::string_view &varname);
 
     std::vector<uint8_t> encryptAES256(const std::vector<uint8_t> &plaintext, const std::vector<uint8_t> &password);
     std::vector<uint8_t> decryptAES256(const std::vector<uint8_t> &ciphertext, const std::vector<uint8_t> &password);
+
+    // Message digest computed incrementally through OpenSSL's EVP interface, which runs the SHA extensions or
+    // vectorized code paths of the CPU when it has them.
+    class Digest {
+      public:
+        enum class Algorithm { Md5, Sha1, Sha256 };
+
+        explicit Digest(Algorithm algorithm);
+        ~Digest();
+
+        Digest(const Digest &) = delete;
+        Digest &operator=(const Digest &) = delete;
+
+        void update(std::string_view data);
+        // Lowercase hex, the way Drive reports checksums. Nothing can be added afterwards.
+        std::string finish();
+
+      private:
+        evp_md_ctx_st *_context = nullptr;
+    };
 }  // namespace utils::data
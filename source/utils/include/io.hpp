@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif  // _WIN32
+
+namespace utils::io {
+    // Copy-on-write clone of from at to, which must not exist yet. Returns false when the filesystem cannot
+    // clone, e.g. across devices or on filesystems without reflink support.
+    bool cloneFile(const std::filesystem::path &from, const std::filesystem::path &to);
+
+    // File accessed through positional reads and writes, safe to use from several threads at once
+    // as long as the written ranges do not overlap.
+    class RandomAccessFile {
+      public:
+        enum class Mode {
+            Read,       // Existing file, read only
+            Overwrite,  // Created or truncated, read and write
+            Update      // Created if missing, existing content kept, read and write
+        };
+
+        RandomAccessFile(const std::filesystem::path &path, Mode mode);
+        ~RandomAccessFile();
+
+        RandomAccessFile(const RandomAccessFile &) = delete;
+        RandomAccessFile &operator=(const RandomAccessFile &) = delete;
+
+        // Reserves disk space for the whole file and sets its size.
+        void preallocate(uint64_t size);
+        void resize(uint64_t size);
+        void writeAt(uint64_t offset, const void *data, size_t size);
+        // Returns the number of bytes read, which is only less than size at the end of the file.
+        size_t readAt(uint64_t offset, void *data, size_t size) const;
+        uint64_t size() const;
+        void flush();
+
+      private:
+        std::filesystem::path _path;
+#ifdef _WIN32
+        HANDLE _handle = INVALID_HANDLE_VALUE;
+#else
+        int _fd = -1;
+#endif  // _WIN32
+    };
+
+    // Read only view of a whole file mapped into memory. An empty file maps to an empty view.
+    class MappedFile {
+      public:
+        explicit MappedFile(const std::filesystem::path &path);
+        ~MappedFile();
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        const char *data() const { return _data; }
+
+        size_t size() const { return _size; }
+
+      private:
+        std::filesystem::path _path;
+        const char *_data = nullptr;
+        size_t _size = 0;
+#ifdef _WIN32
+        HANDLE _handle = INVALID_HANDLE_VALUE;
+        HANDLE _mapping = nullptr;
+#else
+        int _fd = -1;
+#endif  // _WIN32
+    };
+
+    // Small file mapped read-write and shared by every process that opens it. lock() takes a whole-file lock
+    // that excludes other processes as well as other threads of this one, so the class works with
+    // std::lock_guard and std::unique_lock.
+    class SharedMappedFile {
+      public:
+        // Created when missing and extended with zero bytes when shorter than size
+        SharedMappedFile(const std::filesystem::path &path, size_t size);
+        ~SharedMappedFile();
+
+        SharedMappedFile(const SharedMappedFile &) = delete;
+        SharedMappedFile &operator=(const SharedMappedFile &) = delete;
+
+        void lock();
+        void unlock();
+
+        char *data() const { return _data; }
+
+        size_t size() const { return _size; }
+
+      private:
+        void lockFile();
+        void unlockFile();
+
+        std::filesystem::path _path;
+        char *_data = nullptr;
+        size_t _size = 0;
+        // File locks are held per handle, threads sharing the handle are kept apart here
+        std::mutex _mutex;
+#ifdef _WIN32
+        HANDLE _handle = INVALID_HANDLE_VALUE;
+        HANDLE _mapping = nullptr;
+#else
+        int _fd = -1;
+#endif  // _WIN32
+    };
+
+    // Exclusive lock between processes, held through a file of its own that is created when missing. It does not
+    // keep threads of one process apart, those need a mutex of their own. Closing the file releases the lock.
+    class LockFile {
+      public:
+        explicit LockFile(const std::filesystem::path &path);
+        ~LockFile();
+
+        LockFile(const LockFile &) = delete;
+        LockFile &operator=(const LockFile &) = delete;
+
+        void lock();
+        // False right away when another process holds the lock
+        bool try_lock();
+        void unlock();
+
+      private:
+        std::filesystem::path _path;
+#ifdef _WIN32
+        HANDLE _handle = INVALID_HANDLE_VALUE;
+#else
+        int _fd = -1;
+#endif  // _WIN32
+    };
+}  // namespace utils::io
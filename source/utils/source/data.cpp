@@ -73,6 +73,41 @@ namespace utils::data {
         return ciphertext;
     }
 
+    Digest::Digest(Algorithm algorithm) {
+        const EVP_MD* md = algorithm == Algorithm::Md5    ? EVP_md5()
+                           : algorithm == Algorithm::Sha1 ? EVP_sha1()
+                                                          : EVP_sha256();
+        _context = EVP_MD_CTX_new();
+        if (!_context) throw std::runtime_error("Error creating digest context");
+        if (EVP_DigestInit_ex(_context, md, nullptr) != 1) {
+            EVP_MD_CTX_free(_context);
+            throw std::runtime_error("Error initializing digest");
+        }
+    }
+
+    Digest::~Digest() { EVP_MD_CTX_free(_context); }
+
+    void Digest::update(std::string_view data) {
+        if (EVP_DigestUpdate(_context, data.data(), data.size()) != 1) {
+            throw std::runtime_error("Error during digest update");
+        }
+    }
+
+    std::string Digest::finish() {
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int size = 0;
+        if (EVP_DigestFinal_ex(_context, digest, &size) != 1) {
+            throw std::runtime_error("Error during final digest");
+        }
+        static constexpr char HEX[] = "0123456789abcdef";
+        std::string hex(size * 2, '\0');
+        for (unsigned int i = 0; i < size; ++i) {
+            hex[2 * i] = HEX[digest[i] >> 4];
+            hex[2 * i + 1] = HEX[digest[i] & 0xF];
+        }
+        return hex;
+    }
+
     std::vector<uint8_t> decryptAES256(const std::vector<uint8_t>& ciphertext, const std::vector<uint8_t>& password) {
         std::vector<uint8_t> salt = std::vector<uint8_t>(16);
         std::vector<uint8_t> key;
@@ -0,0 +1,420 @@
+#include "io.hpp"
+
+#include <format>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#endif
+
+#ifdef __linux__
+#include <linux/fs.h>
+#elif __APPLE__
+#include <sys/clonefile.h>
+#endif
+
+namespace utils::io {
+#ifdef __linux__
+    bool cloneFile(const std::filesystem::path& from, const std::filesystem::path& to) {
+        int source = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+        if (source < 0) return false;
+        int target = ::open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (target < 0) {
+            ::close(source);
+            return false;
+        }
+        bool cloned = ::ioctl(target, FICLONE, source) == 0;
+        ::close(target);
+        ::close(source);
+        if (!cloned) ::unlink(to.c_str());
+        return cloned;
+    }
+#elif __APPLE__
+    bool cloneFile(const std::filesystem::path& from, const std::filesystem::path& to) {
+        return ::clonefile(from.c_str(), to.c_str(), 0) == 0;
+    }
+#else
+    // Block cloning on ReFS needs the target preallocated extent by extent, copying is left to the caller
+    bool cloneFile(const std::filesystem::path&, const std::filesystem::path&) { return false; }
+#endif
+
+#ifdef _WIN32
+    // ReadFile/WriteFile take 32-bit lengths
+    static constexpr size_t MAX_IO_TRANSFER = 0x40000000;
+
+    RandomAccessFile::RandomAccessFile(const std::filesystem::path& path, Mode mode) : _path(path) {
+        DWORD access = mode == Mode::Read ? GENERIC_READ : (GENERIC_READ | GENERIC_WRITE);
+        DWORD disposition = OPEN_EXISTING;
+        if (mode == Mode::Overwrite) disposition = CREATE_ALWAYS;
+        if (mode == Mode::Update) disposition = OPEN_ALWAYS;
+        _handle = CreateFileW(path.c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, disposition,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (_handle == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error(std::format("Failed to open file {}: error {}", path.string(), GetLastError()));
+        }
+    }
+
+    RandomAccessFile::~RandomAccessFile() {
+        if (_handle != INVALID_HANDLE_VALUE) CloseHandle(_handle);
+    }
+
+    void RandomAccessFile::preallocate(uint64_t size) {
+        FILE_ALLOCATION_INFO allocation{};
+        allocation.AllocationSize.QuadPart = static_cast<LONGLONG>(size);
+        // Allocation is only a hint, the size below is what matters
+        SetFileInformationByHandle(_handle, FileAllocationInfo, &allocation, sizeof(allocation));
+        resize(size);
+    }
+
+    void RandomAccessFile::resize(uint64_t size) {
+        FILE_END_OF_FILE_INFO endOfFile{};
+        endOfFile.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+        if (!SetFileInformationByHandle(_handle, FileEndOfFileInfo, &endOfFile, sizeof(endOfFile))) {
+            throw std::runtime_error(std::format("Failed to resize file {}: error {}", _path.string(), GetLastError()));
+        }
+    }
+
+    void RandomAccessFile::writeAt(uint64_t offset, const void* data, size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            OVERLAPPED overlapped{};
+            overlapped.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+            overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+            DWORD toWrite = static_cast<DWORD>(size > MAX_IO_TRANSFER ? MAX_IO_TRANSFER : size);
+            DWORD written = 0;
+            if (!WriteFile(_handle, bytes, toWrite, &written, &overlapped)) {
+                throw std::runtime_error(
+                    std::format("Failed to write file {}: error {}", _path.string(), GetLastError()));
+            }
+            bytes += written;
+            offset += written;
+            size -= written;
+        }
+    }
+
+    size_t RandomAccessFile::readAt(uint64_t offset, void* data, size_t size) const {
+        char* bytes = static_cast<char*>(data);
+        size_t total = 0;
+        while (total < size) {
+            OVERLAPPED overlapped{};
+            overlapped.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+            overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+            DWORD toRead = static_cast<DWORD>(size - total > MAX_IO_TRANSFER ? MAX_IO_TRANSFER : size - total);
+            DWORD read = 0;
+            if (!ReadFile(_handle, bytes + total, toRead, &read, &overlapped)) {
+                if (GetLastError() == ERROR_HANDLE_EOF) break;
+                throw std::runtime_error(
+                    std::format("Failed to read file {}: error {}", _path.string(), GetLastError()));
+            }
+            if (read == 0) break;
+            total += read;
+            offset += read;
+        }
+        return total;
+    }
+
+    uint64_t RandomAccessFile::size() const {
+        LARGE_INTEGER size{};
+        if (!GetFileSizeEx(_handle, &size)) {
+            throw std::runtime_error(
+                std::format("Failed to query size of {}: error {}", _path.string(), GetLastError()));
+        }
+        return static_cast<uint64_t>(size.QuadPart);
+    }
+
+    void RandomAccessFile::flush() { FlushFileBuffers(_handle); }
+
+    MappedFile::MappedFile(const std::filesystem::path& path) : _path(path) {
+        _handle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+        if (_handle == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error(std::format("Failed to open file {}: error {}", path.string(), GetLastError()));
+        }
+        LARGE_INTEGER size{};
+        if (!GetFileSizeEx(_handle, &size)) {
+            CloseHandle(_handle);
+            throw std::runtime_error(
+                std::format("Failed to query size of {}: error {}", path.string(), GetLastError()));
+        }
+        _size = static_cast<size_t>(size.QuadPart);
+        // A mapping of zero bytes cannot be created
+        if (_size == 0) return;
+        _mapping = CreateFileMappingW(_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (_mapping) _data = static_cast<const char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+        if (!_data) {
+            DWORD error = GetLastError();
+            if (_mapping) CloseHandle(_mapping);
+            CloseHandle(_handle);
+            throw std::runtime_error(std::format("Failed to map file {}: error {}", path.string(), error));
+        }
+    }
+
+    MappedFile::~MappedFile() {
+        if (_data) UnmapViewOfFile(_data);
+        if (_mapping) CloseHandle(_mapping);
+        if (_handle != INVALID_HANDLE_VALUE) CloseHandle(_handle);
+    }
+
+    SharedMappedFile::SharedMappedFile(const std::filesystem::path& path, size_t size) : _path(path), _size(size) {
+        _handle = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                              OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (_handle == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error(std::format("Failed to open file {}: error {}", path.string(), GetLastError()));
+        }
+        // A mapping larger than the file grows it, zero filled
+        _mapping = CreateFileMappingW(_handle, nullptr, PAGE_READWRITE, static_cast<DWORD>(uint64_t{size} >> 32),
+                                      static_cast<DWORD>(size & 0xFFFFFFFF), nullptr);
+        if (_mapping) _data = static_cast<char*>(MapViewOfFile(_mapping, FILE_MAP_WRITE, 0, 0, size));
+        if (!_data) {
+            DWORD error = GetLastError();
+            if (_mapping) CloseHandle(_mapping);
+            CloseHandle(_handle);
+            throw std::runtime_error(std::format("Failed to map file {}: error {}", path.string(), error));
+        }
+    }
+
+    SharedMappedFile::~SharedMappedFile() {
+        if (_data) UnmapViewOfFile(_data);
+        if (_mapping) CloseHandle(_mapping);
+        if (_handle != INVALID_HANDLE_VALUE) CloseHandle(_handle);
+    }
+
+    void SharedMappedFile::lockFile() {
+        OVERLAPPED overlapped{};
+        if (!LockFileEx(_handle, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped)) {
+            throw std::runtime_error(std::format("Failed to lock file {}: error {}", _path.string(), GetLastError()));
+        }
+    }
+
+    void SharedMappedFile::unlockFile() {
+        OVERLAPPED overlapped{};
+        UnlockFileEx(_handle, 0, MAXDWORD, MAXDWORD, &overlapped);
+    }
+
+    LockFile::LockFile(const std::filesystem::path& path) : _path(path) {
+        _handle = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                              OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (_handle == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error(std::format("Failed to open file {}: error {}", path.string(), GetLastError()));
+        }
+    }
+
+    LockFile::~LockFile() {
+        if (_handle != INVALID_HANDLE_VALUE) CloseHandle(_handle);
+    }
+
+    void LockFile::lock() {
+        OVERLAPPED overlapped{};
+        if (!LockFileEx(_handle, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped)) {
+            throw std::runtime_error(std::format("Failed to lock file {}: error {}", _path.string(), GetLastError()));
+        }
+    }
+
+    bool LockFile::try_lock() {
+        OVERLAPPED overlapped{};
+        if (LockFileEx(_handle, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, MAXDWORD, MAXDWORD,
+                       &overlapped)) {
+            return true;
+        }
+        DWORD error = GetLastError();
+        if (error == ERROR_LOCK_VIOLATION || error == ERROR_IO_PENDING) return false;
+        throw std::runtime_error(std::format("Failed to lock file {}: error {}", _path.string(), error));
+    }
+
+    void LockFile::unlock() {
+        OVERLAPPED overlapped{};
+        UnlockFileEx(_handle, 0, MAXDWORD, MAXDWORD, &overlapped);
+    }
+#else
+    RandomAccessFile::RandomAccessFile(const std::filesystem::path& path, Mode mode) : _path(path) {
+        int flags = O_RDONLY;
+        if (mode == Mode::Overwrite) flags = O_RDWR | O_CREAT | O_TRUNC;
+        if (mode == Mode::Update) flags = O_RDWR | O_CREAT;
+        _fd = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+        if (_fd < 0) {
+            throw std::runtime_error(std::format("Failed to open file {}: {}", path.string(), std::strerror(errno)));
+        }
+    }
+
+    RandomAccessFile::~RandomAccessFile() {
+        if (_fd >= 0) ::close(_fd);
+    }
+
+    void RandomAccessFile::preallocate(uint64_t size) {
+#ifdef __linux__
+        int result = posix_fallocate(_fd, 0, static_cast<off_t>(size));
+        // Not every filesystem supports allocation, fall back to a sparse file
+        if (result == 0) return;
+#endif
+        resize(size);
+    }
+
+    void RandomAccessFile::resize(uint64_t size) {
+        if (::ftruncate(_fd, static_cast<off_t>(size)) != 0) {
+            throw std::runtime_error(std::format("Failed to resize file {}: {}", _path.string(), std::strerror(errno)));
+        }
+    }
+
+    void RandomAccessFile::writeAt(uint64_t offset, const void* data, size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t written = ::pwrite(_fd, bytes, size, static_cast<off_t>(offset));
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error(
+                    std::format("Failed to write file {}: {}", _path.string(), std::strerror(errno)));
+            }
+            bytes += written;
+            offset += static_cast<uint64_t>(written);
+            size -= static_cast<size_t>(written);
+        }
+    }
+
+    size_t RandomAccessFile::readAt(uint64_t offset, void* data, size_t size) const {
+        char* bytes = static_cast<char*>(data);
+        size_t total = 0;
+        while (total < size) {
+            ssize_t read = ::pread(_fd, bytes + total, size - total, static_cast<off_t>(offset));
+            if (read < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error(
+                    std::format("Failed to read file {}: {}", _path.string(), std::strerror(errno)));
+            }
+            if (read == 0) break;
+            total += static_cast<size_t>(read);
+            offset += static_cast<uint64_t>(read);
+        }
+        return total;
+    }
+
+    uint64_t RandomAccessFile::size() const {
+        struct stat info {};
+        if (::fstat(_fd, &info) != 0) {
+            throw std::runtime_error(
+                std::format("Failed to query size of {}: {}", _path.string(), std::strerror(errno)));
+        }
+        return static_cast<uint64_t>(info.st_size);
+    }
+
+    void RandomAccessFile::flush() { ::fsync(_fd); }
+
+    MappedFile::MappedFile(const std::filesystem::path& path) : _path(path) {
+        _fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (_fd < 0) {
+            throw std::runtime_error(std::format("Failed to open file {}: {}", path.string(), std::strerror(errno)));
+        }
+        struct stat info {};
+        if (::fstat(_fd, &info) != 0) {
+            int error = errno;
+            ::close(_fd);
+            throw std::runtime_error(
+                std::format("Failed to query size of {}: {}", path.string(), std::strerror(error)));
+        }
+        _size = static_cast<size_t>(info.st_size);
+        if (_size == 0) return;
+        void* data = ::mmap(nullptr, _size, PROT_READ, MAP_SHARED, _fd, 0);
+        if (data == MAP_FAILED) {
+            int error = errno;
+            ::close(_fd);
+            throw std::runtime_error(std::format("Failed to map file {}: {}", path.string(), std::strerror(error)));
+        }
+        // Lookups jump around the file, read ahead would only fetch pages nobody asked for
+        ::madvise(data, _size, MADV_RANDOM);
+        _data = static_cast<const char*>(data);
+    }
+
+    MappedFile::~MappedFile() {
+        if (_data) ::munmap(const_cast<char*>(_data), _size);
+        if (_fd >= 0) ::close(_fd);
+    }
+
+    SharedMappedFile::SharedMappedFile(const std::filesystem::path& path, size_t size) : _path(path), _size(size) {
+        _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (_fd < 0) {
+            throw std::runtime_error(std::format("Failed to open file {}: {}", path.string(), std::strerror(errno)));
+        }
+        auto fail = [this, &path](std::string_view what) {
+            int error = errno;
+            ::close(_fd);
+            throw std::runtime_error(
+                std::format("Failed to {} file {}: {}", what, path.string(), std::strerror(error)));
+        };
+        // Another process may be creating the same file, only the first one extends it
+        if (::flock(_fd, LOCK_EX) != 0) fail("lock");
+        struct stat info {};
+        if (::fstat(_fd, &info) != 0) fail("query size of");
+        if (static_cast<size_t>(info.st_size) < size && ::ftruncate(_fd, static_cast<off_t>(size)) != 0) fail("resize");
+        ::flock(_fd, LOCK_UN);
+        void* data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        if (data == MAP_FAILED) fail("map");
+        _data = static_cast<char*>(data);
+    }
+
+    SharedMappedFile::~SharedMappedFile() {
+        if (_data) ::munmap(_data, _size);
+        if (_fd >= 0) ::close(_fd);
+    }
+
+    // flock rather than fcntl locks, which a process loses as soon as it closes any descriptor of the file
+    void SharedMappedFile::lockFile() {
+        while (::flock(_fd, LOCK_EX) != 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(std::format("Failed to lock file {}: {}", _path.string(), std::strerror(errno)));
+        }
+    }
+
+    void SharedMappedFile::unlockFile() { ::flock(_fd, LOCK_UN); }
+
+    LockFile::LockFile(const std::filesystem::path& path) : _path(path) {
+        _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (_fd < 0) {
+            throw std::runtime_error(std::format("Failed to open file {}: {}", path.string(), std::strerror(errno)));
+        }
+    }
+
+    LockFile::~LockFile() {
+        if (_fd >= 0) ::close(_fd);
+    }
+
+    void LockFile::lock() {
+        while (::flock(_fd, LOCK_EX) != 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(std::format("Failed to lock file {}: {}", _path.string(), std::strerror(errno)));
+        }
+    }
+
+    bool LockFile::try_lock() {
+        while (::flock(_fd, LOCK_EX | LOCK_NB) != 0) {
+            if (errno == EINTR) continue;
+            if (errno == EWOULDBLOCK) return false;
+            throw std::runtime_error(std::format("Failed to lock file {}: {}", _path.string(), std::strerror(errno)));
+        }
+        return true;
+    }
+
+    void LockFile::unlock() { ::flock(_fd, LOCK_UN); }
+#endif  // _WIN32
+
+    void SharedMappedFile::lock() {
+        _mutex.lock();
+        try {
+            lockFile();
+        } catch (...) {
+            _mutex.unlock();
+            throw;
+        }
+    }
+
+    void SharedMappedFile::unlock() {
+        unlockFile();
+        _mutex.unlock();
+    }
+}  // namespace utils::io